@@ -46,9 +46,10 @@ namespace sys
 		path p(name);
 		ASSERT_LOG(exists(p), "Couldn't read file: " << name);
 		std::ifstream file(p.native(), std::ios_base::binary);
-		std::stringstream ss;
-		ss << file.rdbuf();
-		return ss.str();
+		std::string res(static_cast<size_t>(file_size(p)), '\0');
+		file.read(&res[0], res.size());
+		res.resize(static_cast<size_t>(file.gcount()));
+		return res;
 	}
 
 	void write_file(const std::string& name, const std::string& data)
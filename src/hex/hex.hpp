@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include "hex_chunked_map.hpp"
 #include "hex_fwd.hpp"
 #include "hex_loader.hpp"
 #include "hex_map.hpp"
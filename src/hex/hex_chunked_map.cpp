@@ -0,0 +1,399 @@
+/*
+	Copyright (C) 2013-2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#include <algorithm>
+#include <cstring>
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "asserts.hpp"
+#include "filesystem.hpp"
+#include "hex_chunked_map.hpp"
+#include "hex_loader.hpp"
+#include "hex_map.hpp"
+#include "hex_renderable.hpp"
+#include "profile_timer.hpp"
+#include "unit_test.hpp"
+
+#include "SceneGraph.hpp"
+
+namespace hex
+{
+	namespace
+	{
+		// Every this many cells of a row are indexed, so finding a cell needs at most this many 
+		// commas skipped.
+		const int IndexStride = 256;
+
+		bool is_eol(char c) { return c == '\n' || c == '\r'; }
+		bool is_space(char c) { return c == ' ' || c == '\t'; }
+
+		const char* find_comma(const char* first, const char* last)
+		{
+			const char* p = static_cast<const char*>(std::memchr(first, ',', last - first));
+			return p == nullptr ? last : p;
+		}
+	}
+
+	ChunkedMap::ChunkedMap(int chunk_size)
+		: chunk_size_(chunk_size),
+		  file_(),
+		  region_(),
+		  contents_(),
+		  cell_index_(),
+		  index_stride_(0),
+		  row_ends_(),
+		  width_(0),
+		  height_(0),
+		  chunks_(),
+		  render_parent_()
+	{
+		ASSERT_LOG(chunk_size_ > 0, "Chunk size must be positive: " << chunk_size_);
+	}
+
+	ChunkedMap::ChunkedMap(const std::string& filename, int chunk_size)
+		: ChunkedMap(chunk_size)
+	{
+		ASSERT_LOG(sys::file_exists(filename), "Map file doesn't exist: " << filename);
+		try {
+			using namespace boost::interprocess;
+			file_.reset(new file_mapping(filename.c_str(), read_only));
+			region_.reset(new mapped_region(*file_, read_only));
+		} catch(boost::interprocess::interprocess_exception& e) {
+			ASSERT_LOG(false, "Unable to read map file " << filename << ": " << e.what());
+		}
+		const char* data = static_cast<const char*>(region_->get_address());
+		buildIndex(data, data + region_->get_size());
+	}
+
+	ChunkedMap::~ChunkedMap()
+	{
+		for(auto& chunk : chunks_) {
+			if(chunk.second.renderable != nullptr) {
+				render_parent_->removeNode(chunk.second.renderable);
+			}
+		}
+	}
+
+	ChunkedMapPtr ChunkedMap::create(const std::string& filename, int chunk_size)
+	{
+		return std::make_shared<ChunkedMap>(filename, chunk_size);
+	}
+
+	ChunkedMapPtr ChunkedMap::createFromString(const std::string& contents, int chunk_size)
+	{
+		ChunkedMapPtr cmap(new ChunkedMap(chunk_size));
+		cmap->contents_ = contents;
+		cmap->buildIndex(cmap->contents_.data(), cmap->contents_.data() + cmap->contents_.size());
+		return cmap;
+	}
+
+	void ChunkedMap::buildIndex(const char* first, const char* last)
+	{
+		profile::manager pman("ChunkedMap::buildIndex()");
+		const char* it = first;
+		while(it != last) {
+			if(is_eol(*it)) {
+				++it;
+				continue;
+			}
+			const char* line_end = std::find_if(it, last, is_eol);
+			if(std::all_of(it, line_end, is_space)) {
+				it = line_end;
+				continue;
+			}
+			int x = 0;
+			for(const char* cell = it; ; ++x) {
+				if(x % IndexStride == 0) {
+					cell_index_.emplace_back(cell);
+				}
+				const char* comma = find_comma(cell, line_end);
+				if(comma == line_end) {
+					break;
+				}
+				cell = comma + 1;
+			}
+			if(height_ == 0) {
+				width_ = x + 1;
+				index_stride_ = static_cast<int>(cell_index_.size());
+			}
+			ASSERT_LOG(x + 1 == width_, "Row " << height_ << " of the map has " << (x + 1) << " hexes, expected " << width_);
+			row_ends_.emplace_back(line_end);
+			++height_;
+			it = line_end;
+		}
+		LOG_INFO("ChunkedMap size: " << width_ << "," << height_ << " in chunks of " << chunk_size_);
+	}
+
+	const char* ChunkedMap::getCell(int x, int y) const
+	{
+		const char* cell = cell_index_[y * index_stride_ + x / IndexStride];
+		for(int n = x % IndexStride; n != 0; --n) {
+			cell = find_comma(cell, row_ends_[y]) + 1;
+		}
+		return cell;
+	}
+
+	std::string ChunkedMap::getMapData(const rect& area) const
+	{
+		std::string res;
+		for(int y = area.y1(); y < area.y2(); ++y) {
+			const char* first = getCell(area.x1(), y);
+			const char* last = first;
+			for(int x = area.x1(); x < area.x2(); ++x) {
+				last = find_comma(last, row_ends_[y]);
+				if(x + 1 != area.x2()) {
+					++last;
+				}
+			}
+			res.append(first, last);
+			res += '\n';
+		}
+		return res;
+	}
+
+	void ChunkedMap::setRenderParent(const KRE::SceneNodePtr& parent)
+	{
+		for(auto& chunk : chunks_) {
+			if(chunk.second.renderable != nullptr) {
+				render_parent_->removeNode(chunk.second.renderable);
+				chunk.second.renderable.reset();
+			}
+		}
+		render_parent_ = parent;
+		if(render_parent_ == nullptr) {
+			return;
+		}
+		for(auto& chunk : chunks_) {
+			chunk.second.renderable = std::dynamic_pointer_cast<MapNode>(render_parent_->getParentGraph()->createNode("hex_map"));
+			chunk.second.map->setRenderable(chunk.second.renderable);
+			render_parent_->attachNode(chunk.second.renderable);
+		}
+	}
+
+	void ChunkedMap::setViewArea(const rect& area)
+	{
+		const int x1 = std::max(0, area.x1()), x2 = std::min(width_, area.x2());
+		const int y1 = std::max(0, area.y1()), y2 = std::min(height_, area.y2());
+		if(x1 >= x2 || y1 >= y2) {
+			while(!chunks_.empty()) {
+				unloadChunk(chunks_.begin()->first);
+			}
+			return;
+		}
+		const rect chunk_area = rect::from_coordinates(x1 / chunk_size_, y1 / chunk_size_, (x2 - 1) / chunk_size_, (y2 - 1) / chunk_size_);
+
+		std::vector<point> unload;
+		for(const auto& chunk : chunks_) {
+			const point& p = chunk.first;
+			if(p.x < chunk_area.x1() - 1 || p.x > chunk_area.x2() || p.y < chunk_area.y1() - 1 || p.y > chunk_area.y2()) {
+				unload.emplace_back(p);
+			}
+		}
+		for(const auto& p : unload) {
+			unloadChunk(p);
+		}
+		for(int cy = chunk_area.y1(); cy < chunk_area.y2(); ++cy) {
+			for(int cx = chunk_area.x1(); cx < chunk_area.x2(); ++cx) {
+				if(chunks_.find(point(cx, cy)) == chunks_.end()) {
+					loadChunk(point(cx, cy));
+				}
+			}
+		}
+	}
+
+	void ChunkedMap::loadChunk(const point& chunk)
+	{
+		const rect area(chunk.x * chunk_size_, chunk.y * chunk_size_, chunk_size_, chunk_size_);
+		// The chunk is built as part of a larger map taken from the file, with enough margin that 
+		// the matches covering its hexes see the same surroundings as a build of the whole map 
+		// does, as HexMap::setTile() does. That holds as long as no rule spreads a flag across the
+		// map by matching on flags it sets itself, which no rule in the terrain data does.
+		const int margin = 2 * get_terrain_rule_radius();
+		const rect build_area = rect::from_coordinates(std::max(0, area.x1() - margin), 
+			std::max(0, area.y1() - margin), 
+			std::min(width_, area.x2() + margin) - 1, 
+			std::min(height_, area.y2() + margin) - 1);
+		auto hmap = HexMap::createFromString(getMapData(build_area), build_area.top_left());
+		// The rules' random choices are seeded from the hex positions, so a chunk looks the same 
+		// each time it's loaded whatever else has been loaded.
+		hmap->build();
+
+		Chunk& c = chunks_[chunk];
+		c.map = hmap->getRegion(area, true);
+		if(render_parent_ != nullptr) {
+			c.renderable = std::dynamic_pointer_cast<MapNode>(render_parent_->getParentGraph()->createNode("hex_map"));
+			c.map->setRenderable(c.renderable);
+			render_parent_->attachNode(c.renderable);
+		}
+	}
+
+	void ChunkedMap::unloadChunk(const point& chunk)
+	{
+		auto it = chunks_.find(chunk);
+		ASSERT_LOG(it != chunks_.end(), "Chunk isn't loaded: " << chunk);
+		if(it->second.renderable != nullptr) {
+			render_parent_->removeNode(it->second.renderable);
+		}
+		chunks_.erase(it);
+	}
+
+	void ChunkedMap::process()
+	{
+		for(auto& chunk : chunks_) {
+			chunk.second.map->process();
+		}
+	}
+
+	HexMapPtr ChunkedMap::getChunk(const point& chunk) const
+	{
+		auto it = chunks_.find(chunk);
+		return it == chunks_.end() ? nullptr : it->second.map;
+	}
+
+	MapNodePtr ChunkedMap::getChunkRenderable(const point& chunk) const
+	{
+		auto it = chunks_.find(chunk);
+		return it == chunks_.end() ? nullptr : it->second.renderable;
+	}
+
+	const HexObject* ChunkedMap::getTileAt(const point& p) const
+	{
+		if(p.x < 0 || p.y < 0 || p.x >= width_ || p.y >= height_) {
+			return nullptr;
+		}
+		auto it = chunks_.find(point(p.x / chunk_size_, p.y / chunk_size_));
+		return it == chunks_.end() ? nullptr : it->second.map->getTileAt(p);
+	}
+}
+
+namespace
+{
+	void check_same_tiles(const hex::HexObject& expected, const hex::HexObject* actual)
+	{
+		CHECK(actual != nullptr, "no tile at " << expected.getPosition());
+		CHECK_EQ(actual->getFullTypeId(), expected.getFullTypeId());
+		for(int flag = 0; flag != hex::flag_count(); ++flag) {
+			CHECK(actual->hasFlagIndex(flag) == expected.hasFlagIndex(flag), "flag " << flag << " differs at " << expected.getPosition());
+		}
+		const auto images = actual->getImages();
+		const auto expected_images = expected.getImages();
+		CHECK(images.size() == expected_images.size() && std::equal(images.begin(), images.end(), expected_images.begin()), 
+			"images differ at " << expected.getPosition());
+	}
+}
+
+// Each chunk, built with its margin, has the same flags and images as a build of the whole map.
+UNIT_TEST(hex_chunked_map_matches_build)
+{
+	hex::ScopedTerrainConfig config(hex::get_test_terrain_config(false));
+	const std::string contents = hex::get_test_map_data();
+	auto expected = hex::HexMap::createFromString(contents);
+	expected->build();
+
+	// Chunks which don't divide the map evenly.
+	const int chunk_size = 4;
+	auto cmap = hex::ChunkedMap::createFromString(contents, chunk_size);
+	cmap->setViewArea(rect(0, 0, cmap->getWidth(), cmap->getHeight()));
+	for(const auto& tile : expected->getTiles()) {
+		const point& p = tile.getPosition();
+		auto chunk = cmap->getChunk(point(p.x / chunk_size, p.y / chunk_size));
+		CHECK(chunk != nullptr, "Chunk holding " << p << " isn't loaded");
+		check_same_tiles(tile, chunk->getTileAt(p));
+	}
+	CHECK(std::any_of(expected->getTiles().cbegin(), expected->getTiles().cend(), [](const hex::HexObject& hex) { return !hex.getImages().empty(); }), 
+		"no rules matched");
+}
+
+// Chunks attach their renderables to the render parent when loaded and remove them when unloaded,
+// and a reloaded chunk is still built the same as the whole map.
+UNIT_TEST(hex_chunked_map_reload_chunks)
+{
+	hex::ScopedTerrainConfig config(hex::get_test_terrain_config(false));
+	auto scene = KRE::SceneGraph::create("hex_chunked_map_reload_chunks");
+	auto parent = scene->createNode();
+	scene->getRootNode()->attachNode(parent);
+	auto expected = hex::HexMap::createFromString(hex::get_test_map_data());
+	expected->build();
+	auto cmap = hex::ChunkedMap::createFromString(hex::get_test_map_data(), 4);
+	cmap->setRenderParent(parent);
+
+	// The left column of chunks, then the right column, which is far enough away that the left 
+	// column is unloaded, then the left column again.
+	const rect left(0, 0, 4, cmap->getHeight());
+	const rect right(8, 0, 4, cmap->getHeight());
+	cmap->setViewArea(left);
+	CHECK_EQ(cmap->getLoadedChunkCount(), 3);
+	CHECK(cmap->getChunk(point(0, 0)) != nullptr, "Chunk 0,0 isn't loaded");
+	auto renderable = cmap->getChunkRenderable(point(0, 0));
+	CHECK(renderable != nullptr, "Chunk 0,0 has no renderable");
+	CHECK(renderable->getParent() == parent, "Chunk 0,0 isn't rendered under the render parent");
+	std::weak_ptr<hex::MapNode> first_renderable = renderable;
+	renderable.reset();
+
+	cmap->setViewArea(right);
+	CHECK_EQ(cmap->getLoadedChunkCount(), 3);
+	CHECK(cmap->getChunk(point(0, 0)) == nullptr, "Chunk 0,0 wasn't unloaded");
+	CHECK(first_renderable.expired(), "The unloaded chunk's renderable is still in the scene");
+
+	cmap->setViewArea(left);
+	CHECK_EQ(cmap->getLoadedChunkCount(), 3);
+	auto reloaded = cmap->getChunk(point(0, 0));
+	CHECK(reloaded != nullptr, "Chunk 0,0 wasn't reloaded");
+	renderable = cmap->getChunkRenderable(point(0, 0));
+	CHECK(renderable != nullptr, "The reloaded chunk 0,0 has no renderable");
+	CHECK(renderable->getParent() == parent, "The reloaded chunk 0,0 isn't rendered under the render parent");
+	for(const auto& tile : reloaded->getTiles()) {
+		check_same_tiles(*expected->getTileAt(tile.getPosition()), &tile);
+	}
+
+	std::weak_ptr<hex::MapNode> last_renderable = renderable;
+	renderable.reset();
+	reloaded.reset();
+	cmap.reset();
+	CHECK(last_renderable.expired(), "The chunks' renderables outlived the map");
+}
+
+// Scrolls a view across a large map by one chunk each iteration, so each iteration loads and
+// builds a new column of chunks and unloads an old one.
+BENCHMARK_ARG(hex_chunked_map_scroll, const std::string& args)
+{
+	const auto map_args = hex::parse_benchmark_map_args(args, 2, 2, "map file, map size and view width and height");
+	const int size = map_args.size;
+	const int view_w = boost::lexical_cast<int>(map_args.params[0]);
+	const int view_h = boost::lexical_cast<int>(map_args.params[1]);
+	auto cmap = hex::ChunkedMap::createFromString(map_args.data);
+	const int step = cmap->getChunkSize();
+	int x = 0;
+	cmap->setViewArea(rect(x, 0, view_w, view_h));
+	test::reset_benchmark_timer();
+	BENCHMARK_LOOP {
+		x = (x + step) % (size - view_w);
+		cmap->setViewArea(rect(x, 0, view_w, view_h));
+	}
+}
+
+BENCHMARK_ARG_CALL(hex_chunked_map_scroll, synthetic1024, "data/maps/test01.map 1024 64 48")
@@ -0,0 +1,114 @@
+/*
+	Copyright (C) 2013-2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "geometry.hpp"
+#include "hex_fwd.hpp"
+#include "hex_renderable_fwd.hpp"
+#include "SceneFwd.hpp"
+
+namespace boost
+{
+	namespace interprocess
+	{
+		class file_mapping;
+		class mapped_region;
+	}
+}
+
+namespace hex
+{
+	// A map which is loaded, built and rendered in square chunks of hexes, so that only the chunks
+	// around the area being looked at need to be in memory. The map file is memory mapped and 
+	// indexed when it's opened, but each chunk is only parsed when it's loaded.
+	class ChunkedMap
+	{
+	public:
+		static const int DefaultChunkSize = 32;
+
+		ChunkedMap(const std::string& filename, int chunk_size);
+		~ChunkedMap();
+
+		// Chunks are rendered as children of parent once it's set.
+		void setRenderParent(const KRE::SceneNodePtr& parent);
+		// Loads and builds the chunks which overlap area, given in hexes, and unloads any chunks 
+		// that are further than one chunk from it.
+		void setViewArea(const rect& area);
+		// Updates the renderables of the loaded chunks.
+		void process();
+
+		int getWidth() const { return width_; }
+		int getHeight() const { return height_; }
+		int getChunkSize() const { return chunk_size_; }
+		int getLoadedChunkCount() const { return static_cast<int>(chunks_.size()); }
+		// The map of the loaded chunk with the given chunk co-ordinates, or nullptr.
+		HexMapPtr getChunk(const point& chunk) const;
+		// The renderable of the loaded chunk, or nullptr if it isn't loaded or there's no render
+		// parent.
+		MapNodePtr getChunkRenderable(const point& chunk) const;
+		// nullptr if p is outside the map or its chunk isn't loaded.
+		const HexObject* getTileAt(const point& p) const;
+
+		static ChunkedMapPtr create(const std::string& filename, int chunk_size=DefaultChunkSize);
+		static ChunkedMapPtr createFromString(const std::string& contents, int chunk_size=DefaultChunkSize);
+	private:
+		explicit ChunkedMap(int chunk_size);
+		void buildIndex(const char* first, const char* last);
+		// Map data for the hexes within area, in the same format as the map file.
+		std::string getMapData(const rect& area) const;
+		// Start of the cell at x on row y.
+		const char* getCell(int x, int y) const;
+		void loadChunk(const point& chunk);
+		void unloadChunk(const point& chunk);
+
+		int chunk_size_;
+		std::unique_ptr<boost::interprocess::file_mapping> file_;
+		std::unique_ptr<boost::interprocess::mapped_region> region_;
+		std::string contents_;
+		// The start of every IndexStride'th cell of each row, index_stride_ entries per row, and 
+		// the end of each row.
+		std::vector<const char*> cell_index_;
+		int index_stride_;
+		std::vector<const char*> row_ends_;
+		int width_;
+		int height_;
+
+		struct Chunk
+		{
+			HexMapPtr map;
+			MapNodePtr renderable;
+		};
+		std::map<point, Chunk> chunks_;
+		KRE::SceneNodePtr render_parent_;
+
+		ChunkedMap(const ChunkedMap&) = delete;
+		void operator=(const ChunkedMap&) = delete;
+	};
+}
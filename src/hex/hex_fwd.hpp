@@ -36,6 +36,15 @@ namespace hex
 	class HexMap;
 	typedef std::shared_ptr<HexMap> HexMapPtr;
 
+	class ChunkedMap;
+	typedef std::shared_ptr<ChunkedMap> ChunkedMapPtr;
+
 	class HexObject;
 	struct ImageHolder;
+
+	namespace cache
+	{
+		class Reader;
+		class Writer;
+	}
 }
@@ -21,14 +21,22 @@
 	   distribution.
 */
 
+#include <algorithm>
+#include <functional>
+#include <numeric>
+
 #include "asserts.hpp"
 
 #include "json.hpp"
 #include "filesystem.hpp"
 #include "hex_loader.hpp"
 #include "hex_tile.hpp"
+#include "rule_cache.hpp"
 #include "tile_rules.hpp"
 #include "profile_timer.hpp"
+#include "DisplayDevice.hpp"
+#include "JobSystem.hpp"
+#include "Surface.hpp"
 
 namespace
 {
@@ -39,6 +47,12 @@ namespace
 		return res;
 	}
 
+	std::vector<hex::string_id>& get_tile_type_ids()
+	{
+		static std::vector<hex::string_id> res;
+		return res;
+	}
+
 	hex::terrain_rule_type& get_terrain_rules()
 	{
 		static hex::terrain_rule_type res;
@@ -66,19 +80,101 @@ namespace
 		static texture_map_type res;
 		return res;
 	}
+
+	// Where each terrain image was placed in its texture, when the images are packed together.
+	typedef std::map<std::string, point> texture_offset_map_type;
+	texture_offset_map_type& get_texture_offsets()
+	{
+		static texture_offset_map_type res;
+		return res;
+	}
+
+	// Packed textures are kept small enough that 16-bit texture co-ordinates address them to 
+	// within a fraction of a pixel. Images are spaced apart to stop filtering blending them.
+	const int max_packed_texture_size = 8192;
+	const int packed_texture_padding = 2;
+
+	// Packs the terrain images into as few textures as will hold them, on shelves in order of 
+	// height. Layers are made for each texture, so this cuts the number of draw calls.
+	void pack_textures(const std::vector<std::pair<std::string, std::string>>& images, const std::vector<KRE::SurfacePtr>& surfaces, int max_size)
+	{
+		std::vector<size_t> order(images.size());
+		std::iota(order.begin(), order.end(), 0);
+		std::sort(order.begin(), order.end(), [&surfaces, &images](size_t a, size_t b) {
+			if(surfaces[a]->height() != surfaces[b]->height()) {
+				return surfaces[a]->height() > surfaces[b]->height();
+			}
+			return images[a].first < images[b].first;
+		});
+
+		struct PackedTexture
+		{
+			PackedTexture() : placed(), width(0), height(0) {}
+			std::vector<std::pair<size_t, point>> placed;
+			int width;
+			int height;
+		};
+		std::vector<PackedTexture> packed(1);
+		int x = 0;
+		int y = 0;
+		int shelf_height = 0;
+		for(const size_t ndx : order) {
+			const int w = surfaces[ndx]->width();
+			const int h = surfaces[ndx]->height();
+			ASSERT_LOG(w <= max_size && h <= max_size, "Terrain image " << images[ndx].second << " is larger than the packed texture size: " << w << "x" << h << " > " << max_size);
+			if(x + w > max_size) {
+				x = 0;
+				y += shelf_height + packed_texture_padding;
+				shelf_height = 0;
+			}
+			if(y + h > max_size) {
+				packed.emplace_back();
+				x = y = shelf_height = 0;
+			}
+			auto& pt = packed.back();
+			pt.placed.emplace_back(ndx, point(x, y));
+			pt.width = std::max(pt.width, x + w);
+			pt.height = std::max(pt.height, y + h);
+			x += w + packed_texture_padding;
+			shelf_height = std::max(shelf_height, h);
+		}
+
+		for(const auto& pt : packed) {
+			auto surface = KRE::Surface::create(pt.width, pt.height, KRE::PixelFormat::PF::PIXELFORMAT_ABGR8888);
+			for(const auto& p : pt.placed) {
+				const auto& src = surfaces[p.first];
+				// Copy the pixels as they are rather than blending them onto the empty surface.
+				const auto bm = src->getBlendMode();
+				src->setBlendMode(KRE::Surface::BLEND_MODE_NONE);
+				surface->blitTo(src, rect(0, 0, src->width(), src->height()), rect(p.second.x, p.second.y, src->width(), src->height()));
+				src->setBlendMode(bm);
+			}
+			auto tex = KRE::Texture::createTexture(surface);
+			for(const auto& p : pt.placed) {
+				get_textures()[images[p.first].first] = tex;
+				get_texture_offsets()[images[p.first].first] = p.second;
+			}
+		}
+		LOG_INFO("Packed " << images.size() << " terrain textures into " << packed.size() << " of up to " << max_size << "x" << max_size);
+	}
 }
 
 namespace hex
 {
 	void load_terrain_files(const variant& v);
 	void load_tile_data(const variant& v);
-	void load_terrain_data(const variant& v);
+	terrain_rule_type parse_terrain_rules(const std::string& filename);
+	void add_terrain_rule(const TerrainRulePtr& tr);
+	bool load_cache(const std::string& filename, uint64_t source_hash);
+	void write_cache(const std::string& filename, uint64_t source_hash);
 
-	void load(const std::string& base_path)
+	void load(const std::string& base_path, bool pack)
 	{
-		// XXX we should make this a threaded load.
-		// Load terrain textures first
-		profile::manager pman("load_hex_textures");
+		profile::timer total_timer;
+		total_timer.start();
+
+		// Terrain texture names with the file to load each one from.
+		std::vector<std::pair<std::string, std::string>> images;
 		sys::file_path_map files;
 // temporary cheap hack
 #ifdef __linux__
@@ -89,27 +185,213 @@ namespace hex
 #endif
 		for(const auto& p : files) {
 			auto pos = p.second.find("images/");
-			std::string fname = p.second.substr(pos + 7);
-			get_textures().emplace("terrain/" + p.first, KRE::Texture::createTexture(fname));
+			images.emplace_back("terrain/" + p.first, p.second.substr(pos + 7));
 		}
 
-		// Load hex data from files -- order of initialization is important.
-		try {
-			hex::load_tile_data(json::parse_from_file(base_path + "terrain.cfg"));
-		} catch(json::parse_error& e) {		
-			ASSERT_LOG(false, "Error parsing hex " << (base_path + "terrain.cfg") << " file data: " << e.what());
+		// The terrain data doesn't use the textures, so it's loaded while they are.
+		auto& js = KRE::JobSystem::getInstance();
+		KRE::JobGroup data_loaded;
+		double data_time = 0;
+		TerrainConfigSource data_source = TerrainConfigSource::ALREADY_LOADED;
+		js.run(data_loaded, [&base_path, &data_time, &data_source]() {
+			profile::timer t;
+			t.start();
+			data_source = load_terrain_config(base_path);
+			data_time = t.check();
+		});
+
+		// The images are decoded as jobs, but the textures have to be created on this thread as
+		// it has the rendering context. Each decode queues the creation of its texture on this
+		// thread, which runs while it waits for the decodes and helps with them.
+		KRE::JobGroup decoded;
+		KRE::JobGroup uploaded;
+		std::vector<double> decode_times(images.size());
+		std::vector<KRE::SurfacePtr> surfaces(pack ? images.size() : 0);
+		double upload_time = 0;
+		for(size_t n = 0; n != images.size(); ++n) {
+			js.run(decoded, [&js, &images, &decode_times, &surfaces, &uploaded, &upload_time, pack, n]() {
+				profile::timer t;
+				t.start();
+				auto surface = KRE::Surface::create(images[n].second, KRE::SurfaceFlags::NO_CACHE);
+				decode_times[n] = t.check();
+				if(pack) {
+					surfaces[n] = surface;
+					return;
+				}
+				js.runOnMainThread(uploaded, [&images, &upload_time, surface, n]() {
+					profile::timer t;
+					t.start();
+					get_textures().emplace(images[n].first, KRE::Texture::createTexture(surface));
+					upload_time += t.check();
+				});
+			});
 		}
 		try {
-			hex::load_terrain_files(json::parse_from_file(base_path + "terrain-file-data.cfg"));
-		} catch(json::parse_error& e) {
-			ASSERT_LOG(false, "Error parsing hex " << (base_path + "terrain-file-data.cfg") << " file data: " << e.what());
+			// The decodes are waited for first, as they queue the uploads.
+			js.wait(decoded);
+			js.wait(uploaded);
+			if(pack && !images.empty()) {
+				profile::timer t;
+				t.start();
+				const int max_size = KRE::DisplayDevice::getCurrent()->queryParameteri(KRE::DisplayDeviceParameters::MAX_TEXTURE_SIZE);
+				pack_textures(images, surfaces, max_size > 0 ? std::min(max_size, max_packed_texture_size) : max_packed_texture_size);
+				upload_time += t.check();
+			}
+		} catch(...) {
+			// The jobs refer to this function's locals, so they have to finish before it returns.
+			for(auto group : {&decoded, &uploaded, &data_loaded}) {
+				try {
+					js.wait(*group);
+				} catch(...) {
+				}
+			}
+			throw;
 		}
+		const double texture_time = total_timer.check();
+		js.wait(data_loaded);
+
+		LOG_INFO("Loaded " << images.size() << " terrain textures and terrain data in " << (total_timer.check() * 1000.0) << " ms: "
+			<< "decode " << (std::accumulate(decode_times.begin(), decode_times.end(), 0.0) * 1000.0) << " ms on " << (js.getThreadCount() + 1) << " threads, "
+			<< "upload " << (upload_time * 1000.0) << " ms, textures ready after " << (texture_time * 1000.0) << " ms, "
+			<< (data_source == TerrainConfigSource::CFG_FILES ? "parse " : data_source == TerrainConfigSource::CACHE ? "cache read " : "already loaded ") 
+			<< (data_time * 1000.0) << " ms");
+	}
+
+	TerrainConfigSource load_terrain_config(const std::string& base_path)
+	{
+		if(!get_tile_map().empty()) {
+			return TerrainConfigSource::ALREADY_LOADED;
+		}
+
+		// The terrain data is taken from the cache if it was built from the current files.
+		const std::vector<std::string> files = {
+			base_path + "terrain.cfg", 
+			base_path + "terrain-file-data.cfg", 
+			base_path + "terrain-graphics.cfg" 
+		};
+		const uint64_t source_hash = cache::hash_files(files);
+		const std::string cache_file = base_path + "terrain.cache";
+		if(load_cache(cache_file, source_hash)) {
+			return TerrainConfigSource::CACHE;
+		}
+
+		// Each file is loaded as a job. The rules refer to the terrain types, and both intern 
+		// strings, which isn't thread safe, so the rules are parsed once the types are loaded.
+		// The terrain file information is loaded alongside them.
+		auto& js = KRE::JobSystem::getInstance();
+		KRE::JobGroup types_loaded;
+		KRE::JobGroup parsed;
+		std::vector<double> parse_times(files.size());
+		auto parse_job = [&files, &parse_times](size_t n, const std::function<void(const std::string&)>& fn) {
+			return [&files, &parse_times, n, fn]() {
+				profile::timer t;
+				t.start();
+				try {
+					fn(files[n]);
+				} catch(json::parse_error& e) {
+					ASSERT_LOG(false, "Error parsing hex " << files[n] << " file data: " << e.what());
+				}
+				parse_times[n] = t.check();
+			};
+		};
+		terrain_rule_type rules;
+		js.run(types_loaded, parse_job(0, [](const std::string& filename) { 
+			hex::load_tile_data(json::parse_from_file(filename, true)); 
+		}));
+		js.run(parsed, parse_job(1, [](const std::string& filename) { 
+			hex::load_terrain_files(json::parse_from_file(filename, true)); 
+		}));
+		js.runAfter(types_loaded, parsed, parse_job(2, [&rules](const std::string& filename) { 
+			rules = parse_terrain_rules(filename); 
+		}));
 		try {
-			hex::load_terrain_data(json::parse_from_file(base_path + "terrain-graphics.cfg"));
-		} catch(json::parse_error& e) {		
-			ASSERT_LOG(false, "Error parsing hex " << (base_path + "terrain-graphics.cfg") << " file data: " << e.what());
+			js.wait(types_loaded);
+		} catch(...) {
+			// The jobs refer to this function's locals, so they have to finish before it returns.
+			try {
+				js.wait(parsed);
+			} catch(...) {
+			}
+			throw;
+		}
+		js.wait(parsed);
+
+		// Whether a rule has any images to use depends on the file information.
+		profile::timer t;
+		t.start();
+		for(const auto& tr : rules) {
+			add_terrain_rule(tr);
+		}
+		LOG_INFO("Loaded " << ::get_terrain_rules().size() << " of " << rules.size() << " terrain rules. Parsed " 
+			<< files[0] << " in " << (parse_times[0] * 1000.0) << " ms, " 
+			<< files[1] << " in " << (parse_times[1] * 1000.0) << " ms and " 
+			<< files[2] << " in " << (parse_times[2] * 1000.0) << " ms, then checked the rule images in " << (t.check() * 1000.0) << " ms");
+		write_cache(cache_file, source_hash);
+		return TerrainConfigSource::CFG_FILES;
+	}
+
+	bool load_cache(const std::string& filename, uint64_t source_hash)
+	{
+		profile::manager pman("load_terrain_cache");
+		const bool loaded = cache::read_file(filename, source_hash, [](cache::Reader& r) {
+			const int tile_count = r.readCount();
+			for(int n = 0; n != tile_count; ++n) {
+				auto tile = HexTile::create(r);
+				if(get_tile_map().find(tile->getString()) != get_tile_map().end()) {
+					throw cache::load_error("duplicate tile " + tile->getString());
+				}
+				get_tile_map()[tile->getString()] = tile;
+				::get_tile_type_ids().emplace_back(intern_string(tile->getString()));
+			}
+			const int file_count = r.readCount();
+			for(int n = 0; n != file_count; ++n) {
+				const std::string& name = r.readString();
+				const std::string& image_name = r.readString();
+				const rect area = r.readRect();
+				get_file_info().emplace(name, TerrainFileInfo(image_name, area, r.readInts()));
+			}
+			const int rule_count = r.readCount();
+			for(int n = 0; n != rule_count; ++n) {
+				::get_terrain_rules().emplace_back(TerrainRule::create(r));
+				::get_terrain_rules().back()->setIndex(n);
+			}
+		});
+		if(!loaded) {
+			// Start again from the .cfg files.
+			get_tile_map().clear();
+			::get_tile_type_ids().clear();
+			get_file_info().clear();
+			::get_terrain_rules().clear();
+			return false;
+		}
+		LOG_INFO("Loaded " << get_tile_map().size() << " hex tiles, information for " << get_file_info().size() 
+			<< " terrain files and " << ::get_terrain_rules().size() << " terrain rules from " << filename);
+		return true;
+	}
+
+	void write_cache(const std::string& filename, uint64_t source_hash)
+	{
+		profile::manager pman("write_terrain_cache");
+		cache::Writer w;
+		// In the order they were loaded, so the tiles get the same interned ids.
+		w.writeInt(static_cast<int>(::get_tile_type_ids().size()));
+		for(auto id : ::get_tile_type_ids()) {
+			get_tile_map()[get_interned_string(id)]->writeCache(w);
+		}
+		w.writeInt(static_cast<int>(get_file_info().size()));
+		for(const auto& fi : get_file_info()) {
+			w.writeString(fi.first);
+			w.writeString(fi.second.image_name);
+			w.writeRect(fi.second.area);
+			w.writeInts(fi.second.border);
+		}
+		w.writeInt(static_cast<int>(::get_terrain_rules().size()));
+		for(const auto& tr : ::get_terrain_rules()) {
+			tr->writeCache(w);
+		}
+		if(cache::write_file(filename, w.finish(source_hash))) {
+			LOG_INFO("Wrote terrain cache " << filename);
 		}
-	
 	}
 
 	void load_tile_data(const variant& v)
@@ -176,27 +458,38 @@ namespace hex
 			auto it = get_tile_map().find(string);
 			ASSERT_LOG(it == get_tile_map().end(), "Duplicate tile string id's found: " << string);
 			get_tile_map()[string] = tile;
+			::get_tile_type_ids().emplace_back(intern_string(string));
 		}
 		LOG_INFO("Loaded " << get_tile_map().size() << " hex tiles into memory.");
 	}
 
-	void load_terrain_data(const variant& v)
+	terrain_rule_type parse_terrain_rules(const std::string& filename)
 	{
-		profile::manager pman("load_terrain_data");
-		ASSERT_LOG(v.is_map() && v.has_key("terrain_graphics") && v["terrain_graphics"].is_list(), 
-			"Expected hex tile data to be a map with 'terrain_type' key.");
-		const auto& tg_data = v["terrain_graphics"].as_list();
-		for(const auto& tg : tg_data) {
-			ASSERT_LOG(tg.is_map(), "Expected inner items of 'terrain_type' to be maps." << tg.to_debug_string());
-			auto tr = TerrainRule::create(tg);
-			if(tr->tryEliminate()) {
-				::get_terrain_rules().emplace_back(tr);
-				//LOG_INFO("Keep Rule: " << tr->toString());
-			} else {
-				//LOG_INFO("Removed Rule: " << tr->toString());
-			}
+		profile::manager pman("parse_terrain_rules");
+		// Each entry of the 'terrain_graphics' list is turned into a rule as soon as it has been 
+		// parsed, rather than building the whole file first.
+		terrain_rule_type rules;
+		json::variant_builder builder(2, [&rules](const variant& tg) {
+			ASSERT_LOG(tg.is_map(), "Expected inner items of 'terrain_graphics' to be maps." << tg.to_debug_string());
+			rules.emplace_back(TerrainRule::create(tg));
+		}, true);
+		json::parse_from_file(filename, builder);
+		const variant& v = builder.get();
+		ASSERT_LOG(v.is_map() && v.has_key("terrain_graphics") && v["terrain_graphics"].is_list() && v.num_elements() == 1, 
+			"Expected hex tile data to be a map with only a 'terrain_graphics' key.");
+		return rules;
+	}
+
+	// Adds the rule unless it has no images to use.
+	void add_terrain_rule(const TerrainRulePtr& tr)
+	{
+		if(tr->tryEliminate()) {
+			tr->setIndex(static_cast<int>(::get_terrain_rules().size()));
+			::get_terrain_rules().emplace_back(tr);
+			//LOG_INFO("Keep Rule: " << tr->toString());
+		} else {
+			//LOG_INFO("Removed Rule: " << tr->toString());
 		}
-		LOG_INFO("Loaded " << get_terrain_rules().size() << " terrain rules into memory.");
 	}
 
 	void load_terrain_files(const variant& v)
@@ -228,6 +521,20 @@ namespace hex
 		return ::get_terrain_rules();
 	}
 
+	int get_terrain_rule_radius()
+	{
+		int radius = 0;
+		for(const auto& tr : ::get_terrain_rules()) {
+			radius = std::max(radius, tr->getFootprintSize());
+		}
+		return radius;
+	}
+
+	const std::vector<string_id>& get_tile_type_ids()
+	{
+		return ::get_tile_type_ids();
+	}
+
 	KRE::TexturePtr get_terrain_texture(const std::string& filename, rect* area, std::vector<int>* borders)
 	{
 		auto& fileinfo = get_file_info();
@@ -235,6 +542,10 @@ namespace hex
 		if(it != fileinfo.end()) {
 			if(area) {
 				*area = it->second.area;
+				auto offset_it = get_texture_offsets().find(it->second.image_name);
+				if(offset_it != get_texture_offsets().end()) {
+					*area = rect(area->x() + offset_it->second.x, area->y() + offset_it->second.y, area->w(), area->h());
+				}
 			}
 			if(borders) {
 				*borders = it->second.border;
@@ -251,4 +562,34 @@ namespace hex
 	{
 		return get_file_info().find(name) != get_file_info().end();
 	}
+
+	struct ScopedTerrainConfig::Saved
+	{
+		tile_map_type tile_map;
+		std::vector<string_id> tile_type_ids;
+		file_info_map_type file_info;
+		terrain_rule_type terrain_rules;
+	};
+
+	ScopedTerrainConfig::ScopedTerrainConfig(const variant& v)
+		: saved_(new Saved)
+	{
+		saved_->tile_map.swap(get_tile_map());
+		saved_->tile_type_ids.swap(::get_tile_type_ids());
+		saved_->file_info.swap(get_file_info());
+		saved_->terrain_rules.swap(::get_terrain_rules());
+		load_tile_data(v);
+		load_terrain_files(v["files"]);
+		for(const auto& tg : v["terrain_graphics"].as_list()) {
+			add_terrain_rule(TerrainRule::create(tg));
+		}
+	}
+
+	ScopedTerrainConfig::~ScopedTerrainConfig()
+	{
+		get_tile_map().swap(saved_->tile_map);
+		::get_tile_type_ids().swap(saved_->tile_type_ids);
+		get_file_info().swap(saved_->file_info);
+		::get_terrain_rules().swap(saved_->terrain_rules);
+	}
 }
@@ -25,6 +25,7 @@
 
 #include "variant.hpp"
 #include "hex_fwd.hpp"
+#include "string_intern.hpp"
 
 #include "Texture.hpp"
 
@@ -34,8 +35,39 @@ namespace hex
 
 	HexTilePtr get_tile_from_type(const std::string& type_str);
 	const terrain_rule_type& get_terrain_rules();
+	// The largest footprint of any terrain rule, i.e. the furthest apart two hexes a rule matches 
+	// against can be.
+	int get_terrain_rule_radius();
+	// Interned codes of all the terrain types in terrain.cfg.
+	const std::vector<string_id>& get_tile_type_ids();
 	KRE::TexturePtr get_terrain_texture(const std::string& filename, rect* area, std::vector<int>* borders);
 	bool terrain_info_exists(const std::string& name);
 
-	void load(const std::string& base_path);
+	// With pack set the terrain images are packed into as few textures as possible, so maps are
+	// drawn with fewer layers.
+	void load(const std::string& base_path, bool pack=false);
+	// Where load_terrain_config() got the terrain data from.
+	enum class TerrainConfigSource {
+		ALREADY_LOADED,
+		CACHE,
+		CFG_FILES,
+	};
+	// Loads the terrain types and rules but not the textures, unless they're already loaded. 
+	// Called by load(), and by benchmarks which build maps.
+	TerrainConfigSource load_terrain_config(const std::string& base_path);
+
+	// Replaces the terrain types, file information and rules with those in v until it's 
+	// destroyed, for tests. v has the 'terrain_type' list of terrain.cfg, a 'files' map in the 
+	// form of terrain-file-data.cfg and the 'terrain_graphics' list of terrain-graphics.cfg.
+	class ScopedTerrainConfig
+	{
+	public:
+		explicit ScopedTerrainConfig(const variant& v);
+		~ScopedTerrainConfig();
+		ScopedTerrainConfig(const ScopedTerrainConfig&) = delete;
+		void operator=(const ScopedTerrainConfig&) = delete;
+	private:
+		struct Saved;
+		std::unique_ptr<Saved> saved_;
+	};
 }
@@ -21,94 +21,653 @@
 	   distribution.
 */
 
+#include <iterator>
+#include <limits>
+#include <numeric>
+#include <set>
+#include <thread>
+#include <unordered_map>
 #include <boost/algorithm/string.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include "asserts.hpp"
 #include "filesystem.hpp"
 #include "hex_map.hpp"
+#include "hex_helper.hpp"
 #include "hex_tile.hpp"
 #include "hex_loader.hpp"
 #include "hex_renderable.hpp"
+#include "json.hpp"
 #include "profile_timer.hpp"
+#include "random.hpp"
 #include "tile_rules.hpp"
+#include "unit_test.hpp"
 
 namespace hex
 {
+	namespace
+	{
+		// The images and match records of the hexes are each held in a pool, with a span of it for 
+		// each hex. A span that's replaced is left as garbage until there's as much garbage as 
+		// there is in use.
+		template<typename Span, typename T>
+		void compact_spans(std::vector<Span>& spans, std::vector<T>& pool, int& garbage)
+		{
+			std::vector<T> new_pool;
+			new_pool.reserve(pool.size() - garbage);
+			for(auto& span : spans) {
+				const int first = static_cast<int>(new_pool.size());
+				std::move(pool.begin() + span.first, pool.begin() + span.first + span.count, std::back_inserter(new_pool));
+				span.first = first;
+			}
+			pool.swap(new_pool);
+			garbage = 0;
+		}
+
+		template<typename Span, typename T>
+		void set_span(std::vector<Span>& spans, std::vector<T>& pool, int& garbage, int index, const T* first, const T* last)
+		{
+			auto& span = spans[index];
+			garbage += span.count;
+			span.first = static_cast<int>(pool.size());
+			span.count = static_cast<int>(last - first);
+			pool.insert(pool.end(), first, last);
+			if(garbage > static_cast<int>(pool.size()) / 2) {
+				compact_spans(spans, pool, garbage);
+			}
+		}
+
+		// Adds items, which are (hex index, item) pairs, after the existing ones of each hex in the
+		// order they're given.
+		template<typename Span, typename T>
+		void merge_spans(std::vector<Span>& spans, std::vector<T>& pool, int& garbage, std::vector<std::pair<int, T>>& items)
+		{
+			if(items.empty()) {
+				return;
+			}
+			std::vector<int> starts(spans.size() + 1);
+			for(const auto& item : items) {
+				++starts[item.first + 1];
+			}
+			std::partial_sum(starts.cbegin(), starts.cend(), starts.begin());
+			std::vector<int> order(items.size());
+			std::vector<int> next(starts.cbegin(), starts.cend() - 1);
+			for(int n = 0; n != static_cast<int>(items.size()); ++n) {
+				order[next[items[n].first]++] = n;
+			}
+			std::vector<T> new_pool;
+			new_pool.reserve(pool.size() - garbage + items.size());
+			for(int n = 0; n != static_cast<int>(spans.size()); ++n) {
+				auto& span = spans[n];
+				const int first = static_cast<int>(new_pool.size());
+				std::move(pool.begin() + span.first, pool.begin() + span.first + span.count, std::back_inserter(new_pool));
+				for(int m = starts[n]; m != starts[n + 1]; ++m) {
+					new_pool.emplace_back(std::move(items[order[m]].second));
+				}
+				span.first = first;
+				span.count = static_cast<int>(new_pool.size()) - first;
+			}
+			pool.swap(new_pool);
+			garbage = 0;
+			items.clear();
+			items.shrink_to_fit();
+		}
+	}
+
 	HexMap::HexMap(const std::string& filename)
 		: tiles_(),
+		  type_ids_(),
+		  mod_ids_(),
+		  full_type_ids_(),
+		  flags_(),
+		  flag_words_((flag_count() + 63) / 64),
+		  temp_flags_(),
+		  image_spans_(),
+		  image_pool_(),
+		  image_garbage_(0),
+		  building_(false),
+		  new_images_(),
+		  record_spans_(),
+		  record_pool_(),
+		  record_garbage_(0),
+		  new_records_(),
+		  match_rule_(-1),
+		  match_origin_(),
+		  built_(false),
 		  x_(0),
 		  y_(0),
 		  width_(0),
 		  height_(0),
 		  starting_positions_(),
 		  changed_(false),
+		  changed_hexes_(),
 		  renderable_(nullptr)
 	{
+		profile::manager pman("HexMap::parseMapData()");
+		ASSERT_LOG(sys::file_exists(filename), "Map file doesn't exist: " << filename);
+		try {
+			using namespace boost::interprocess;
+			file_mapping file(filename.c_str(), read_only);
+			mapped_region region(file, read_only);
+			const char* data = static_cast<const char*>(region.get_address());
+			parseMapData(data, data + region.get_size());
+		} catch(boost::interprocess::interprocess_exception& e) {
+			ASSERT_LOG(false, "Unable to read map file " << filename << ": " << e.what());
+		}
+	}
+
+	HexMap::HexMap(const variant& v)
+		: tiles_(),
+		  type_ids_(),
+		  mod_ids_(),
+		  full_type_ids_(),
+		  flags_(),
+		  flag_words_((flag_count() + 63) / 64),
+		  temp_flags_(),
+		  image_spans_(),
+		  image_pool_(),
+		  image_garbage_(0),
+		  building_(false),
+		  new_images_(),
+		  record_spans_(),
+		  record_pool_(),
+		  record_garbage_(0),
+		  new_records_(),
+		  match_rule_(-1),
+		  match_origin_(),
+		  built_(false),
+		  x_(0),
+		  y_(0),
+		  width_(0),
+		  height_(0),
+		  starting_positions_(),
+		  changed_(false),
+		  changed_hexes_(),
+		  renderable_(nullptr)
+	{
+		// XXX
+	}
+
+	HexMap::~HexMap()
+	{
+	}
+
+	void HexMap::parseMapData(const char* first, const char* last)
+	{
+		// Old-style map data, rows of comma separated terrain codes, any of which may be prefixed 
+		// by a starting position, e.g. "1 Ke". The codes are parsed in place and resolved through 
+		// a table of those seen so far, as a map has only a few distinct codes.
+		struct CellType 
+		{
+			string_id full_type;
+			string_id type;
+			string_id mod;
+		};
+		std::unordered_map<std::string, CellType> cell_types;
+		std::string code;
+
+		// Sized for the cells first so the arrays aren't moved as the map is read.
+		const size_t cell_count = tiles_.size() + std::count(first, last, ',') + std::count(first, last, '\n') + 1;
+		tiles_.reserve(cell_count);
+		type_ids_.reserve(cell_count);
+		mod_ids_.reserve(cell_count);
+		full_type_ids_.reserve(cell_count);
+		flags_.reserve(cell_count * flag_words_);
+		image_spans_.reserve(cell_count);
+		record_spans_.reserve(cell_count);
+
+		auto is_space = [](char c) { return c == ' ' || c == '\t'; };
+		auto is_eol = [](char c) { return c == '\n' || c == '\r'; };
+
 		int max_x = -1;
-		// assume a old-style map.
 		int y = 0;
-		auto contents = sys::read_file(filename);
-		std::vector<std::string> lines;
-		boost::split(lines, contents, boost::is_any_of("\n\r"), boost::token_compress_on);
-		for(const auto& line : lines) {
-			int x = 0;
-			if(line.empty()) {
+		const char* it = first;
+		while(it != last) {
+			if(is_eol(*it)) {
+				++it;
+				continue;
+			}
+			const char* line_end = std::find_if(it, last, is_eol);
+			if(std::all_of(it, line_end, is_space)) {
+				it = line_end;
 				continue;
 			}
-			std::vector<std::string> types;
-			boost::split(types, line, boost::is_any_of(","), boost::token_compress_off);
-			for(const auto& type : types) {
-				std::string full_type = boost::trim_copy(type);
-				auto pos = full_type.find(' ');
-				if(pos != std::string::npos) {
-					full_type = full_type.substr(pos+1);
-				}
-				std::string type_str = full_type;
-				pos = type_str.find('^');
-				std::string mod_str;
-				if(pos != std::string::npos) {
-					mod_str = type_str.substr(pos + 1);
-					type_str = type_str.substr(0, pos);
-				}
-				pos = type_str.find(' ');
-				std::string player_pos;
-				if(pos != std::string::npos) {
-					player_pos = type_str.substr(0, pos);
-					type_str = type_str.substr(pos + 1);
-					starting_positions_.emplace_back(point(x, y), player_pos);
-					LOG_INFO("Starting position " << player_pos << ": " << x << "," << y);
-				}
-				auto tile = get_tile_from_type(type_str);
-				tiles_.emplace_back(x, y, tile, this);
-				tiles_.back().setTypeStr(full_type, type_str, mod_str);
+			int x = 0;
+			while(true) {
+				const char* cell_end = std::find(it, line_end, ',');
+				const char* start = std::find_if_not(it, cell_end, is_space);
+				const char* end = cell_end;
+				while(end != start && is_space(end[-1])) {
+					--end;
+				}
+				const char* sp = std::find(start, end, ' ');
+				if(sp != end) {
+					const std::string player_pos(start, sp);
+					starting_positions_.emplace_back(point(x_ + x, y_ + y), player_pos);
+					LOG_INFO("Starting position " << player_pos << ": " << (x_ + x) << "," << (y_ + y));
+					start = std::find_if_not(sp, end, is_space);
+				}
+
+				code.assign(start, end);
+				auto ct = cell_types.find(code);
+				if(ct == cell_types.end()) {
+					const char* caret = std::find(start, end, '^');
+					const std::string type_str(start, caret);
+					CellType cell;
+					cell.full_type = intern_string(code);
+					cell.type = intern_string(type_str);
+					cell.mod = intern_string(caret != end ? std::string(caret + 1, end) : std::string());
+					// Checks that the terrain type exists.
+					get_tile_from_type(type_str);
+					ct = cell_types.emplace(code, cell).first;
+				}
+				addHex(x_ + x, y_ + y, ct->second.full_type, ct->second.type, ct->second.mod);
+
 				++x;
-				if(x > max_x) {
-					max_x = x;
+				if(cell_end == line_end) {
+					break;
 				}
+				it = cell_end + 1;
 			}
+			max_x = std::max(max_x, x);
 			++y;
+			it = line_end;
 		}
 		width_ = max_x;
 		height_ = y;
 		LOG_INFO("HexMap size: " << width_ << "," << height_);
 	}
 
-	HexMap::HexMap(const variant& v)
+	void HexMap::addHex(int x, int y, string_id full_type, string_id type, string_id mod)
 	{
-		// XXX
+		const int index = static_cast<int>(tiles_.size());
+		tiles_.emplace_back(this, index, point(x, y));
+		type_ids_.emplace_back(type);
+		mod_ids_.emplace_back(mod);
+		full_type_ids_.emplace_back(full_type);
+		flags_.resize(flags_.size() + flag_words_);
+		image_spans_.emplace_back();
+		record_spans_.emplace_back();
 	}
 
-	HexMap::~HexMap()
+	void HexMap::build(bool use_rule_index, int threads)
+	{
+		profile::manager pman("HexMap::build()");
+		auto& terrain_rules = hex::get_terrain_rules();
+		auto self = shared_from_this();
+		setFlagWords((flag_count() + 63) / 64);
+		building_ = true;
+		if(!use_rule_index) {
+			for(auto& tr : terrain_rules) {
+				tr->match(self, threads);
+			}
+			mergeNewImages();
+			built_ = true;
+			return;
+		}
+
+		// Index of the hexes on the map by terrain type, in map order.
+		std::map<string_id, std::vector<int>> hexes_by_type;
+		for(int n = 0; n != static_cast<int>(tiles_.size()); ++n) {
+			hexes_by_type[tiles_[n].getFullTypeId()].emplace_back(n);
+		}
+		// Many rules share the same anchor types (i.e. "C*") so we only need to work out which 
+		// hexes match a set of types once.
+		std::map<std::vector<std::string>, std::vector<int>> hexes_by_anchor_types;
+		for(auto& tr : terrain_rules) {
+			const TileRule* anchor = tr->getAnchor();
+			if(anchor == nullptr) {
+				tr->match(self, threads);
+				continue;
+			}
+			auto it = hexes_by_anchor_types.find(anchor->getTypes());
+			if(it == hexes_by_anchor_types.end()) {
+				std::vector<int> anchor_hexes;
+				for(const auto& ht : hexes_by_type) {
+					const HexObject& hex = tiles_[ht.second.front()];
+					if(anchor->matchType(hex.getFullTypeId(), hex.getTypeId())) {
+						anchor_hexes.insert(anchor_hexes.end(), ht.second.cbegin(), ht.second.cend());
+					}
+				}
+				it = hexes_by_anchor_types.emplace(anchor->getTypes(), anchor_hexes).first;
+			}
+			tr->match(self, it->second, threads);
+		}
+		mergeNewImages();
+		built_ = true;
+	}
+
+	void HexMap::setTile(const point& p, const std::string& full_type)
 	{
+		profile::manager pman("HexMap::setTile()");
+		HexObject* hex = const_cast<HexObject*>(getTileAt(p));
+		ASSERT_LOG(hex != nullptr, "Position is outside the map: " << p);
+		std::string type_str = full_type;
+		std::string mod_str;
+		auto pos = type_str.find('^');
+		if(pos != std::string::npos) {
+			mod_str = type_str.substr(pos + 1);
+			type_str = type_str.substr(0, pos);
+		}
+		get_tile_from_type(type_str);
+		hex->setTypeStr(full_type, type_str, mod_str);
+
+		if(!built_) {
+			return;
+		}
+		if(renderable_ != nullptr) {
+			changed_hexes_.emplace_back(hex->getIndex());
+		}
+		// A rule with an absolute position is tried everywhere or nowhere depending on one hex.
+		auto& terrain_rules = hex::get_terrain_rules();
+		if(std::any_of(terrain_rules.cbegin(), terrain_rules.cend(), [](const TerrainRulePtr& tr) { return tr->hasAbsolutePosition(); })) {
+			rebuild();
+			return;
+		}
+		const int radius = std::max(1, get_terrain_rule_radius());
+		for(int size = 2 * radius + 1; !rebuildAround(p, size); size *= 2) {
+		}
 	}
 
-	void HexMap::build()
+	bool HexMap::rebuildAround(const point& p, int size)
 	{
-		profile::manager pman("HexMap::build()");
+		// The terrain around p is copied and the matches of every rule are redone on it in the 
+		// order a build makes them. A hex is dirty if what's been done to it differs from the build
+		// so far, which to start with is just p. A match whose reach covers a dirty hex is tried 
+		// again, and any hexes where the result differs become dirty. The others are replayed from
+		// the records of the hexes, so only the rules and hexes near a change are matched.
 		auto& terrain_rules = hex::get_terrain_rules();
-		for(auto& tr : terrain_rules) {
-			tr->match(shared_from_this());
+		HexMapPtr window = getRegion(rect::from_coordinates(p.x - size, p.y - size, p.x + size, p.y + size), false);
+		window->setFlagWords(flag_words_);
+		const auto& wtiles = window->tiles_;
+
+		// The records of the hexes in the window, with the index of the hex in the window and for 
+		// images the image added, in the order the matches were made.
+		struct Record
+		{
+			int rule;
+			point origin;
+			int hex;
+			int flag;
+			const ImageHolder* image;
+		};
+		auto by_match = [](const Record& a, const Record& b) {
+			if(a.rule != b.rule) {
+				return a.rule < b.rule;
+			}
+			return a.origin.y != b.origin.y ? a.origin.y < b.origin.y : a.origin.x < b.origin.x;
+		};
+		auto by_hex = [](const Record& a, const Record& b) { return a.hex < b.hex; };
+		std::vector<Record> records;
+		for(const auto& whex : wtiles) {
+			const int src = getTileAt(whex.getPosition())->getIndex();
+			const ImageHolder* image = image_pool_.data() + image_spans_[src].first;
+			const auto& span = record_spans_[src];
+			for(int n = span.first; n != span.first + span.count; ++n) {
+				const auto& mr = record_pool_[n];
+				records.emplace_back(Record{mr.rule, mr.origin, whex.getIndex(), mr.flag, mr.flag < 0 ? image++ : nullptr});
+			}
+		}
+		std::stable_sort(records.begin(), records.end(), by_match);
+
+		std::vector<char> dirty(wtiles.size());
+		std::vector<int> dirty_hexes(1, window->getTileAt(p)->getIndex());
+		dirty[dirty_hexes.front()] = 1;
+
+		auto rec = records.cbegin();
+		for(const auto& tr : terrain_rules) {
+			const int rule = tr->getIndex();
+			const auto& reach = tr->getReach();
+			// Hexes the rule is tried at again, as (y, x) so they're in map order.
+			std::set<std::pair<int, int>> rematch;
+			auto add_rematches = [&](int index, const std::pair<int, int>& after) {
+				int x, y, z;
+				hex::evenq_to_cube_coords(wtiles[index].getPosition(), &x, &y, &z);
+				for(const auto& r : reach) {
+					const point o = hex::cube_to_evenq_coords(x - r.x, y - r.y, z - r.z);
+					if(std::make_pair(o.y, o.x) > after && getTileAt(o) != nullptr) {
+						rematch.emplace(o.y, o.x);
+					}
+				}
+			};
+			for(const int index : dirty_hexes) {
+				add_rematches(index, std::make_pair(std::numeric_limits<int>::min(), 0));
+			}
+
+			const auto rule_end = std::find_if(rec, records.cend(), [rule](const Record& r) { return r.rule != rule; });
+			while(rec != rule_end || !rematch.empty()) {
+				const bool match_again = !rematch.empty() 
+					&& (rec == rule_end || std::make_pair(rec->origin.y, rec->origin.x) >= *rematch.begin());
+				const point origin = match_again ? point(rematch.begin()->second, rematch.begin()->first) : rec->origin;
+				if(match_again) {
+					rematch.erase(rematch.begin());
+				}
+				auto old_end = rec;
+				while(old_end != rule_end && old_end->origin == origin) {
+					++old_end;
+				}
+
+				if(!match_again) {
+					window->beginMatch(rule, origin);
+					for(; rec != old_end; ++rec) {
+						if(rec->flag >= 0) {
+							window->setFlag(rec->hex, rec->flag);
+						} else {
+							window->addImage(rec->hex, *rec->image);
+						}
+					}
+					window->endMatch();
+					continue;
+				}
+
+				// Unless the window covers everything the match could see, it has to be bigger.
+				int x, y, z;
+				hex::evenq_to_cube_coords(origin, &x, &y, &z);
+				for(const auto& r : reach) {
+					const point q = hex::cube_to_evenq_coords(x + r.x, y + r.y, z + r.z);
+					if(getTileAt(q) != nullptr && window->getTileAt(q) == nullptr) {
+						return false;
+					}
+				}
+				const size_t first_new = window->new_records_.size();
+				tr->matchAt(window, &window->tiles_[window->getTileAt(origin)->getIndex()]);
+
+				std::vector<Record> before(rec, old_end);
+				rec = old_end;
+				std::vector<Record> after;
+				for(size_t n = first_new; n != window->new_records_.size(); ++n) {
+					const auto& nr = window->new_records_[n];
+					after.emplace_back(Record{rule, origin, nr.first, nr.second.flag, nullptr});
+				}
+				std::stable_sort(before.begin(), before.end(), by_hex);
+				std::stable_sort(after.begin(), after.end(), by_hex);
+				// The images the match added to a hex are the last ones it has.
+				for(auto it = after.begin(); it != after.end(); ) {
+					const auto hex_end = std::find_if(it, after.end(), [it](const Record& r) { return r.hex != it->hex; });
+					const auto images = wtiles[it->hex].getImages();
+					const ImageHolder* image = images.end() - std::count_if(it, hex_end, [](const Record& r) { return r.flag < 0; });
+					for(; it != hex_end; ++it) {
+						if(it->flag < 0) {
+							it->image = image++;
+						}
+					}
+				}
+
+				auto b = before.cbegin();
+				auto a = after.cbegin();
+				while(b != before.cend() || a != after.cend()) {
+					const int index = a == after.cend() || (b != before.cend() && b->hex < a->hex) ? b->hex : a->hex;
+					bool same = true;
+					for(; b != before.cend() && b->hex == index && a != after.cend() && a->hex == index; ++b, ++a) {
+						same = same && b->flag == a->flag && (b->flag >= 0 || *b->image == *a->image);
+					}
+					for(; b != before.cend() && b->hex == index; ++b) {
+						same = false;
+					}
+					for(; a != after.cend() && a->hex == index; ++a) {
+						same = false;
+					}
+					if(!same && !dirty[index]) {
+						dirty[index] = 1;
+						dirty_hexes.emplace_back(index);
+						add_rematches(index, std::make_pair(origin.y, origin.x));
+					}
+				}
+			}
+		}
+
+		// The dirty hexes have been redone from scratch in the window, the rest are unchanged.
+		std::vector<int> slots(wtiles.size(), -1);
+		std::vector<std::vector<MatchRecord>> dirty_records(dirty_hexes.size());
+		for(int n = 0; n != static_cast<int>(dirty_hexes.size()); ++n) {
+			slots[dirty_hexes[n]] = n;
 		}
+		for(const auto& nr : window->new_records_) {
+			if(slots[nr.first] >= 0) {
+				dirty_records[slots[nr.first]].emplace_back(nr.second);
+			}
+		}
+		for(int n = 0; n != static_cast<int>(dirty_hexes.size()); ++n) {
+			const HexObject& whex = wtiles[dirty_hexes[n]];
+			const int dst = getTileAt(whex.getPosition())->getIndex();
+			copyFlags(dst, *window, whex.getIndex());
+			const auto& mrs = dirty_records[n];
+			set_span(record_spans_, record_pool_, record_garbage_, dst, mrs.data(), mrs.data() + mrs.size());
+			const auto images = whex.getImages();
+			const auto old_images = tiles_[dst].getImages();
+			if(images.size() != old_images.size() || !std::equal(images.begin(), images.end(), old_images.begin())) {
+				setImages(dst, images.begin(), images.end());
+				if(renderable_ != nullptr) {
+					changed_hexes_.emplace_back(dst);
+				}
+			}
+		}
+		return true;
+	}
+
+	void HexMap::setFlag(int index, int flag)
+	{
+		if(flag >= flag_words_ * 64) {
+			setFlagWords(flag / 64 + 1);
+		}
+		uint64_t& word = flags_[index * flag_words_ + flag / 64];
+		const uint64_t bit = uint64_t(1) << (flag % 64);
+		if(match_rule_ >= 0 && (word & bit) == 0) {
+			new_records_.emplace_back(index, MatchRecord(match_rule_, match_origin_, flag));
+		}
+		word |= bit;
+	}
+
+	void HexMap::addTempFlag(int index, int flag)
+	{
+		const auto tf = std::make_pair(index, flag);
+		if(std::find(temp_flags_.cbegin(), temp_flags_.cend(), tf) == temp_flags_.cend()) {
+			temp_flags_.emplace_back(tf);
+		}
+	}
+
+	void HexMap::clearTempFlags(int index)
+	{
+		temp_flags_.erase(std::remove_if(temp_flags_.begin(), temp_flags_.end(), [index](const std::pair<int, int>& tf) {
+			return tf.first == index;
+		}), temp_flags_.end());
+	}
+
+	void HexMap::setTempFlags(int index)
+	{
+		for(const auto& tf : temp_flags_) {
+			if(tf.first == index) {
+				setFlag(index, tf.second);
+			}
+		}
+		clearTempFlags(index);
+	}
+
+	void HexMap::copyFlags(int index, const HexMap& src, int src_index)
+	{
+		if(src.flag_words_ > flag_words_) {
+			setFlagWords(src.flag_words_);
+		}
+		auto it = flags_.begin() + index * flag_words_;
+		std::fill(it, it + flag_words_, 0);
+		std::copy(src.flags_.cbegin() + src_index * src.flag_words_, src.flags_.cbegin() + (src_index + 1) * src.flag_words_, it);
+	}
+
+	void HexMap::setFlagWords(int words)
+	{
+		if(words <= flag_words_) {
+			return;
+		}
+		std::vector<uint64_t> flags(tiles_.size() * words);
+		for(int n = 0; n != static_cast<int>(tiles_.size()); ++n) {
+			std::copy(flags_.cbegin() + n * flag_words_, flags_.cbegin() + (n + 1) * flag_words_, flags.begin() + n * words);
+		}
+		flags_.swap(flags);
+		flag_words_ = words;
+	}
+
+	void HexMap::addImage(int index, const ImageHolder& holder)
+	{
+		if(match_rule_ >= 0) {
+			new_records_.emplace_back(index, MatchRecord(match_rule_, match_origin_, -1));
+		}
+		if(building_) {
+			new_images_.emplace_back(index, holder);
+			return;
+		}
+		const auto& span = image_spans_[index];
+		std::vector<ImageHolder> images(image_pool_.cbegin() + span.first, image_pool_.cbegin() + span.first + span.count);
+		images.emplace_back(holder);
+		setImages(index, images.data(), images.data() + images.size());
+	}
+
+	void HexMap::setImages(int index, const ImageHolder* first, const ImageHolder* last)
+	{
+		set_span(image_spans_, image_pool_, image_garbage_, index, first, last);
+	}
+
+	void HexMap::clearImages(int index)
+	{
+		auto& span = image_spans_[index];
+		image_garbage_ += span.count;
+		span.count = 0;
+		if(building_) {
+			new_images_.erase(std::remove_if(new_images_.begin(), new_images_.end(), [index](const std::pair<int, ImageHolder>& img) {
+				return img.first == index;
+			}), new_images_.end());
+		}
+		// Then the records of adding them go too.
+		const auto& rspan = record_spans_[index];
+		std::vector<MatchRecord> records;
+		std::copy_if(record_pool_.cbegin() + rspan.first, record_pool_.cbegin() + rspan.first + rspan.count, std::back_inserter(records), [](const MatchRecord& mr) {
+			return mr.flag >= 0;
+		});
+		set_span(record_spans_, record_pool_, record_garbage_, index, records.data(), records.data() + records.size());
+		new_records_.erase(std::remove_if(new_records_.begin(), new_records_.end(), [index](const std::pair<int, MatchRecord>& mr) {
+			return mr.first == index && mr.second.flag < 0;
+		}), new_records_.end());
+	}
+
+	void HexMap::mergeNewImages()
+	{
+		building_ = false;
+		merge_spans(image_spans_, image_pool_, image_garbage_, new_images_);
+		merge_spans(record_spans_, record_pool_, record_garbage_, new_records_);
+	}
+
+	void HexMap::rebuild()
+	{
+		std::fill(flags_.begin(), flags_.end(), 0);
+		image_spans_.assign(tiles_.size(), ImageSpan());
+		image_pool_.clear();
+		image_garbage_ = 0;
+		record_spans_.assign(tiles_.size(), ImageSpan());
+		record_pool_.clear();
+		record_garbage_ = 0;
+		build();
+		changed_ = renderable_ != nullptr;
 	}
 
 	const HexObject* HexMap::getTileAt(int x, int y) const
@@ -139,21 +698,77 @@ namespace hex
 		return std::make_shared<HexMap>(v);
 	}
 
+	HexMapPtr HexMap::createFromString(const std::string& contents, const point& origin)
+	{
+		auto hmap = std::make_shared<HexMap>(variant());
+		hmap->x_ = origin.x;
+		hmap->y_ = origin.y;
+		hmap->parseMapData(contents.data(), contents.data() + contents.size());
+		return hmap;
+	}
+
+	HexMapPtr HexMap::getRegion(const rect& area, bool with_images) const
+	{
+		const int x1 = std::max(x_, area.x1()), x2 = std::min(x_ + width_, area.x2());
+		const int y1 = std::max(y_, area.y1()), y2 = std::min(y_ + height_, area.y2());
+		auto region = std::make_shared<HexMap>(variant());
+		region->x_ = x1;
+		region->y_ = y1;
+		region->width_ = std::max(0, x2 - x1);
+		region->height_ = std::max(0, y2 - y1);
+		const int count = region->width_ * region->height_;
+		region->tiles_.reserve(count);
+		region->type_ids_.reserve(count);
+		region->mod_ids_.reserve(count);
+		region->full_type_ids_.reserve(count);
+		region->flags_.reserve(count * region->flag_words_);
+		region->image_spans_.reserve(count);
+		region->record_spans_.reserve(count);
+		for(int y = y1; y < y2; ++y) {
+			for(int x = x1; x < x2; ++x) {
+				const int src = getTileAt(x, y)->getIndex();
+				const int dst = static_cast<int>(region->tiles_.size());
+				region->addHex(x, y, full_type_ids_[src], type_ids_[src], mod_ids_[src]);
+				if(with_images) {
+					region->copyFlags(dst, *this, src);
+					const auto& span = image_spans_[src];
+					region->setImages(dst, image_pool_.data() + span.first, image_pool_.data() + span.first + span.count);
+					const auto& rspan = record_spans_[src];
+					set_span(region->record_spans_, region->record_pool_, region->record_garbage_, dst, 
+						record_pool_.data() + rspan.first, record_pool_.data() + rspan.first + rspan.count);
+				}
+			}
+		}
+		region->built_ = with_images && built_;
+		return region;
+	}
+
 	void HexMap::process()
 	{
 		if(changed_) {
 			changed_ = false;
+			changed_hexes_.clear();
 			renderable_->update(width_, height_, tiles_);
+		} else if(!changed_hexes_.empty()) {
+			std::sort(changed_hexes_.begin(), changed_hexes_.end());
+			changed_hexes_.erase(std::unique(changed_hexes_.begin(), changed_hexes_.end()), changed_hexes_.end());
+			renderable_->updateHexes(tiles_, changed_hexes_);
+			changed_hexes_.clear();
 		}
 	}
 
-	HexObject::HexObject(int x, int y, const HexTilePtr & tile, const HexMap* parent)
+	HexObject::HexObject(HexMap* parent, int index, const point& pos)
 		: parent_(parent),
-		  pos_(x, y),
-		  tile_(tile),
-		  type_str_(),
-		  mod_str_()
+		  index_(index),
+		  pos_(pos)
+	{
+	}
+
+	void HexObject::setTypeStr(const std::string& full_type, const std::string& type, const std::string& mods)
 	{
+		parent_->full_type_ids_[index_] = intern_string(full_type);
+		parent_->type_ids_[index_] = intern_string(type);
+		parent_->mod_ids_[index_] = intern_string(mods);
 	}
 
 	const HexObject* HexObject::getTileAt(int x, int y) const 
@@ -166,16 +781,40 @@ namespace hex
 		return parent_->getTileAt(p);
 	}
 
+	bool HexObject::hasFlag(const std::string& flag) const
+	{
+		const string_id id = find_interned_string(flag);
+		return id != InvalidStringId && hasFlag(id);
+	}
+
+	void HexObject::addFlag(string_id flag)
+	{
+		parent_->setFlag(index_, flag_index(flag));
+	}
+
+	void HexObject::addTempFlag(string_id flag) const
+	{
+		parent_->addTempFlag(index_, flag_index(flag));
+	}
+
+	void HexObject::addTempFlagIndex(int flag) const
+	{
+		parent_->addTempFlag(index_, flag);
+	}
+
+	void HexObject::clearTempFlags() const
+	{
+		parent_->clearTempFlags(index_);
+	}
+
 	void HexObject::setTempFlags() const
 	{
-		for(const auto& f : temp_flags_) {
-			flags_.emplace(f);
-		}
+		parent_->setTempFlags(index_);
 	}
 
 	void HexObject::clearImages()
 	{
-		images_.clear();
+		parent_->clearImages(index_);
 	}
 
 	void HexObject::addImage(const ImageHolder& holder)
@@ -183,7 +822,267 @@ namespace hex
 		if(holder.name.empty()) {
 			return;
 		}
-		LOG_INFO("Hex" << pos_ << ": " << holder.name << "; layer: " << holder.layer << "; base: " << holder.base << "; center: " << holder.center << "; offset: " << holder.offset);
-		images_.emplace_back(holder);
+		parent_->addImage(index_, holder);
+	}
+
+	ImageRange HexObject::getImages() const
+	{
+		const auto& span = parent_->image_spans_[index_];
+		const ImageHolder* first = parent_->image_pool_.data() + span.first;
+		return ImageRange(first, first + span.count);
+	}
+
+	bool operator==(const ImageHolder& a, const ImageHolder& b)
+	{
+		return a.name == b.name
+			&& a.layer == b.layer
+			&& a.base == b.base
+			&& a.center == b.center
+			&& a.offset == b.offset
+			&& a.crop == b.crop
+			&& a.opacity == b.opacity
+			&& a.is_animated == b.is_animated
+			&& a.animation_frames == b.animation_frames
+			&& a.animation_timing == b.animation_timing;
+	}
+
+	bool operator!=(const ImageHolder& a, const ImageHolder& b)
+	{
+		return !(a == b);
+	}
+
+	std::string generate_map_data(const std::string& filename, int width, int height)
+	{
+		std::vector<std::vector<std::string>> source;
+		auto contents = sys::read_file(filename);
+		std::vector<std::string> lines;
+		boost::split(lines, contents, boost::is_any_of("\n\r"), boost::token_compress_on);
+		for(const auto& line : lines) {
+			if(!line.empty()) {
+				source.emplace_back();
+				boost::split(source.back(), line, boost::is_any_of(","), boost::token_compress_off);
+			}
+		}
+		std::stringstream ss;
+		for(int y = 0; y != height; ++y) {
+			const auto& row = source[y % source.size()];
+			for(int x = 0; x != width; ++x) {
+				ss << (x == 0 ? "" : ", ") << boost::trim_copy(row[x % row.size()]);
+			}
+			ss << "\n";
+		}
+		return ss.str();
+	}
+
+	BenchmarkMapArgs parse_benchmark_map_args(const std::string& args, size_t min_params, size_t max_params, const std::string& usage)
+	{
+		std::vector<std::string> params;
+		boost::split(params, args, boost::is_any_of(" "));
+		ASSERT_LOG(params.size() >= min_params + 2 && params.size() <= max_params + 2, "Expected " << usage << " parameters: " << args);
+		BenchmarkMapArgs res;
+		res.size = boost::lexical_cast<int>(params[1]);
+		res.data = res.size > 0 ? generate_map_data(params[0], res.size, res.size) : sys::read_file(params[0]);
+		res.params.assign(params.begin() + 2, params.end());
+		return res;
+	}
+
+	variant get_test_terrain_config(bool spreading_rule)
+	{
+		// Rules which set flags that later rules depend on, optionally including one which 
+		// spreads a flag across the map as it's matched, and which add images to hexes other than
+		// the one matched at.
+		const std::string spread = R"(
+				{
+					"map": [", 2", ". , .", ", 1", ". , .", ", ."],
+					"rotations": ["n", "ne", "se", "s", "sw", "nw"],
+					"tile": [
+						{"pos": 1, "type": ["Gg"], "set_no_flag": ["reach"]},
+						{"pos": 2, "type": ["Gg", "Hh"], "has_flag": ["reach"]}
+					]
+				},)";
+		return json::parse(R"({
+			"terrain_type": [{"string": "Gg"}, {"string": "Ww"}, {"string": "Hh"}, {"string": "Mm"}],
+			"files": {
+				"shore-n": {"image": "terrain/test.png", "rect": [0, 0, 72, 72]},
+				"shore-ne": {"image": "terrain/test.png", "rect": [0, 0, 72, 72]},
+				"shore-se": {"image": "terrain/test.png", "rect": [0, 0, 72, 72]},
+				"shore-s": {"image": "terrain/test.png", "rect": [0, 0, 72, 72]},
+				"shore-sw": {"image": "terrain/test.png", "rect": [0, 0, 72, 72]},
+				"shore-nw": {"image": "terrain/test.png", "rect": [0, 0, 72, 72]},
+				"reach": {"image": "terrain/test.png", "rect": [0, 0, 72, 72]},
+				"reach2": {"image": "terrain/test.png", "rect": [0, 0, 72, 72]},
+				"inland": {"image": "terrain/test.png", "rect": [0, 0, 72, 72]},
+				"mountain": {"image": "terrain/test.png", "rect": [0, 0, 72, 72]}
+			},
+			"terrain_graphics": [
+				{
+					"map": [", .", ". , .", ", 1", ". , .", ", ."],
+					"tile": [{"pos": 1, "type": ["Hh"], "set_no_flag": ["reach"]}]
+				},)" + (spreading_rule ? spread : std::string()) + R"(
+				{
+					"map": [", 2", ". , .", ", 1", ". , .", ", ."],
+					"rotations": ["n", "ne", "se", "s", "sw", "nw"],
+					"tile": [
+						{"pos": 1, "type": ["Gg"], "set_no_flag": ["shore-@R0"], "image": {"layer": 1, "name": "shore-@R0"}},
+						{"pos": 2, "type": ["Ww"], "image": {"layer": 2, "name": "shore-@R3"}}
+					]
+				},
+				{
+					"map": [", .", ". , .", ", 1", ". , .", ", ."],
+					"probability": 70,
+					"tile": [{"pos": 1, "type": ["Gg"], "has_flag": ["reach"], "image": {"name": "reach@V", "variations": ["", "2"]}}]
+				},
+				{
+					"map": [", 2", ". , .", ", 1", ". , .", ", ."],
+					"rotations": ["n", "ne", "se", "s", "sw", "nw"],
+					"tile": [
+						{"pos": 1, "type": ["Gg"], "no_flag": ["reach"], "set_no_flag": ["dry"], "image": {"name": "inland"}},
+						{"pos": 2, "type": ["Mm"]}
+					]
+				},
+				{
+					"map": [", .", ". , .", ", 1", ". , .", ", ."],
+					"mod_x": 2,
+					"mod_y": 1,
+					"tile": [{"pos": 1, "type": ["Mm"], "image": {"name": "mountain"}}]
+				}
+			]
+		})");
+	}
+
+	std::string get_test_map_data()
+	{
+		return 
+			"Gg, Gg, Ww, Ww, Gg, Gg, Hh, Gg, Gg, Gg, Mm, Gg\n"
+			"Gg, Ww, Ww, Gg, Gg, Gg, Gg, Gg, Mm, Gg, Gg, Gg\n"
+			"Gg, Gg, Ww, Gg, Hh, Gg, Gg, Gg, Gg, Gg, Ww, Gg\n"
+			"Mm, Gg, Gg, Gg, Gg, Gg, Mm, Mm, Gg, Gg, Ww, Ww\n"
+			"Gg, Gg, Gg, Ww, Gg, Gg, Gg, Gg, Gg, Gg, Gg, Gg\n"
+			"Gg, Hh, Gg, Ww, Ww, Gg, Gg, Gg, Gg, Hh, Gg, Gg\n"
+			"Gg, Gg, Gg, Gg, Gg, Gg, Mm, Gg, Gg, Gg, Gg, Gg\n"
+			"Ww, Ww, Gg, Gg, Gg, Gg, Gg, Gg, Ww, Gg, Gg, Mm\n"
+			"Gg, Gg, Gg, Mm, Gg, Gg, Gg, Gg, Ww, Gg, Gg, Gg\n"
+			"Gg, Gg, Gg, Gg, Gg, Gg, Gg, Hh, Gg, Gg, Gg, Gg\n";
 	}
 }
+
+BENCHMARK_ARG(hex_map_build, const std::string& args)
+{
+	const auto map_args = hex::parse_benchmark_map_args(args, 1, 2, "map file, size, index/noindex and optional thread count");
+	// A thread count of 0 means one per hardware thread.
+	int threads = map_args.params.size() == 2 ? boost::lexical_cast<int>(map_args.params[1]) : 1;
+	if(threads == 0) {
+		threads = std::max(1U, std::thread::hardware_concurrency());
+	}
+	BENCHMARK_LOOP {
+		auto hmap = hex::HexMap::createFromString(map_args.data);
+		hmap->build(map_args.params[0] == "index", threads);
+	}
+}
+
+BENCHMARK_ARG_CALL(hex_map_build, test01_index, "data/maps/test01.map 0 index")
+BENCHMARK_ARG_CALL(hex_map_build, test01_noindex, "data/maps/test01.map 0 noindex")
+BENCHMARK_ARG_CALL(hex_map_build, synthetic512_index, "data/maps/test01.map 512 index")
+BENCHMARK_ARG_CALL(hex_map_build, synthetic512_noindex, "data/maps/test01.map 512 noindex")
+BENCHMARK_ARG_CALL(hex_map_build, synthetic512_index_threads, "data/maps/test01.map 512 index 0")
+
+BENCHMARK_ARG(hex_map_parse, const std::string& args)
+{
+	const auto map_args = hex::parse_benchmark_map_args(args, 0, 0, "map file and size");
+	test::reset_benchmark_timer();
+	BENCHMARK_LOOP {
+		hex::HexMap::createFromString(map_args.data);
+	}
+}
+
+BENCHMARK_ARG_CALL(hex_map_parse, synthetic1024, "data/maps/test01.map 1024")
+
+// The sort of pass over the map that rule matching makes, which only looks at types and flags.
+BENCHMARK_ARG(hex_map_scan, const std::string& args)
+{
+	auto hmap = hex::HexMap::createFromString(hex::parse_benchmark_map_args(args, 0, 0, "map file and size").data);
+	const hex::string_id type = hmap->getTiles().front().getFullTypeId();
+	const hex::string_id flag = hex::intern_string("base");
+	int count = 0;
+	test::reset_benchmark_timer();
+	BENCHMARK_LOOP {
+		for(const auto& hex : hmap->getTiles()) {
+			if(hex.getFullTypeId() == type && !hex.hasFlag(flag)) {
+				++count;
+			}
+		}
+	}
+	LOG_DEBUG("Matched " << count << " hexes");
+}
+
+BENCHMARK_ARG_CALL(hex_map_scan, synthetic1024, "data/maps/test01.map 1024")
+
+UNIT_TEST(hex_map_set_tile_matches_build)
+{
+	hex::ScopedTerrainConfig config(hex::get_test_terrain_config());
+	const std::string contents = hex::get_test_map_data();
+	// Includes a corner, neighbouring edits, a hex edited twice and hills, which the flag spread
+	// from, being removed and added.
+	const std::vector<std::pair<point, std::string>> edits = {
+		std::make_pair(point(0, 0), "Ww"),
+		std::make_pair(point(6, 0), "Gg"),
+		std::make_pair(point(5, 4), "Hh"),
+		std::make_pair(point(6, 4), "Mm"),
+		std::make_pair(point(4, 2), "Ww"),
+		std::make_pair(point(3, 4), "Gg"),
+		std::make_pair(point(5, 4), "Ww"),
+		std::make_pair(point(11, 9), "Mm"),
+	};
+
+	// The maps are built with the global random number generator in different states, as the
+	// images mustn't depend on it.
+	const rng::Seed seed = rng::get_seed();
+	rng::seed_from_int(1);
+	auto edited = hex::HexMap::createFromString(contents);
+	edited->build();
+	for(const auto& e : edits) {
+		edited->setTile(e.first, e.second);
+	}
+
+	rng::seed_from_int(2);
+	auto expected = hex::HexMap::createFromString(contents);
+	for(const auto& e : edits) {
+		const auto pos = e.second.find('^');
+		auto& hex = expected->getTilesMutable()[expected->getTileAt(e.first)->getIndex()];
+		hex.setTypeStr(e.second, e.second.substr(0, pos), pos == std::string::npos ? std::string() : e.second.substr(pos + 1));
+	}
+	expected->build();
+	rng::set_seed(seed);
+
+	CHECK_EQ(edited->getTiles().size(), expected->getTiles().size());
+	for(size_t n = 0; n != expected->getTiles().size(); ++n) {
+		const hex::HexObject& a = edited->getTiles()[n];
+		const hex::HexObject& b = expected->getTiles()[n];
+		CHECK_EQ(a.getFullTypeId(), b.getFullTypeId());
+		for(int flag = 0; flag != hex::flag_count(); ++flag) {
+			CHECK(a.hasFlagIndex(flag) == b.hasFlagIndex(flag), "flag " << flag << " differs at " << a.getPosition());
+		}
+		const auto images = a.getImages();
+		const auto expected_images = b.getImages();
+		CHECK(images.size() == expected_images.size() && std::equal(images.begin(), images.end(), expected_images.begin()), 
+			"images differ at " << a.getPosition());
+	}
+	CHECK(std::any_of(expected->getTiles().cbegin(), expected->getTiles().cend(), [](const hex::HexObject& hex) { return !hex.getImages().empty(); }), 
+		"no rules matched");
+}
+
+BENCHMARK_ARG(hex_map_set_tile, const std::string& args)
+{
+	auto hmap = hex::HexMap::createFromString(hex::parse_benchmark_map_args(args, 0, 0, "map file and size").data);
+	hmap->build();
+	const point p(hmap->getWidth() / 2, hmap->getHeight() / 2);
+	const std::string types[] = { "Ww", hmap->getTileAt(p)->getFullTypeString() };
+	test::reset_benchmark_timer();
+	int n = 0;
+	BENCHMARK_LOOP {
+		hmap->setTile(p, types[n++ % 2]);
+	}
+}
+
+BENCHMARK_ARG_CALL(hex_map_set_tile, test01, "data/maps/test01.map 0")
+BENCHMARK_ARG_CALL(hex_map_set_tile, synthetic256, "data/maps/test01.map 256")
@@ -23,12 +23,16 @@
 
 #pragma once
 
-#include <set>
+#include <algorithm>
+#include <cstdint>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "geometry.hpp"
 #include "hex_fwd.hpp"
 #include "hex_renderable_fwd.hpp"
+#include "string_intern.hpp"
 #include "variant.hpp"
 
 namespace hex
@@ -47,42 +51,62 @@ namespace hex
 		int animation_timing;
 	};
 
-	// Realisation of a HexTile
+	bool operator==(const ImageHolder& a, const ImageHolder& b);
+	bool operator!=(const ImageHolder& a, const ImageHolder& b);
+
+	// The images of a hex, which are a range of the map's image pool. Only valid until images are
+	// next added to the map.
+	class ImageRange
+	{
+	public:
+		typedef const ImageHolder* const_iterator;
+		ImageRange(const ImageHolder* first, const ImageHolder* last) : first_(first), last_(last) {}
+		const_iterator begin() const { return first_; }
+		const_iterator end() const { return last_; }
+		size_t size() const { return last_ - first_; }
+		bool empty() const { return first_ == last_; }
+		const ImageHolder& operator[](size_t n) const { return first_[n]; }
+	private:
+		const ImageHolder* first_;
+		const ImageHolder* last_;
+	};
+
+	// Realisation of a HexTile. The map holds the data of all its hexes in an array per field,
+	// this is a view of the hex at one index of them.
 	class HexObject
 	{
 	public:
-		HexObject(int x, int y, const HexTilePtr& tile, const HexMap* parent);
-		void setTypeStr(const std::string& full_type, const std::string& type, const std::string& mods=std::string()) {
-			full_type_str_ = full_type;
-			type_str_ = type;
-			mod_str_ = mods;
-		}
+		HexObject(HexMap* parent, int index, const point& pos);
+		void setTypeStr(const std::string& full_type, const std::string& type, const std::string& mods=std::string());
 		const point& getPosition() const { return pos_; }
 		int getX() const { return pos_.x; }
 		int getY() const { return pos_.y; }
-		const std::string& getTypeString() const { return type_str_; }
-		const std::string& getModString() const { return mod_str_; }
-		const std::string& getFullTypeString() const { return full_type_str_; }
+		int getIndex() const { return index_; }
+		const std::string& getTypeString() const { return get_interned_string(getTypeId()); }
+		const std::string& getModString() const { return get_interned_string(getModId()); }
+		const std::string& getFullTypeString() const { return get_interned_string(getFullTypeId()); }
+		string_id getTypeId() const;
+		string_id getModId() const;
+		string_id getFullTypeId() const;
 		const HexObject* getTileAt(int x, int y) const;
 		const HexObject* getTileAt(const point& p) const; 
-		bool hasFlag(const std::string& flag) const { return flags_.find(flag) != flags_.end() || temp_flags_.find(flag) != temp_flags_.end(); }
-		void addFlag(const std::string& flag) { flags_.emplace(flag); }
-		void addTempFlag(const std::string& flag) const { temp_flags_.emplace(flag); }
-		void clearTempFlags() const { temp_flags_.clear(); }
+		bool hasFlag(const std::string& flag) const;
+		bool hasFlag(string_id flag) const;
+		void addFlag(const std::string& flag) { addFlag(intern_string(flag)); }
+		void addFlag(string_id flag);
+		void addTempFlag(string_id flag) const;
+		// As hasFlag() and addTempFlag() but taking the flag_index() of the flag, used by the matcher.
+		bool hasFlagIndex(int flag) const;
+		void addTempFlagIndex(int flag) const;
+		void clearTempFlags() const;
 		void setTempFlags() const;
 		void clearImages();
 		void addImage(const ImageHolder& holder);
-		const std::vector<ImageHolder>& getImages() const { return images_; }
+		ImageRange getImages() const;
 	private:
-		const HexMap* parent_;
+		HexMap* parent_;
+		int index_;
 		point pos_;
-		HexTilePtr tile_;
-		std::string type_str_;
-		std::string mod_str_;
-		std::string full_type_str_;
-		mutable std::set<std::string> flags_;
-		mutable std::set<std::string> temp_flags_;
-		std::vector<ImageHolder> images_;
 	};
 
 	class HexMap : public std::enable_shared_from_this<HexMap>
@@ -92,18 +116,42 @@ namespace hex
 		explicit HexMap(const variant& v);
 		~HexMap();
 
-		void build();
+		// If use_rule_index is false every rule is tried against every hex on the map. Only really
+		// useful for comparison purposes, since the result is the same.
+		// threads is the number of pieces the search for rule matches is split into on the shared
+		// job system, which is sized separately. The result doesn't depend on it.
+		void build(bool use_rule_index=true, int threads=1);
+		// Changes the terrain at p to full_type, e.g. "Gg^Fp", and rebuilds the flags and images of
+		// the hexes around it that the change affects, as a build() of the whole map would. The 
+		// renderable is updated for just those hexes on the next call to process().
+		void setTile(const point& p, const std::string& full_type);
 
 		const HexObject* getTileAt(int x, int y) const ;
 		const HexObject* getTileAt(const point& p) const ;
 		const std::vector<HexObject>& getTiles() const { return tiles_; }
 		std::vector<HexObject>& getTilesMutable() { return tiles_; }
 
+		int getX() const { return x_; }
+		int getY() const { return y_; }
 		int getWidth() const { return width_; }
 		int getHeight() const { return height_; }
 
 		static HexMapPtr create(const std::string& filename);
 		static HexMapPtr create(const variant& v);
+		// Create a map from old-style map data, rather than the name of a file containing it. The
+		// first hex of the data is at origin.
+		static HexMapPtr createFromString(const std::string& contents, const point& origin=point());
+		// Creates a map of the hexes of this one which are within area. If with_images is true 
+		// their flags and images are copied, otherwise just their terrain.
+		HexMapPtr getRegion(const rect& area, bool with_images) const;
+
+		// Called by TerrainRule around matching the rule with index rule at origin, so that what the
+		// match does to the map is recorded against it.
+		void beginMatch(int rule, const point& origin) { 
+			match_rule_ = rule; 
+			match_origin_ = origin; 
+		}
+		void endMatch() { match_rule_ = -1; }
 
 		void setRenderable(MapNodePtr renderable) { 
 			renderable_ = renderable; 
@@ -111,7 +159,76 @@ namespace hex
 		}
 		void process();
 	private:
+		void parseMapData(const char* first, const char* last);
+		void addHex(int x, int y, string_id full_type, string_id type, string_id mod);
+
+		friend class HexObject;
+		bool hasFlag(int index, int flag) const;
+		void setFlag(int index, int flag);
+		void addTempFlag(int index, int flag);
+		void clearTempFlags(int index);
+		void setTempFlags(int index);
+		void copyFlags(int index, const HexMap& src, int src_index);
+		void setFlagWords(int words);
+		void addImage(int index, const ImageHolder& holder);
+		void setImages(int index, const ImageHolder* first, const ImageHolder* last);
+		void clearImages(int index);
+		void mergeNewImages();
+		// Rebuilds the whole map from its terrain, for edits setTile() can't work out locally.
+		void rebuild();
+		// Redoes the matches of the rules within size of p, see setTile(). False if something 
+		// further away could be affected.
+		bool rebuildAround(const point& p, int size);
+
+		// Views of the hexes, all the per hex arrays are indexed the same way.
 		std::vector<HexObject> tiles_;
+		// The fields used for rule matching.
+		std::vector<string_id> type_ids_;
+		std::vector<string_id> mod_ids_;
+		std::vector<string_id> full_type_ids_;
+		// flag_words_ words of flag bits for each hex, bit n being the flag with flag_index() n.
+		std::vector<uint64_t> flags_;
+		int flag_words_;
+		// Flags added by a rule which is being matched, as (hex index, flag index) pairs. These are
+		// only ever a few at a time.
+		std::vector<std::pair<int, int>> temp_flags_;
+		// The images of each hex are a contiguous range of image_pool_. Ranges that were replaced
+		// are left as garbage until there's as much of it as there are images in use.
+		struct ImageSpan
+		{
+			ImageSpan() : first(0), count(0) {}
+			int first;
+			int count;
+		};
+		std::vector<ImageSpan> image_spans_;
+		std::vector<ImageHolder> image_pool_;
+		int image_garbage_;
+		// While building, images are held here as (hex index, image) pairs and moved into the pool
+		// in hex order at the end.
+		bool building_;
+		std::vector<std::pair<int, ImageHolder>> new_images_;
+		// Each thing a rule match did to a hex, in order: the rule and the hex it was matched at,
+		// and the flag index of the flag it set or -1 if it added the next of the hex's images. 
+		// A flag that was already set isn't recorded.
+		struct MatchRecord
+		{
+			MatchRecord(int r, const point& o, int f) : rule(r), origin(o), flag(f) {}
+			int rule;
+			point origin;
+			int flag;
+		};
+		// The records of each hex, kept like the images. As matches are made they're added to 
+		// new_records_ as (hex index, record) pairs, which are moved to the pool at the end of a 
+		// build.
+		std::vector<ImageSpan> record_spans_;
+		std::vector<MatchRecord> record_pool_;
+		int record_garbage_;
+		std::vector<std::pair<int, MatchRecord>> new_records_;
+		// The match in progress, match_rule_ is -1 if there isn't one.
+		int match_rule_;
+		point match_origin_;
+		// Until the map is built setTile() just changes the terrain.
+		bool built_;
 		int x_;
 		int y_;
 		int width_;
@@ -123,6 +240,46 @@ namespace hex
 		};
 		std::vector<StartingPosition> starting_positions_;
 		bool changed_;
+		// Indexes of hexes whose images changed since the last process().
+		std::vector<int> changed_hexes_;
 		MapNodePtr renderable_;
 	};
+
+	// Builds old-style map data of the given size by tiling the map in filename, for benchmarks.
+	std::string generate_map_data(const std::string& filename, int width, int height);
+
+	// Map data and the remaining arguments of a benchmark taking "map_file size ..." arguments.
+	struct BenchmarkMapArgs
+	{
+		std::string data;
+		int size;
+		std::vector<std::string> params;
+	};
+	// Splits args on spaces. The map data is the contents of map_file if size is 0, otherwise it's
+	// generated from the file at size x size. There must be between min_params and max_params 
+	// arguments after the size, usage describes all of them in the error if not.
+	BenchmarkMapArgs parse_benchmark_map_args(const std::string& args, size_t min_params, size_t max_params, const std::string& usage);
+
+	// Terrain types, files and rules in the form ScopedTerrainConfig takes and a small map they
+	// put flags and images all over, for tests which compare maps built in different ways. The 
+	// spreading rule carries a flag any distance across the map, further than any margin.
+	variant get_test_terrain_config(bool spreading_rule=true);
+	std::string get_test_map_data();
+
+	inline string_id HexObject::getTypeId() const { return parent_->type_ids_[index_]; }
+	inline string_id HexObject::getModId() const { return parent_->mod_ids_[index_]; }
+	inline string_id HexObject::getFullTypeId() const { return parent_->full_type_ids_[index_]; }
+	inline bool HexObject::hasFlag(string_id flag) const { return parent_->hasFlag(index_, find_flag_index(flag)); }
+	inline bool HexObject::hasFlagIndex(int flag) const { return parent_->hasFlag(index_, flag); }
+
+	inline bool HexMap::hasFlag(int index, int flag) const
+	{
+		if(flag < 0) {
+			return false;
+		}
+		if(flag < flag_words_ * 64 && (flags_[index * flag_words_ + flag / 64] & (uint64_t(1) << (flag % 64))) != 0) {
+			return true;
+		}
+		return !temp_flags_.empty() && std::find(temp_flags_.cbegin(), temp_flags_.cend(), std::make_pair(index, flag)) != temp_flags_.cend();
+	}
 }
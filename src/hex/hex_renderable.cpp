@@ -21,14 +21,21 @@
 	   distribution.
 */
 
+#include <algorithm>
 #include <set>
 
+#include <boost/lexical_cast.hpp>
+
 #include "hex_helper.hpp"
 #include "hex_loader.hpp"
 #include "hex_map.hpp"
 #include "hex_renderable.hpp"
 #include "hex_tile.hpp"
 
+#include "CameraObject.hpp"
+#include "DisplayDevice.hpp"
+#include "Frustum.hpp"
+#include "RenderManager.hpp"
 #include "Shaders.hpp"
 #include "SceneGraph.hpp"
 #include "StencilSettings.hpp"
@@ -36,6 +43,7 @@
 
 #include "random.hpp"
 #include "profile_timer.hpp"
+#include "unit_test.hpp"
 
 namespace hex
 {
@@ -46,6 +54,127 @@ namespace hex
 		rng::Seed hex_tile_seed;
 
 		const int g_hex_tile_size = 72;
+
+		// Layers are culled in blocks of this many hexes square.
+		const int g_bucket_size = 16;
+
+		// Images are drawn as quads of two triangles sharing a diagonal.
+		const int g_vertices_per_quad = 4;
+		const int g_indices_per_quad = 6;
+
+		template<typename T>
+		std::vector<T> make_quad_indices(int quads)
+		{
+			std::vector<T> indices;
+			indices.reserve(quads * g_indices_per_quad);
+			for(int n = 0; n != quads; ++n) {
+				const T v = static_cast<T>(n * g_vertices_per_quad);
+				indices.emplace_back(v);
+				indices.emplace_back(v + 1);
+				indices.emplace_back(v + 2);
+				indices.emplace_back(v + 2);
+				indices.emplace_back(v);
+				indices.emplace_back(v + 3);
+			}
+			return indices;
+		}
+
+		// Draws a layer's images as instances of a unit quad, see MapLayer::QuadInstance.
+		ShaderProgramPtr get_instanced_shader()
+		{
+			static ShaderProgramPtr res;
+			if(res == nullptr) {
+				const char* const vs = 
+					"uniform mat4 u_mvp_matrix;\n"
+					"attribute vec2 a_position;\n"
+					"attribute vec4 a_area;\n"
+					"attribute vec4 a_uv;\n"
+					"varying vec2 v_texcoord;\n"
+					"void main()\n"
+					"{\n"
+					"    v_texcoord = mix(a_uv.xy, a_uv.zw, a_position);\n"
+					"    gl_Position = u_mvp_matrix * vec4(a_area.xy + a_position * a_area.zw, 0.0, 1.0);\n"
+					"}\n";
+				const char* const fs =
+					"#ifdef GL_ES\n"
+					"precision mediump float;\n"
+					"#endif\n"
+					"uniform sampler2D u_tex_map;\n"
+					"uniform bool u_discard;\n"
+					"uniform vec4 u_color;\n"
+					"varying vec2 v_texcoord;\n"
+					"void main()\n"
+					"{\n"
+					"    vec4 color = texture2D(u_tex_map, v_texcoord);\n"
+					"    if(u_discard && color[3] == 0.0) {\n"
+					"        discard;\n"
+					"    }\n"
+					"    gl_FragColor = color * u_color;\n"
+					"}\n";
+				std::vector<ShaderData> shader_data;
+				shader_data.emplace_back(ProgramType::VERTEX, vs);
+				shader_data.emplace_back(ProgramType::FRAGMENT, fs);
+				std::vector<ActiveMapping> uniform_map;
+				uniform_map.emplace_back("mvp_matrix", "u_mvp_matrix");
+				uniform_map.emplace_back("color", "u_color");
+				uniform_map.emplace_back("discard", "u_discard");
+				uniform_map.emplace_back("tex_map", "u_tex_map");
+				std::vector<ActiveMapping> attribute_map;
+				attribute_map.emplace_back("position", "a_position");
+				res = ShaderProgram::createShader("hex_instanced", shader_data, uniform_map, attribute_map);
+			}
+			return res;
+		}
+
+		// Draws every frame of a layer's animations, hiding those which aren't current by 
+		// collapsing their vertices to a point. a_frame is the frame index and frame count.
+		ShaderProgramPtr get_animated_shader()
+		{
+			static ShaderProgramPtr res;
+			if(res == nullptr) {
+				const char* const vs = 
+					"uniform mat4 u_mvp_matrix;\n"
+					"uniform float u_frame;\n"
+					"attribute vec2 a_position;\n"
+					"attribute vec2 a_texcoord;\n"
+					"attribute vec2 a_frame;\n"
+					"varying vec2 v_texcoord;\n"
+					"void main()\n"
+					"{\n"
+					"    float shown = 1.0 - step(0.5, abs(mod(u_frame, a_frame.y) - a_frame.x));\n"
+					"    v_texcoord = a_texcoord;\n"
+					"    gl_Position = shown * (u_mvp_matrix * vec4(a_position, 0.0, 1.0));\n"
+					"}\n";
+				const char* const fs =
+					"#ifdef GL_ES\n"
+					"precision mediump float;\n"
+					"#endif\n"
+					"uniform sampler2D u_tex_map;\n"
+					"uniform vec4 u_color;\n"
+					"varying vec2 v_texcoord;\n"
+					"void main()\n"
+					"{\n"
+					"    gl_FragColor = texture2D(u_tex_map, v_texcoord) * u_color;\n"
+					"}\n";
+				std::vector<ShaderData> shader_data;
+				shader_data.emplace_back(ProgramType::VERTEX, vs);
+				shader_data.emplace_back(ProgramType::FRAGMENT, fs);
+				std::vector<ActiveMapping> uniform_map;
+				uniform_map.emplace_back("mvp_matrix", "u_mvp_matrix");
+				uniform_map.emplace_back("color", "u_color");
+				uniform_map.emplace_back("tex_map", "u_tex_map");
+				std::vector<ActiveMapping> attribute_map;
+				attribute_map.emplace_back("position", "a_position");
+				attribute_map.emplace_back("texcoord", "a_texcoord");
+				res = ShaderProgram::createShader("hex_animated", shader_data, uniform_map, attribute_map);
+			}
+			return res;
+		}
+
+		uint16_t to_unorm16(float f)
+		{
+			return static_cast<uint16_t>(std::min(std::max(f, 0.0f), 1.0f) * 65535.0f + 0.5f);
+		}
 	}
 
 	SceneNodeRegistrar<MapNode> psc_register("hex_map");
@@ -53,7 +182,12 @@ namespace hex
 	MapNode::MapNode(std::weak_ptr<KRE::SceneGraph> sg, const variant& node)
 		: SceneNode(sg, node),
 		  layers_(),
-		  changed_(false)
+		  layer_info_(),
+		  rr_(),
+		  width_(0),
+		  height_(0),
+		  changed_(false),
+		  culling_(true)
 	{
 	}
 
@@ -62,8 +196,19 @@ namespace hex
 		return std::make_shared<MapNode>(sg, node);
 	}
 
+	rect MapNode::getTileArea(const rect& pixel_area)
+	{
+		// Columns overlap by a quarter of a tile.
+		const int column_width = 3 * g_hex_tile_size / 4;
+		return rect::from_coordinates(pixel_area.x1() / column_width - 1, 
+			pixel_area.y1() / g_hex_tile_size - 1, 
+			pixel_area.x2() / column_width + 1, 
+			pixel_area.y2() / g_hex_tile_size + 1);
+	}
+
 	void MapNode::notifyNodeAttached(std::weak_ptr<SceneNode> parent)
 	{
+		SceneNode::notifyNodeAttached(parent);
 		for(auto& layer : layers_) {
 			attachObject(layer);
 		}
@@ -100,12 +245,10 @@ namespace hex
 		const float vx2 = static_cast<float>(p.x + w);
 		const float vy2 = static_cast<float>(p.y + h);
 
+		// The triangles are made up by the layer's index buffer, see MapLayer::updateAttributes().
 		coords->emplace_back(glm::vec2(vx1, vy1), glm::vec2(uv.x1(), uv.y1()));
 		coords->emplace_back(glm::vec2(vx2, vy1), glm::vec2(uv.x2(), uv.y1()));
 		coords->emplace_back(glm::vec2(vx2, vy2), glm::vec2(uv.x2(), uv.y2()));
-
-		coords->emplace_back(glm::vec2(vx2, vy2), glm::vec2(uv.x2(), uv.y2()));
-		coords->emplace_back(glm::vec2(vx1, vy1), glm::vec2(uv.x1(), uv.y1()));
 		coords->emplace_back(glm::vec2(vx1, vy2), glm::vec2(uv.x1(), uv.y2()));
 		return p;
 	}
@@ -196,81 +339,295 @@ namespace hex
 
 	void MapNode::update(int width, int height, const std::vector<HexObject>& tiles)
 	{
+		profile::manager pman("MapNode::update()");
+		width_ = width;
+		height_ = height;
 		layers_.clear();
+		layer_info_.clear();
 		clear();
 
 		rr_.reset(new RectRenderable);
-		const point p1 = get_pixel_pos_from_tile_pos_evenq(1, 1, g_hex_tile_size) + point(0, g_hex_tile_size / 2);
-		const point p2 = get_pixel_pos_from_tile_pos_evenq(width-2, height-2, g_hex_tile_size) + point(0, g_hex_tile_size / 2);
+		// The map may be part of a larger one, so is outlined from its first tile.
+		const point origin = tiles.empty() ? point() : tiles.front().getPosition();
+		const point p1 = get_pixel_pos_from_tile_pos_evenq(origin.x + 1, origin.y + 1, g_hex_tile_size) + point(0, g_hex_tile_size / 2);
+		const point p2 = get_pixel_pos_from_tile_pos_evenq(origin.x + width - 2, origin.y + height - 2, g_hex_tile_size) + point(0, g_hex_tile_size / 2);
 		rr_->update(p1.x, p1.y, p2.x, p2.y, Color::colorWhite());
 		rr_->setOrder(999999);
 		attachObject(rr_);
 
-		std::map<std::pair<int,int>, std::pair<MapLayerPtr, std::vector<KRE::vertex_texcoord>>> map_layers;
-		for(auto& hex : tiles) {
-			auto images = hex.getImages();
-			for(auto& img : images) {
-				rect area;
-				std::vector<int> borders;
-				auto tex = get_terrain_texture(img.name, &area, &borders);
-				if(!img.crop.empty()) {
-					area = rect(area.x1() + img.crop.x1(), area.y1() + img.crop.y1(), img.crop.w(), img.crop.h());
+		layer_coords_type coords;
+		std::map<layer_key, hex_vertices_type> hex_vertices;
+		for(int n = 0; n != static_cast<int>(tiles.size()); ++n) {
+			addHexImages(tiles[n], n, &coords, &hex_vertices);
+		}
+
+		size_t vertex_count = 0;
+		for(const auto& c : coords) {
+			vertex_count += c.second.size();
+		}
+		// Each layer is a draw call.
+		LOG_DEBUG("MapNode::update() " << vertex_count << " vertices, " << (vertex_count * sizeof(KRE::vertex_texcoord)) << " bytes, " << layer_info_.size() << " layers");
+
+		for(auto& li : layer_info_) {
+			li.second.hex_vertices.swap(hex_vertices[li.first]);
+			// Animated layers build their own geometry from their animation sequences.
+			if(std::dynamic_pointer_cast<AnimatedMapLayer>(li.second.layer) == nullptr) {
+				updateBuckets(li.second, coords[li.first], tiles);
+				li.second.layer->updateAttributes(&coords[li.first]);
+			}
+		}
+		attachLayers();
+	}
+
+	void MapNode::updateHexes(const std::vector<HexObject>& tiles, const std::vector<int>& changed)
+	{
+		// Animated layers rebuild their geometry from their sequences the next time they're drawn 
+		// after a sequence changes, so only need the old sequences removed here. addHexImages() 
+		// adds the new ones.
+		for(auto& li : layer_info_) {
+			auto aml = std::dynamic_pointer_cast<AnimatedMapLayer>(li.second.layer);
+			if(aml != nullptr) {
+				for(const int index : changed) {
+					aml->removeAnimationSeq(get_pixel_pos_from_tile_pos_evenq(tiles[index].getPosition(), g_hex_tile_size));
+				}
+			}
+		}
+
+		layer_coords_type coords;
+		std::map<layer_key, hex_vertices_type> hex_vertices;
+		for(const int index : changed) {
+			if(!addHexImages(tiles[index], index, &coords, &hex_vertices)) {
+				update(width_, height_, tiles);
+				return;
+			}
+		}
+
+		for(auto& li : layer_info_) {
+			auto& info = li.second;
+			if(std::dynamic_pointer_cast<AnimatedMapLayer>(info.layer) != nullptr) {
+				continue;
+			}
+			const auto& new_coords = coords[li.first];
+			const auto& new_vertices = hex_vertices[li.first];
+
+			bool affected = false;
+			bool same_size = true;
+			for(const int index : changed) {
+				auto old_it = info.hex_vertices.find(index);
+				auto new_it = new_vertices.find(index);
+				const int old_count = old_it == info.hex_vertices.end() ? 0 : old_it->second.second;
+				const int new_count = new_it == new_vertices.end() ? 0 : new_it->second.second;
+				affected |= old_count != 0 || new_count != 0;
+				same_size &= old_count == new_count;
+			}
+			if(!affected) {
+				continue;
+			}
+
+			if(same_size) {
+				for(const auto& nv : new_vertices) {
+					std::vector<KRE::vertex_texcoord> vtx(new_coords.begin() + nv.second.first, new_coords.begin() + nv.second.first + nv.second.second);
+					info.layer->updateAttributes(vtx, info.hex_vertices[nv.first].first);
 				}
-				if(img.is_animated) {
-					auto& layer = map_layers[std::make_pair(img.layer,tex->id())];
-					std::shared_ptr<AnimatedMapLayer> aml = std::dynamic_pointer_cast<AnimatedMapLayer>(layer.first);
-					if(aml == nullptr) {
-						aml = std::make_shared<AnimatedMapLayer>();
+				// The images may have moved even though they have the same number of vertices.
+				updateBuckets(info, info.layer->getAttributes(), tiles);
+				continue;
+			}
+
+			// Splice the new vertices in, keeping everything in map order as update() does.
+			const auto old_coords = info.layer->getAttributes();
+			std::vector<KRE::vertex_texcoord> vtx;
+			hex_vertices_type vertices;
+			auto old_it = info.hex_vertices.cbegin();
+			auto changed_it = changed.cbegin();
+			while(old_it != info.hex_vertices.cend() || changed_it != changed.cend()) {
+				const bool use_old = changed_it == changed.cend() || (old_it != info.hex_vertices.cend() && old_it->first < *changed_it);
+				const int index = use_old ? old_it->first : *changed_it;
+				if(use_old) {
+					vertices[index] = std::make_pair(static_cast<int>(vtx.size()), old_it->second.second);
+					vtx.insert(vtx.end(), old_coords.begin() + old_it->second.first, old_coords.begin() + old_it->second.first + old_it->second.second);
+				} else {
+					auto new_it = new_vertices.find(index);
+					if(new_it != new_vertices.end()) {
+						vertices[index] = std::make_pair(static_cast<int>(vtx.size()), new_it->second.second);
+						vtx.insert(vtx.end(), new_coords.begin() + new_it->second.first, new_coords.begin() + new_it->second.first + new_it->second.second);
+					}
+					if(old_it != info.hex_vertices.cend() && old_it->first == index) {
+						++old_it;
 					}
-					aml->setTexture(tex);
-					aml->addAnimationSeq(img.animation_frames, get_pixel_pos_from_tile_pos_evenq(hex.getPosition(), g_hex_tile_size));
-					aml->setAnimationTiming(img.animation_timing);
-					aml->setCrop(img.crop);
-					aml->setColor(1.0f, 1.0f, 1.0f, img.opacity);
-					aml->setBCO(img.base, img.center, img.offset);
+					++changed_it;
+				}
+				if(use_old) {
+					++old_it;
+				}
+			}
+			info.hex_vertices.swap(vertices);
+			updateBuckets(info, vtx, tiles);
+			if(vtx.empty()) {
+				info.layer->clearAttributes();
+			} else {
+				info.layer->updateAttributes(&vtx);
+			}
+		}
+		attachLayers();
+	}
+
+	bool MapNode::addHexImages(const HexObject& hex, int index, layer_coords_type* coords, std::map<layer_key, hex_vertices_type>* hex_vertices)
+	{
+		auto images = hex.getImages();
+		for(auto& img : images) {
+			rect area;
+			std::vector<int> borders;
+			auto tex = get_terrain_texture(img.name, &area, &borders);
+			if(!img.crop.empty()) {
+				area = rect(area.x1() + img.crop.x1(), area.y1() + img.crop.y1(), img.crop.w(), img.crop.h());
+			}
+			if(img.is_animated) {
+				auto& layer = layer_info_[std::make_pair(img.layer,tex->id())];
+				std::shared_ptr<AnimatedMapLayer> aml = std::dynamic_pointer_cast<AnimatedMapLayer>(layer.layer);
+				if(aml == nullptr) {
+					if(layer.attached) {
+						return false;
+					}
+					aml = std::make_shared<AnimatedMapLayer>();
+				}
+				aml->setTexture(tex);
+				aml->addAnimationSeq(img.animation_frames, get_pixel_pos_from_tile_pos_evenq(hex.getPosition(), g_hex_tile_size));
+				aml->setAnimationTiming(img.animation_timing);
+				aml->setCrop(img.crop);
+				aml->setColor(1.0f, 1.0f, 1.0f, img.opacity);
+				aml->setBCO(img.base, img.center, img.offset);
 					
-					layer.first = aml;
-				} else {
-					if(tex) {
-						auto& layer = map_layers[std::make_pair(img.layer,tex->id())];
-						if(layer.first == nullptr) {
-							layer.first.reset(new MapLayer);
-						}
-
-						layer.first->setTexture(tex);
-						add_tex_coords(&layer.second, 
-							tex->getTextureCoords(0, area), 
-							area.w(), 
-							area.h(), 
-							borders, 
-							img.base, 
-							img.center, 
-							img.offset,
-							get_pixel_pos_from_tile_pos_evenq(hex.getPosition(), 
-							g_hex_tile_size));
-						layer.first->setColor(1.0f, 1.0f, 1.0f, img.opacity);
+				layer.layer = aml;
+			} else {
+				if(tex) {
+					const layer_key key = std::make_pair(img.layer,tex->id());
+					auto& layer = layer_info_[key];
+					if(layer.layer == nullptr) {
+						layer.layer.reset(new MapLayer);
 					}
+
+					layer.layer->setTexture(tex);
+					auto& vtx = (*coords)[key];
+					auto& range = (*hex_vertices)[key].emplace(index, std::make_pair(static_cast<int>(vtx.size()), 0)).first->second;
+					add_tex_coords(&vtx, 
+						tex->getTextureCoords(0, area), 
+						area.w(), 
+						area.h(), 
+						borders, 
+						img.base, 
+						img.center, 
+						img.offset,
+						get_pixel_pos_from_tile_pos_evenq(hex.getPosition(), 
+						g_hex_tile_size));
+					range.second = static_cast<int>(vtx.size()) - range.first;
+					layer.layer->setColor(1.0f, 1.0f, 1.0f, img.opacity);
 				}
 			}
 		}
+		return true;
+	}
 
-		for(auto& layer : map_layers) {
-			layer.second.first->updateAttributes(&layer.second.second);
-			layer.second.first->setOrder(layer.first.first + layer.first.second + 1000);
-			layer.second.first->setBlendMode(BlendModeConstants::BM_ONE, BlendModeConstants::BM_ONE_MINUS_SRC_ALPHA);
-			layers_.emplace_back(layer.second.first);
-			attachObject(layer.second.first);
+	void MapNode::attachLayers()
+	{
+		for(auto& li : layer_info_) {
+			if(li.second.attached) {
+				continue;
+			}
+			li.second.attached = true;
+			li.second.layer->setOrder(li.first.first + li.first.second + 1000);
+			li.second.layer->setBlendMode(BlendModeConstants::BM_ONE, BlendModeConstants::BM_ONE_MINUS_SRC_ALPHA);
+			layers_.emplace_back(li.second.layer);
+			attachObject(li.second.layer);
 		}
 	}
 
+	void MapNode::updateBuckets(const LayerInfo& info, const std::vector<KRE::vertex_texcoord>& vtx, const std::vector<HexObject>& tiles)
+	{
+		std::vector<MapLayer::Bucket> buckets;
+		if(culling_) {
+			// Hexes are in map order, so within a block each row's vertices are contiguous.
+			std::map<point, std::pair<glm::vec2, glm::vec2>> extents;
+			std::map<point, MapLayer::Bucket> blocks;
+			for(const auto& hv : info.hex_vertices) {
+				const int first = hv.second.first;
+				const int count = hv.second.second;
+				if(count == 0) {
+					continue;
+				}
+				const point& pos = tiles[hv.first].getPosition();
+				const point block(pos.x / g_bucket_size, pos.y / g_bucket_size);
+				auto& ranges = blocks[block].ranges;
+				if(!ranges.empty() && ranges.back().first + ranges.back().second == first) {
+					ranges.back().second += count;
+				} else {
+					ranges.emplace_back(first, count);
+				}
+				auto it = extents.find(block);
+				if(it == extents.end()) {
+					it = extents.emplace(block, std::make_pair(vtx[first].vtx, vtx[first].vtx)).first;
+				}
+				for(int n = first; n != first + count; ++n) {
+					it->second.first = glm::min(it->second.first, vtx[n].vtx);
+					it->second.second = glm::max(it->second.second, vtx[n].vtx);
+				}
+			}
+			buckets.reserve(blocks.size());
+			for(auto& b : blocks) {
+				const auto& ext = extents[b.first];
+				b.second.area = rectf(ext.first.x, ext.first.y, ext.second.x - ext.first.x, ext.second.y - ext.first.y);
+				buckets.emplace_back(std::move(b.second));
+			}
+		}
+		info.layer->setBuckets(&buckets);
+	}
+
+	MapLayer::MapLayer(const std::string& name)
+		: SceneObject(name),
+		  attr_(nullptr),
+		  quad_(nullptr),
+		  instances_(nullptr),
+		  instanced_(false),
+		  buckets_(),
+		  cull_mvp_(1.0f),
+		  cull_valid_(false),
+		  index_quads_(0)
+	{
+	}
+
 	MapLayer::MapLayer()
-		: SceneObject("hex::MapLayer"),
-		  attr_(nullptr)
+		: MapLayer("hex::MapLayer")
 	{
+		instanced_ = DisplayDevice::checkForFeature(DisplayDeviceCapabilties::INSTANCED_ARRAYS);
+		if(instanced_) {
+			setShader(get_instanced_shader());
+
+			auto as = DisplayDevice::createAttributeSet(true, false, true);
+			as->setDrawMode(DrawMode::TRIANGLE_STRIP);
+
+			quad_ = std::make_shared<Attribute<glm::vec2>>(AccessFreqHint::STATIC);
+			quad_->addAttributeDesc(AttributeDesc(AttrType::POSITION, 2, AttrFormat::FLOAT, false, sizeof(glm::vec2), 0, 0));
+			as->addAttribute(quad_);
+
+			instances_ = std::make_shared<Attribute<QuadInstance>>(AccessFreqHint::STATIC);
+			instances_->addAttributeDesc(AttributeDesc("a_area", 4, AttrFormat::FLOAT, false, sizeof(QuadInstance), offsetof(QuadInstance, area), 1));
+			instances_->addAttributeDesc(AttributeDesc("a_uv", 4, AttrFormat::UNSIGNED_SHORT, true, sizeof(QuadInstance), offsetof(QuadInstance, uv), 1));
+			as->addAttribute(instances_);
+			addAttributeSet(as);
+
+			std::vector<glm::vec2> corners;
+			corners.emplace_back(0.0f, 0.0f);
+			corners.emplace_back(1.0f, 0.0f);
+			corners.emplace_back(0.0f, 1.0f);
+			corners.emplace_back(1.0f, 1.0f);
+			quad_->update(&corners);
+			as->setInstanceCount(0);
+			return;
+		}
+
 		setShader(ShaderProgram::getSystemDefault());
 
-		//auto as = DisplayDevice::createAttributeSet(true, false ,true);
-		auto as = DisplayDevice::createAttributeSet(true, false, false);
+		auto as = DisplayDevice::createAttributeSet(true, true, false);
 		as->setDrawMode(DrawMode::TRIANGLES);
 
 		attr_ = std::make_shared<Attribute<vertex_texcoord>>(AccessFreqHint::STATIC);
@@ -280,100 +637,269 @@ namespace hex
 		as->addAttribute(attr_);
 		addAttributeSet(as);
 	}
+
+	MapLayer::QuadInstance MapLayer::makeInstance(const KRE::vertex_texcoord* quad)
+	{
+		// Opposite corners of the quad, see add_tex_coords().
+		const auto& v1 = quad[0];
+		const auto& v2 = quad[2];
+		QuadInstance res;
+		res.area = glm::vec4(v1.vtx.x, v1.vtx.y, v2.vtx.x - v1.vtx.x, v2.vtx.y - v1.vtx.y);
+		res.uv = glm::u16vec4(to_unorm16(v1.tc.x), to_unorm16(v1.tc.y), to_unorm16(v2.tc.x), to_unorm16(v2.tc.y));
+		return res;
+	}
 	
 	void MapLayer::updateAttributes(std::vector<KRE::vertex_texcoord>* attrs)
 	{
+		const int quads = static_cast<int>(attrs->size()) / g_vertices_per_quad;
+		auto& as = getAttributeSet().front();
+		if(instanced_) {
+			std::vector<QuadInstance> instances;
+			instances.reserve(quads);
+			for(int n = 0; n != quads; ++n) {
+				instances.emplace_back(makeInstance(&(*attrs)[n * g_vertices_per_quad]));
+			}
+			instances_->update(&instances);
+			as->setCount(g_vertices_per_quad);
+			as->setInstanceCount(quads);
+			return;
+		}
+
 		attr_->update(attrs);
+		// The indices only depend on the number of quads, so are kept while there are enough.
+		if(quads > index_quads_) {
+			if(quads * g_vertices_per_quad <= 65536) {
+				auto indices = make_quad_indices<uint16_t>(quads);
+				as->updateIndicies(&indices);
+			} else {
+				auto indices = make_quad_indices<uint32_t>(quads);
+				as->updateIndicies(&indices);
+			}
+			index_quads_ = quads;
+		}
+		as->setCount(quads * g_indices_per_quad);
+	}
+
+	void MapLayer::updateAttributes(const std::vector<KRE::vertex_texcoord>& attrs, int offset)
+	{
+		if(!instanced_) {
+			attr_->updateRange(attrs, offset);
+			return;
+		}
+		std::vector<QuadInstance> instances;
+		for(int n = 0; n + g_vertices_per_quad <= static_cast<int>(attrs.size()); n += g_vertices_per_quad) {
+			instances.emplace_back(makeInstance(&attrs[n]));
+		}
+		instances_->updateRange(instances, offset / g_vertices_per_quad);
+	}
+
+	std::vector<KRE::vertex_texcoord> MapLayer::getAttributes() const
+	{
+		if(!instanced_) {
+			return std::vector<KRE::vertex_texcoord>(attr_->cbegin(), attr_->cend());
+		}
+		std::vector<KRE::vertex_texcoord> res;
+		res.reserve(instances_->size() * g_vertices_per_quad);
+		for(auto it = instances_->cbegin(); it != instances_->cend(); ++it) {
+			const glm::vec2 p1(it->area.x, it->area.y);
+			const glm::vec2 p2 = p1 + glm::vec2(it->area.z, it->area.w);
+			const glm::vec4 uv = glm::vec4(it->uv) / 65535.0f;
+			res.emplace_back(p1, glm::vec2(uv.x, uv.y));
+			res.emplace_back(glm::vec2(p2.x, p1.y), glm::vec2(uv.z, uv.y));
+			res.emplace_back(p2, glm::vec2(uv.z, uv.w));
+			res.emplace_back(glm::vec2(p1.x, p2.y), glm::vec2(uv.x, uv.w));
+		}
+		return res;
+	}
+
+	void MapLayer::clearAttributes()
+	{
+		if(instanced_) {
+			instances_->clear();
+			getAttributeSet().front()->setInstanceCount(0);
+		} else {
+			attr_->clear();
+		}
+		std::vector<Bucket> no_buckets;
+		setBuckets(&no_buckets);
+	}
+
+	void MapLayer::setBuckets(std::vector<Bucket>* buckets)
+	{
+		buckets_.swap(*buckets);
+		cull_valid_ = false;
+		auto& as = getAttributeSet().front();
+		as->enableMultiDraw(!buckets_.empty());
+		as->clearMultiDrawData();
+	}
+
+	void MapLayer::preRender(const KRE::WindowPtr& wnd)
+	{
+		if(buckets_.empty()) {
+			return;
+		}
+		CameraPtr cam = getCamera() != nullptr ? getCamera() : DisplayDevice::getCurrent()->getDefaultCamera();
+		glm::mat4 pmat(1.0f);
+		glm::mat4 vmat(1.0f);
+		if(cam != nullptr) {
+			pmat = cam->getProjectionMat();
+			vmat = cam->getViewMat();
+		}
+		const glm::mat4 model = getModelMatrix();
+		const glm::mat4 mvp = pmat * vmat * model;
+		if(cull_valid_ && mvp == cull_mvp_) {
+			return;
+		}
+		cull_mvp_ = mvp;
+		cull_valid_ = true;
+
+		// Testing against the frustum in the layer's own co-ordinates works for orthographic as 
+		// well as perspective cameras.
+		const Frustum frustum(pmat, vmat * model);
+		std::vector<std::pair<int, int>> ranges;
+		for(const auto& bucket : buckets_) {
+			if(frustum.isCubeInside(glm::vec3(bucket.area.x(), bucket.area.y(), 0.0f), bucket.area.w(), bucket.area.h(), 0.0f)) {
+				ranges.insert(ranges.end(), bucket.ranges.begin(), bucket.ranges.end());
+			}
+		}
+		// Draw adjacent rows of neighbouring buckets with one range.
+		std::sort(ranges.begin(), ranges.end());
+		auto& as = getAttributeSet().front();
+		as->clearMultiDrawData();
+		for(auto it = ranges.cbegin(); it != ranges.cend(); ) {
+			const int first = it->first;
+			int last = it->first + it->second;
+			for(++it; it != ranges.cend() && it->first == last; ++it) {
+				last += it->second;
+			}
+			// Ranges are in instances when instancing, otherwise in indices.
+			if(instanced_) {
+				as->addMultiDrawData(first / g_vertices_per_quad, (last - first) / g_vertices_per_quad);
+			} else {
+				as->addMultiDrawData(first / g_vertices_per_quad * g_indices_per_quad, (last - first) / g_vertices_per_quad * g_indices_per_quad);
+			}
+		}
 	}
 
 	AnimatedMapLayer::AnimatedMapLayer()
-		: frames_(),
+		: MapLayer("hex::AnimatedMapLayer"),
+		  frames_(),
 		  crop_rect_(),
 		  timing_(100),
-		  current_frame_pos_(0),
+		  base_(),
+		  center_(),
+		  offset_(),
+		  anim_attr_(nullptr),
+		  frame_(0.0f),
+		  changed_(false),
 		  mask_(nullptr),
 		  alpha_uv_()
 	{
+		auto shader = get_animated_shader()->clone();
+		const int u_frame = shader->getUniformOrDie("u_frame");
+		shader->setUniformDrawFunction([this, u_frame](ShaderProgramPtr shader) {
+			shader->setUniformValue(u_frame, frame_);
+		});
+		setShader(shader);
+
+		auto as = DisplayDevice::createAttributeSet(true, true, false);
+		as->setDrawMode(DrawMode::TRIANGLES);
+
+		anim_attr_ = std::make_shared<Attribute<AnimVertex>>(AccessFreqHint::STATIC);
+		anim_attr_->addAttributeDesc(AttributeDesc(AttrType::POSITION, 2, AttrFormat::FLOAT, false, sizeof(AnimVertex), offsetof(AnimVertex, vtx)));
+		anim_attr_->addAttributeDesc(AttributeDesc(AttrType::TEXTURE, 2, AttrFormat::FLOAT, false, sizeof(AnimVertex), offsetof(AnimVertex, tc)));
+		anim_attr_->addAttributeDesc(AttributeDesc("a_frame", 2, AttrFormat::FLOAT, false, sizeof(AnimVertex), offsetof(AnimVertex, frame)));
+
+		as->addAttribute(anim_attr_);
+		addAttributeSet(as);
 	}
 
 	void AnimatedMapLayer::preRender(const KRE::WindowPtr& wnd)
 	{
-		static int last_check_time = -1;
-		bool update_anim = false;
-		if(last_check_time == -1) {
-			last_check_time = profile::get_tick_time();
-			update_anim = true;
-		} else {
-			int current_tick = profile::get_tick_time();
-			if(current_tick - last_check_time >= timing_) {
-				last_check_time = current_tick;
-				update_anim = true;
-			}
+		if(changed_) {
+			updateFrames();
+			changed_ = false;
 		}
+		// Every layer counts frames from the same clock, so chunks and layers loaded at different
+		// times animate in step.
+		frame_ = static_cast<float>(profile::get_tick_time() / std::max(timing_, 1));
+	}
 
-		if(update_anim) {
-			if(mask_ == nullptr) {
-				std::vector<int> borders;
-				rect area;
-				auto tex = get_terrain_texture("alphamask", &area, &borders);
-				alpha_uv_ = tex->getTextureCoords(0, area);
-				mask_.reset(new Blittable(tex));
-				auto shader = ShaderProgram::getSystemDefault()->clone();
-				shader->setUniformDrawFunction([](ShaderProgramPtr shader) { 
-					shader->setUniformValue(shader->getDiscardUniform(), 1);
-				});
-				mask_->setShader(shader);
-			}
+	void AnimatedMapLayer::updateFrames()
+	{
+		if(mask_ == nullptr) {
+			std::vector<int> borders;
+			rect area;
+			auto tex = get_terrain_texture("alphamask", &area, &borders);
+			alpha_uv_ = tex->getTextureCoords(0, area);
+			mask_.reset(new Blittable(tex));
+			auto shader = ShaderProgram::getSystemDefault()->clone();
+			shader->setUniformDrawFunction([](ShaderProgramPtr shader) { 
+				shader->setUniformValue(shader->getDiscardUniform(), 1);
+			});
+			mask_->setShader(shader);
+		}
 
-			std::vector<KRE::vertex_texcoord> vtx;
-			std::vector<KRE::vertex_texcoord> mask_vtx;
-			auto tex = getTexture();
-			for(auto it = frames_.cbegin(); it != frames_.cend(); ++it) {
-				const auto& f = *it;
-				const auto& pos = f.first;
-				const auto& frame = f.second;
-				rect area = frame[current_frame_pos_ % frame.size()].area;
+		std::vector<KRE::vertex_texcoord> quad;
+		std::vector<AnimVertex> vtx;
+		std::vector<KRE::vertex_texcoord> mask_vtx;
+		auto tex = getTexture();
+		for(auto it = frames_.cbegin(); it != frames_.cend(); ++it) {
+			const auto& pos = it->first;
+			const auto& frames = it->second;
+			const float frame_count = static_cast<float>(frames.size());
+			point p;
+			for(int n = 0; n != static_cast<int>(frames.size()); ++n) {
+				rect area = frames[n].area;
 				if(!crop_rect_.empty()) {
 					area = rect(area.x1() + crop_rect_.x1(), area.y1() + crop_rect_.y1(), crop_rect_.w(), crop_rect_.h());
 				}
-				point p = add_tex_coords(&vtx, 
-					tex->getTextureCoords(0, area),
-					area.w(),
-					area.h(),
-					frame[current_frame_pos_ % frame.size()].borders, 
-					base_, 
-					center_, 
-					offset_,
-					pos);
-				if(it != frames_.cbegin()) {
-					mask_vtx.emplace_back(glm::vec2(p.x, p.y), glm::vec2(alpha_uv_.x1(), alpha_uv_.y1())); // degenerate
+				quad.clear();
+				const point fp = add_tex_coords(&quad, tex->getTextureCoords(0, area), area.w(), area.h(), frames[n].borders, base_, center_, offset_, pos);
+				for(const auto& v : quad) {
+					vtx.emplace_back(v.vtx, v.tc, glm::vec2(static_cast<float>(n), frame_count));
 				}
-				mask_vtx.emplace_back(glm::vec2(p.x, p.y), glm::vec2(alpha_uv_.x1(), alpha_uv_.y1()));
-				mask_vtx.emplace_back(glm::vec2(p.x + area.w(), p.y), glm::vec2(alpha_uv_.x2(), alpha_uv_.y1()));
-				mask_vtx.emplace_back(glm::vec2(p.x, p.y + area.h()), glm::vec2(alpha_uv_.x1(), alpha_uv_.y2()));
-				mask_vtx.emplace_back(glm::vec2(p.x + area.w(), p.y + area.h()), glm::vec2(alpha_uv_.x2(), alpha_uv_.y2()));
-				auto next_it = it; ++next_it;
-				if(next_it != frames_.cend()) {
-					mask_vtx.emplace_back(glm::vec2(p.x + area.w(), p.y + area.h()), glm::vec2(alpha_uv_.x2(), alpha_uv_.y2())); // degenerate
+				if(n == 0) {
+					p = fp;
 				}
-				/*add_hex_coords(&vtx, 
-					area, 
-					tex,
-					frames_[current_frame_pos_].borders, 
-					base_, 
-					center_, 
-					offset_,
-					pos);*/
 			}
 
-			clearAttributes();
-			updateAttributes(&vtx);
-
-			mask_->update(&mask_vtx);
-			setClipSettings(get_stencil_mask_settings(), mask_);
+			// The mask covers the first frame, the frames of a sequence are the same size.
+			const rect& area = frames.front().area;
+			const int w = crop_rect_.empty() ? area.w() : crop_rect_.w();
+			const int h = crop_rect_.empty() ? area.h() : crop_rect_.h();
+			if(it != frames_.cbegin()) {
+				mask_vtx.emplace_back(glm::vec2(p.x, p.y), glm::vec2(alpha_uv_.x1(), alpha_uv_.y1())); // degenerate
+			}
+			mask_vtx.emplace_back(glm::vec2(p.x, p.y), glm::vec2(alpha_uv_.x1(), alpha_uv_.y1()));
+			mask_vtx.emplace_back(glm::vec2(p.x + w, p.y), glm::vec2(alpha_uv_.x2(), alpha_uv_.y1()));
+			mask_vtx.emplace_back(glm::vec2(p.x, p.y + h), glm::vec2(alpha_uv_.x1(), alpha_uv_.y2()));
+			mask_vtx.emplace_back(glm::vec2(p.x + w, p.y + h), glm::vec2(alpha_uv_.x2(), alpha_uv_.y2()));
+			auto next_it = it; ++next_it;
+			if(next_it != frames_.cend()) {
+				mask_vtx.emplace_back(glm::vec2(p.x + w, p.y + h), glm::vec2(alpha_uv_.x2(), alpha_uv_.y2())); // degenerate
+			}
+		}
 
-			++current_frame_pos_;
+		const int quads = static_cast<int>(vtx.size()) / g_vertices_per_quad;
+		auto& as = getAttributeSet().front();
+		if(vtx.empty()) {
+			anim_attr_->clear();
+			as->setCount(0);
+		} else {
+			anim_attr_->update(&vtx);
+			if(quads * g_vertices_per_quad <= 65536) {
+				auto indices = make_quad_indices<uint16_t>(quads);
+				as->updateIndicies(&indices);
+			} else {
+				auto indices = make_quad_indices<uint32_t>(quads);
+				as->updateIndicies(&indices);
+			}
+			as->setCount(quads * g_indices_per_quad);
 		}
+
+		mask_->update(&mask_vtx);
+		setClipSettings(get_stencil_mask_settings(), mask_);
 	}
 
 	void AnimatedMapLayer::addAnimationSeq(const std::vector<std::string>& frames, const point& hex_pos)
@@ -386,6 +912,55 @@ namespace hex
 			auto tex = get_terrain_texture(frame, &area, &borders);
 			new_frames.emplace_back(area, borders);
 		}
-		frames_.emplace(hex_pos, new_frames);
+		if(!new_frames.empty()) {
+			frames_[hex_pos] = new_frames;
+			changed_ = true;
+		}
+	}
+}
+
+// Frame time for drawing a large map through a small view, with and without culling. Needs the
+// main window, so is only run from the full program.
+BENCHMARK_ARG(hex_map_render, const std::string& args)
+{
+	const auto map_args = hex::parse_benchmark_map_args(args, 3, 4, "map file, map size, view width and height, cull or nocull and optionally retained");
+	const auto& params = map_args.params;
+	const bool retained = params.size() == 4 && params[3] == "retained";
+	const int view_w = boost::lexical_cast<int>(params[0]);
+	const int view_h = boost::lexical_cast<int>(params[1]);
+
+	auto hmap = hex::HexMap::createFromString(map_args.data);
+	hmap->build();
+	auto scene = KRE::SceneGraph::create("hex_map_render");
+	scene->setRetained(retained);
+	auto node = std::dynamic_pointer_cast<hex::MapNode>(scene->createNode("hex_map"));
+	node->setCulling(params[2] == "cull");
+	hmap->setRenderable(node);
+	scene->getRootNode()->attachNode(node);
+	scene->getRootNode()->attachCamera(std::make_shared<KRE::Camera>("hex_map_render", 0, view_w, 0, view_h));
+	hmap->process();
+
+	auto wnd = KRE::WindowManager::getMainWindow();
+	auto rman = std::make_shared<KRE::RenderManager>();
+	rman->setRetained(retained);
+	rman->addQueue(0, "opaques");
+	std::vector<uint8_t> pixel;
+	auto& counters = KRE::DisplayDevice::getStateChangeCounters();
+	counters = KRE::StateChangeCounters();
+	test::reset_benchmark_timer();
+	BENCHMARK_LOOP {
+		wnd->clear(KRE::ClearFlags::ALL);
+		scene->renderScene(rman);
+		rman->render(wnd);
+		// Reading a pixel back waits for the frame to finish drawing.
+		KRE::DisplayDevice::getCurrent()->readPixels(0, 0, 1, 1, KRE::ReadFormat::RGBA, KRE::AttrFormat::UNSIGNED_BYTE, pixel, 4);
 	}
+	LOG_INFO("hex_map_render state changes (made/skipped): shaders " << counters.shader_changes << "/" << counters.shader_changes_skipped
+		<< ", textures " << counters.texture_binds << "/" << counters.texture_binds_skipped
+		<< ", uniforms " << counters.uniform_uploads << "/" << counters.uniform_uploads_skipped
+		<< ", blend " << counters.blend_changes << "/" << counters.blend_changes_skipped);
 }
+
+BENCHMARK_ARG_CALL(hex_map_render, synthetic512_cull, "data/maps/test01.map 512 1024 768 cull")
+BENCHMARK_ARG_CALL(hex_map_render, synthetic512_nocull, "data/maps/test01.map 512 1024 768 nocull")
+BENCHMARK_ARG_CALL(hex_map_render, synthetic512_cull_retained, "data/maps/test01.map 512 1024 768 cull retained")
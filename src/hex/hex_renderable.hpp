@@ -23,6 +23,8 @@
 
 #pragma once
 
+#include <glm/gtc/type_precision.hpp>
+
 #include "AttributeSet.hpp"
 #include "Blittable.hpp"
 #include "SceneNode.hpp"
@@ -39,14 +41,47 @@ namespace hex
 	public:
 		explicit MapNode(std::weak_ptr<KRE::SceneGraph> sg, const variant& node);
 		void update(int width, int height, const std::vector<HexObject>& tiles);
+		// Regenerates the geometry of just the hexes with the given indexes in tiles, which must be
+		// sorted. Vertex data is patched in place where the number of vertices for those hexes on
+		// a layer is unchanged, otherwise only the layers affected are rebuilt.
+		void updateHexes(const std::vector<HexObject>& tiles, const std::vector<int>& changed);
 		static MapNodePtr create(std::weak_ptr<KRE::SceneGraph> sg, const variant& node);
+		// Whether layers only draw the parts of the map in view, which is the default. Takes effect
+		// on the next update().
+		void setCulling(bool en) { culling_ = en; }
+		// The area of tiles, with a tile to spare on each side, drawn within the given pixel area.
+		static rect getTileArea(const rect& pixel_area);
 	private:
 		void notifyNodeAttached(std::weak_ptr<SceneNode> parent) override;
-		
+
+		// Layers are keyed on the image layer and texture id.
+		typedef std::pair<int, int> layer_key;
+		// First vertex and number of vertices on a layer for each hex drawn on it, by index of the hex in the map.
+		typedef std::map<int, std::pair<int, int>> hex_vertices_type;
+		struct LayerInfo
+		{
+			LayerInfo() : layer(), hex_vertices(), attached(false) {}
+			MapLayerPtr layer;
+			hex_vertices_type hex_vertices;
+			bool attached;
+		};
+		typedef std::map<layer_key, std::vector<KRE::vertex_texcoord>> layer_coords_type;
+		// Appends the geometry for the images on hex to coords, creating layers as needed, with the 
+		// vertices added for it recorded in hex_vertices. Returns false if an animated image needs a 
+		// layer that's already attached as a static one.
+		bool addHexImages(const HexObject& hex, int index, layer_coords_type* coords, std::map<layer_key, hex_vertices_type>* hex_vertices);
+		void attachLayers();
+		// Splits the geometry of a static layer, vtx, into buckets for culling.
+		void updateBuckets(const LayerInfo& info, const std::vector<KRE::vertex_texcoord>& vtx, const std::vector<HexObject>& tiles);
+
 		std::vector<MapLayerPtr> layers_;
+		std::map<layer_key, LayerInfo> layer_info_;
 		std::shared_ptr<RectRenderable> rr_;
+		int width_;
+		int height_;
 
 		bool changed_;
+		bool culling_;
 
 		MapNode() = delete;
 		MapNode(const MapNode&) = delete;
@@ -56,23 +91,66 @@ namespace hex
 	class MapLayer : public KRE::SceneObject
 	{
 	public:
+		// The vertices, as (first, count) ranges, for the hexes of one block of the map and the 
+		// area they're drawn over.
+		struct Bucket
+		{
+			Bucket() : area(), ranges() {}
+			rectf area;
+			std::vector<std::pair<int, int>> ranges;
+		};
+
 		MapLayer();
 		virtual ~MapLayer() {}
+		// Takes the images as quads of four vertices, see add_tex_coords(). Where the display
+		// device supports instancing each quad is stored as a single instance of a unit quad.
 		void updateAttributes(std::vector<KRE::vertex_texcoord>* attrs);
-		void clearAttributes() { attr_->clear(); }
+		// Overwrites attrs.size() vertices starting at offset.
+		void updateAttributes(const std::vector<KRE::vertex_texcoord>& attrs, int offset);
+		std::vector<KRE::vertex_texcoord> getAttributes() const;
+		void clearAttributes();
+		// Once set only the buckets in view of the camera are drawn, with no buckets the whole 
+		// layer is.
+		void setBuckets(std::vector<Bucket>* buckets);
+		void preRender(const KRE::WindowPtr& wnd) override;
+	protected:
+		// For derived layers which provide their own geometry.
+		explicit MapLayer(const std::string& name);
 	private:
+		// The area an image is drawn over and its texture co-ordinates, as normalised 16-bit
+		// values, onto which the corners of the unit quad are mapped.
+		struct QuadInstance
+		{
+			glm::vec4 area;
+			glm::u16vec4 uv;
+		};
+		static QuadInstance makeInstance(const KRE::vertex_texcoord* quad);
+
 		std::shared_ptr<KRE::Attribute<KRE::vertex_texcoord>> attr_;
+		// Unit quad and per image data when instancing, attr_ is unused then.
+		std::shared_ptr<KRE::Attribute<glm::vec2>> quad_;
+		std::shared_ptr<KRE::Attribute<QuadInstance>> instances_;
+		bool instanced_;
+		std::vector<Bucket> buckets_;
+		// The transform the buckets in view were last found for.
+		glm::mat4 cull_mvp_;
+		bool cull_valid_;
+		// Number of quads the index buffer covers.
+		int index_quads_;
 	};
 
+	// Every frame of every animation is uploaded once, with the frame to show chosen by the
+	// vertex shader from the tick count.
 	class AnimatedMapLayer : public MapLayer
 	{
 	public:
 		AnimatedMapLayer();
 		void preRender(const KRE::WindowPtr& wnd) override;
 		void addAnimationSeq(const std::vector<std::string>& frames, const point& hex_pos);
+		void removeAnimationSeq(const point& hex_pos) { frames_.erase(hex_pos); changed_ = true; }
 		void setAnimationTiming(int frame_time) { timing_ = frame_time; }
-		void setCrop(const rect& r) { crop_rect_ = r; }
-		void setBCO(const point& b, const point& c, const point& o) { base_ = b; center_ = c; offset_ = o; }
+		void setCrop(const rect& r) { crop_rect_ = r; changed_ = true; }
+		void setBCO(const point& b, const point& c, const point& o) { base_ = b; center_ = c; offset_ = o; changed_ = true; }
 	private:
 		struct AnimFrame
 		{
@@ -80,13 +158,27 @@ namespace hex
 			rect area;
 			std::vector<int> borders;
 		};
+		// A vertex of one frame, with the frame's index in its sequence and the sequence length.
+		struct AnimVertex
+		{
+			AnimVertex(const glm::vec2& v, const glm::vec2& t, const glm::vec2& f) : vtx(v), tc(t), frame(f) {}
+			glm::vec2 vtx;
+			glm::vec2 tc;
+			glm::vec2 frame;
+		};
+		// Rebuilds the geometry for all the frames and the mask which clips them.
+		void updateFrames();
+
 		std::map<point, std::vector<AnimFrame>> frames_;
 		rect crop_rect_;
 		int timing_;
-		int current_frame_pos_;
 		point base_;
 		point center_;
 		point offset_;
+		std::shared_ptr<KRE::Attribute<AnimVertex>> anim_attr_;
+		// The frame number to draw, for the shader.
+		float frame_;
+		bool changed_;
 		std::shared_ptr<KRE::Blittable> mask_;
 		rectf alpha_uv_;
 	};
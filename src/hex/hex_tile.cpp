@@ -22,6 +22,7 @@
 */
 
 #include "hex_tile.hpp"
+#include "rule_cache.hpp"
 
 namespace hex
 {
@@ -41,8 +42,45 @@ namespace hex
 	{
 	}
 
+	HexTile::HexTile(cache::Reader& r)
+		: id_(r.readString()),
+		name_(r.readString()),
+		str_(r.readString()),
+		editor_group_(r.readString()),
+		editor_name_(r.readString()),
+		symbol_image_(r.readString()),
+		icon_image_(r.readString()),
+		help_topic_text_(r.readString()),
+		hidden_(r.readBool()),
+		recruit_onto_(r.readBool()),
+		hide_help_(r.readBool()),
+		submerge_(r.readFloat())
+	{
+	}
+
+	void HexTile::writeCache(cache::Writer& w) const
+	{
+		w.writeString(id_);
+		w.writeString(name_);
+		w.writeString(str_);
+		w.writeString(editor_group_);
+		w.writeString(editor_name_);
+		w.writeString(symbol_image_);
+		w.writeString(icon_image_);
+		w.writeString(help_topic_text_);
+		w.writeBool(hidden_);
+		w.writeBool(recruit_onto_);
+		w.writeBool(hide_help_);
+		w.writeFloat(submerge_);
+	}
+
 	HexTilePtr HexTile::create(const std::string& str)
 	{
 		return std::make_shared<HexTile>(str);
 	}
+
+	HexTilePtr HexTile::create(cache::Reader& r)
+	{
+		return std::make_shared<HexTile>(r);
+	}
 }
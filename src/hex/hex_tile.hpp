@@ -33,6 +33,8 @@ namespace hex
 	{
 	public:
 		HexTile(const std::string& str);
+		explicit HexTile(cache::Reader& r);
+		void writeCache(cache::Writer& w) const;
 		const std::string& getId() const { return id_; }
 		const std::string& geName() const { return name_; }
 		const std::string& getString() const { return str_; }
@@ -59,6 +61,7 @@ namespace hex
 		void setSubmerge(float submerge) { submerge_ = submerge; }
 
 		static HexTilePtr create(const std::string& str);
+		static HexTilePtr create(cache::Reader& r);
 	private:
 		std::string id_;
 		std::string name_;
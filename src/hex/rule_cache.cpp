@@ -0,0 +1,365 @@
+/*
+	Copyright (C) 2013-2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <cstring>
+#include <fstream>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include "asserts.hpp"
+#include "filesystem.hpp"
+#include "rule_cache.hpp"
+#include "unit_test.hpp"
+
+namespace hex
+{
+	namespace cache
+	{
+		namespace 
+		{
+			// Also serves as a byte order check.
+			const uint32_t Magic = 0x43525848;	// "HXRC"
+
+			struct Header
+			{
+				uint32_t magic;
+				uint32_t version;
+				uint64_t source_hash;
+				uint32_t string_count;
+				uint32_t string_bytes;
+				uint32_t data_words;
+				uint32_t reserved;
+			};
+
+			size_t padded(size_t n)
+			{
+				return (n + 3) & ~size_t(3);
+			}
+		}
+
+		uint64_t hash_files(const std::vector<std::string>& filenames)
+		{
+			// FNV-1a
+			uint64_t hash = 14695981039346656037ULL;
+			auto add = [&hash](const char* p, size_t n) {
+				for(size_t i = 0; i != n; ++i) {
+					hash = (hash ^ static_cast<unsigned char>(p[i])) * 1099511628211ULL;
+				}
+			};
+			for(const auto& fname : filenames) {
+				const std::string contents = sys::read_file(fname);
+				const uint64_t size = contents.size();
+				add(reinterpret_cast<const char*>(&size), sizeof(size));
+				add(contents.data(), contents.size());
+			}
+			return hash;
+		}
+
+		Writer::Writer()
+			: data_(),
+			  strings_(),
+			  string_index_()
+		{
+		}
+
+		void Writer::writeFloat(float f)
+		{
+			int32_t n;
+			static_assert(sizeof(n) == sizeof(f), "float and int32_t are different sizes");
+			std::memcpy(&n, &f, sizeof(n));
+			data_.emplace_back(n);
+		}
+
+		void Writer::writeString(const std::string& str)
+		{
+			auto it = string_index_.find(str);
+			if(it == string_index_.end()) {
+				it = string_index_.emplace(str, static_cast<int>(strings_.size())).first;
+				strings_.emplace_back(str);
+			}
+			writeInt(it->second);
+		}
+
+		void Writer::writePoint(const point& p)
+		{
+			writeInt(p.x);
+			writeInt(p.y);
+		}
+
+		void Writer::writeRect(const rect& r)
+		{
+			writeInt(r.x());
+			writeInt(r.y());
+			writeInt(r.w());
+			writeInt(r.h());
+		}
+
+		void Writer::writeInts(const std::vector<int>& v)
+		{
+			writeInt(static_cast<int>(v.size()));
+			for(const int n : v) {
+				writeInt(n);
+			}
+		}
+
+		void Writer::writeStrings(const std::vector<std::string>& v)
+		{
+			writeInt(static_cast<int>(v.size()));
+			for(const auto& str : v) {
+				writeString(str);
+			}
+		}
+
+		std::string Writer::finish(uint64_t source_hash) const
+		{
+			Header header;
+			header.magic = Magic;
+			header.version = Version;
+			header.source_hash = source_hash;
+			header.string_count = static_cast<uint32_t>(strings_.size());
+			header.string_bytes = 0;
+			for(const auto& str : strings_) {
+				header.string_bytes += static_cast<uint32_t>(str.size());
+			}
+			header.data_words = static_cast<uint32_t>(data_.size());
+			header.reserved = 0;
+
+			std::string res(reinterpret_cast<const char*>(&header), sizeof(header));
+			for(const auto& str : strings_) {
+				const uint32_t len = static_cast<uint32_t>(str.size());
+				res.append(reinterpret_cast<const char*>(&len), sizeof(len));
+			}
+			for(const auto& str : strings_) {
+				res += str;
+			}
+			res.resize(padded(res.size()), '\0');
+			res.append(reinterpret_cast<const char*>(data_.data()), data_.size() * sizeof(int32_t));
+			return res;
+		}
+
+		Reader::Reader(const char* data, size_t size, uint64_t source_hash)
+			: strings_(),
+			  pos_(nullptr),
+			  end_(nullptr)
+		{
+			Header header;
+			if(size < sizeof(header)) {
+				throw load_error("file too short");
+			}
+			std::memcpy(&header, data, sizeof(header));
+			if(header.magic != Magic) {
+				throw load_error("not a cache file");
+			}
+			if(header.version != Version) {
+				throw load_error("written by a different version");
+			}
+			if(header.source_hash != source_hash) {
+				throw load_error("source files have changed");
+			}
+			const uint64_t lengths_size = uint64_t(header.string_count) * sizeof(uint32_t);
+			const uint64_t expected_size = padded(sizeof(header) + lengths_size + header.string_bytes) + uint64_t(header.data_words) * sizeof(int32_t);
+			if(expected_size != size) {
+				throw load_error("file size doesn't match header");
+			}
+
+			const char* lengths = data + sizeof(header);
+			const char* chars = lengths + lengths_size;
+			const char* chars_end = chars + header.string_bytes;
+			strings_.reserve(header.string_count);
+			for(uint32_t n = 0; n != header.string_count; ++n) {
+				uint32_t len;
+				std::memcpy(&len, lengths + n * sizeof(uint32_t), sizeof(len));
+				if(len > static_cast<size_t>(chars_end - chars)) {
+					throw load_error("string table overflow");
+				}
+				strings_.emplace_back(chars, len);
+				chars += len;
+			}
+			if(chars != chars_end) {
+				throw load_error("string table size mismatch");
+			}
+			pos_ = data + padded(sizeof(header) + lengths_size + header.string_bytes);
+			end_ = data + size;
+		}
+
+		int Reader::readInt()
+		{
+			if(end_ - pos_ < static_cast<std::ptrdiff_t>(sizeof(int32_t))) {
+				throw load_error("unexpected end of data");
+			}
+			int32_t n;
+			std::memcpy(&n, pos_, sizeof(n));
+			pos_ += sizeof(n);
+			return n;
+		}
+
+		float Reader::readFloat()
+		{
+			const int32_t n = readInt();
+			float f;
+			std::memcpy(&f, &n, sizeof(f));
+			return f;
+		}
+
+		const std::string& Reader::readString()
+		{
+			const int index = readInt();
+			if(index < 0 || index >= static_cast<int>(strings_.size())) {
+				throw load_error("invalid string index");
+			}
+			return strings_[index];
+		}
+
+		point Reader::readPoint()
+		{
+			const int x = readInt();
+			const int y = readInt();
+			return point(x, y);
+		}
+
+		rect Reader::readRect()
+		{
+			const int x = readInt();
+			const int y = readInt();
+			const int w = readInt();
+			const int h = readInt();
+			return rect(x, y, w, h);
+		}
+
+		int Reader::readCount()
+		{
+			const int count = readInt();
+			// Every item takes at least one word.
+			if(count < 0 || count > (end_ - pos_) / static_cast<std::ptrdiff_t>(sizeof(int32_t))) {
+				throw load_error("invalid count");
+			}
+			return count;
+		}
+
+		std::vector<int> Reader::readInts()
+		{
+			std::vector<int> res(readCount());
+			for(auto& n : res) {
+				n = readInt();
+			}
+			return res;
+		}
+
+		std::vector<std::string> Reader::readStrings()
+		{
+			const int count = readCount();
+			std::vector<std::string> res;
+			res.reserve(count);
+			for(int n = 0; n != count; ++n) {
+				res.emplace_back(readString());
+			}
+			return res;
+		}
+
+		bool read_file(const std::string& filename, uint64_t source_hash, const std::function<void(Reader&)>& fn)
+		{
+			if(!sys::file_exists(filename)) {
+				LOG_INFO("No terrain cache found at " << filename);
+				return false;
+			}
+			try {
+				using namespace boost::interprocess;
+				file_mapping file(filename.c_str(), read_only);
+				mapped_region region(file, read_only);
+				Reader reader(static_cast<const char*>(region.get_address()), region.get_size(), source_hash);
+				fn(reader);
+				if(!reader.atEnd()) {
+					throw load_error("unexpected data at end of file");
+				}
+			} catch(load_error& e) {
+				LOG_INFO("Not using terrain cache " << filename << ": " << e.what());
+				return false;
+			} catch(boost::interprocess::interprocess_exception& e) {
+				LOG_WARN("Unable to map terrain cache " << filename << ": " << e.what());
+				return false;
+			}
+			return true;
+		}
+
+		bool write_file(const std::string& filename, const std::string& contents)
+		{
+			std::ofstream file(filename, std::ios_base::binary | std::ios_base::trunc);
+			file.write(contents.data(), contents.size());
+			if(!file) {
+				LOG_WARN("Unable to write terrain cache " << filename);
+				return false;
+			}
+			return true;
+		}
+	}
+}
+
+UNIT_TEST(rule_cache_round_trip)
+{
+	hex::cache::Writer w;
+	w.writeInt(-5);
+	w.writeBool(true);
+	w.writeFloat(0.5f);
+	w.writeString("grass/green");
+	w.writePoint(point(3, -4));
+	w.writeRect(rect(1, 2, 3, 4));
+	w.writeStrings(std::vector<std::string>{ "grass/green", "water/ocean" });
+	w.writeInts(std::vector<int>{ 1, 2, 3 });
+	const std::string data = w.finish(1234);
+
+	hex::cache::Reader r(data.data(), data.size(), 1234);
+	CHECK_EQ(r.readInt(), -5);
+	CHECK_EQ(r.readBool(), true);
+	CHECK_EQ(r.readFloat(), 0.5f);
+	CHECK_EQ(r.readString(), "grass/green");
+	CHECK_EQ(r.readPoint(), point(3, -4));
+	const rect rr = r.readRect();
+	CHECK_EQ(rr.x() == 1 && rr.y() == 2 && rr.w() == 3 && rr.h() == 4, true);
+	CHECK_EQ(r.readStrings().size(), 2);
+	CHECK_EQ(r.readInts()[2], 3);
+	CHECK_EQ(r.atEnd(), true);
+
+	bool threw = false;
+	try {
+		r.readInt();
+	} catch(hex::cache::load_error&) {
+		threw = true;
+	}
+	CHECK_EQ(threw, true);
+
+	// Wrong source hash or a truncated file are rejected up front.
+	threw = false;
+	try {
+		hex::cache::Reader r2(data.data(), data.size(), 4321);
+	} catch(hex::cache::load_error&) {
+		threw = true;
+	}
+	CHECK_EQ(threw, true);
+	threw = false;
+	try {
+		hex::cache::Reader r3(data.data(), data.size() - 4, 1234);
+	} catch(hex::cache::load_error&) {
+		threw = true;
+	}
+	CHECK_EQ(threw, true);
+}
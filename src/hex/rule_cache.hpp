@@ -0,0 +1,107 @@
+/*
+	Copyright (C) 2013-2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "geometry.hpp"
+
+namespace hex
+{
+	// Binary cache of the terrain data loaded from the .cfg files, after rule elimination, so that
+	// start up doesn't have to parse and process the JSON every time. The file is made up of a 
+	// header, a table of all the strings used and then the data as a sequence of 32-bit words which 
+	// the reader checks the bounds of as it goes. It's only good for the exact source files it was
+	// built from and for the machine that wrote it.
+	namespace cache
+	{
+		class load_error : public std::runtime_error
+		{
+		public:
+			load_error(const std::string& error)
+				: std::runtime_error(error)
+			{}
+		};
+
+		// Needs bumping whenever anything changes in what gets written to the cache.
+		const uint32_t Version = 1;
+
+		// Hash of the contents of the given files, used to check a cache against its sources.
+		uint64_t hash_files(const std::vector<std::string>& filenames);
+
+		class Writer
+		{
+		public:
+			Writer();
+			void writeInt(int n) { data_.emplace_back(static_cast<int32_t>(n)); }
+			void writeBool(bool b) { writeInt(b ? 1 : 0); }
+			void writeFloat(float f);
+			void writeString(const std::string& str);
+			void writePoint(const point& p);
+			void writeRect(const rect& r);
+			void writeInts(const std::vector<int>& v);
+			void writeStrings(const std::vector<std::string>& v);
+			// Returns the complete contents of the cache file.
+			std::string finish(uint64_t source_hash) const;
+		private:
+			std::vector<int32_t> data_;
+			std::vector<std::string> strings_;
+			std::unordered_map<std::string, int> string_index_;
+		};
+
+		class Reader
+		{
+		public:
+			// Checks the header and reads the string table, throwing load_error if data isn't a cache 
+			// written from sources with the given hash. data must stay valid while reading.
+			Reader(const char* data, size_t size, uint64_t source_hash);
+			int readInt();
+			bool readBool() { return readInt() != 0; }
+			float readFloat();
+			const std::string& readString();
+			point readPoint();
+			rect readRect();
+			std::vector<int> readInts();
+			std::vector<std::string> readStrings();
+			// A count of items to follow, checked against the amount of data left.
+			int readCount();
+			bool atEnd() const { return pos_ == end_; }
+		private:
+			std::vector<std::string> strings_;
+			const char* pos_;
+			const char* end_;
+		};
+
+		// Maps the cache file into memory and calls fn with a reader for it. Returns false, after
+		// logging the reason, if the file doesn't exist or isn't a valid cache for the sources.
+		bool read_file(const std::string& filename, uint64_t source_hash, const std::function<void(Reader&)>& fn);
+		// Returns false, after logging the reason, if the file couldn't be written.
+		bool write_file(const std::string& filename, const std::string& contents);
+	}
+}
@@ -0,0 +1,135 @@
+/*
+	Copyright (C) 2013-2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <deque>
+#include <unordered_map>
+#include <vector>
+
+#include "asserts.hpp"
+#include "string_intern.hpp"
+#include "unit_test.hpp"
+
+namespace hex
+{
+	namespace 
+	{
+		// n.b. A deque so that references to the strings stay valid as more are added.
+		typedef std::deque<std::string> string_list_type;
+		string_list_type& get_strings()
+		{
+			static string_list_type res;
+			return res;
+		}
+
+		typedef std::unordered_map<std::string, string_id> string_id_map_type;
+		string_id_map_type& get_string_ids()
+		{
+			static string_id_map_type res;
+			return res;
+		}
+
+		// Indexed by string_id, -1 for strings which aren't flags.
+		std::vector<int>& get_flag_indexes()
+		{
+			static std::vector<int> res;
+			return res;
+		}
+
+		int& get_flag_count()
+		{
+			static int res = 0;
+			return res;
+		}
+	}
+
+	string_id intern_string(const std::string& str)
+	{
+		auto& ids = get_string_ids();
+		auto it = ids.find(str);
+		if(it != ids.end()) {
+			return it->second;
+		}
+		const string_id id = static_cast<string_id>(get_strings().size());
+		get_strings().emplace_back(str);
+		ids.emplace(str, id);
+		return id;
+	}
+
+	string_id find_interned_string(const std::string& str)
+	{
+		auto it = get_string_ids().find(str);
+		return it == get_string_ids().end() ? InvalidStringId : it->second;
+	}
+
+	const std::string& get_interned_string(string_id id)
+	{
+		ASSERT_LOG(id >= 0 && id < interned_string_count(), "Invalid interned string id: " << id);
+		return get_strings()[id];
+	}
+
+	int interned_string_count()
+	{
+		return static_cast<int>(get_strings().size());
+	}
+
+	int flag_index(string_id flag)
+	{
+		ASSERT_LOG(flag >= 0 && flag < interned_string_count(), "Invalid interned string id for flag: " << flag);
+		auto& indexes = get_flag_indexes();
+		if(flag >= static_cast<int>(indexes.size())) {
+			indexes.resize(interned_string_count(), -1);
+		}
+		if(indexes[flag] < 0) {
+			indexes[flag] = get_flag_count()++;
+		}
+		return indexes[flag];
+	}
+
+	int find_flag_index(string_id flag)
+	{
+		const auto& indexes = get_flag_indexes();
+		return flag >= 0 && flag < static_cast<int>(indexes.size()) ? indexes[flag] : -1;
+	}
+
+	int flag_count()
+	{
+		return get_flag_count();
+	}
+}
+
+UNIT_TEST(intern_string)
+{
+	const hex::string_id id = hex::intern_string("transition-n");
+	CHECK_EQ(hex::intern_string("transition-n"), id);
+	CHECK_NE(hex::intern_string("transition-ne"), id);
+	CHECK_EQ(hex::find_interned_string("transition-n"), id);
+	CHECK_EQ(hex::get_interned_string(id), "transition-n");
+	CHECK_EQ(hex::find_interned_string("xyzzy-never-interned"), hex::InvalidStringId);
+
+	const hex::string_id flag = hex::intern_string("xyzzy-flag");
+	CHECK_EQ(hex::find_flag_index(flag), -1);
+	const int index = hex::flag_index(flag);
+	CHECK_EQ(hex::flag_index(flag), index);
+	CHECK_EQ(hex::find_flag_index(flag), index);
+	CHECK_EQ(index, hex::flag_count() - 1);
+}
@@ -0,0 +1,47 @@
+/*
+	Copyright (C) 2013-2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <string>
+
+namespace hex
+{
+	// Terrain type and flag names get mapped to small dense integers when the data is loaded
+	// so that rule matching can compare and look them up without touching any strings.
+	typedef int string_id;
+	const string_id InvalidStringId = -1;
+
+	string_id intern_string(const std::string& str);
+	// Returns InvalidStringId if str has never been interned.
+	string_id find_interned_string(const std::string& str);
+	const std::string& get_interned_string(string_id id);
+	int interned_string_count();
+
+	// Flags that can be set on hexes are numbered separately, so that the flags of a hex fit in 
+	// a small bit set. Returns the number of flag, numbering it if it hasn't been already.
+	int flag_index(string_id flag);
+	// Returns -1 if flag has never been numbered, in which case no hex can have it set.
+	int find_flag_index(string_id flag);
+	int flag_count();
+}
@@ -0,0 +1,177 @@
+/*
+	Copyright (C) 2013-2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <map>
+#include <memory>
+
+#include "asserts.hpp"
+#include "hex_loader.hpp"
+#include "terrain_pattern.hpp"
+#include "unit_test.hpp"
+
+namespace hex
+{
+	bool string_match(const std::string& s1, const std::string& s2)
+	{
+		std::string::const_iterator s1it = s1.cbegin();
+		std::string::const_iterator s2it = s2.cbegin();
+		while(s1it != s1.cend() && s2it != s2.cend()) {
+			if(*s1it == '*') {
+				++s1it;
+				if(s1it == s1.cend()) {
+					// an asterisk at the end of the string matches all, so just return a match.
+					return true;
+				}
+				while(s2it != s2.cend() && *s2it != *s1it) {
+					++s2it;
+				}
+				if(s2it == s2.cend() && s1it != s1.cend()) {
+					return false;
+				}
+				++s1it;
+				++s2it;
+			} else {
+				if(*s1it++ != *s2it++) {
+					return false;
+				}
+			}
+		}
+		if(s1it != s1.cend() || s2it != s2.cend()) {
+			return false;
+		}
+		return true;
+	}
+
+	TerrainPattern::TerrainPattern(const std::string& pattern)
+		: kind_(Kind::GLOB),
+		  pattern_(pattern),
+		  prefix_(),
+		  find_('\0'),
+		  suffix_(),
+		  table_()
+	{
+		const auto star = pattern.find('*');
+		if(pattern == "*") {
+			kind_ = Kind::ANY;
+		} else if(pattern == "!") {
+			kind_ = Kind::INVERT;
+		} else if(star == std::string::npos) {
+			kind_ = Kind::EXACT;
+		} else if(pattern.find('*', star + 1) == std::string::npos) {
+			prefix_ = pattern.substr(0, star);
+			if(star + 1 == pattern.size()) {
+				kind_ = Kind::PREFIX;
+			} else {
+				kind_ = Kind::FIND_SUFFIX;
+				find_ = pattern[star + 1];
+				suffix_ = pattern.substr(star + 2);
+			}
+		}
+	}
+
+	bool TerrainPattern::match(const std::string& str) const
+	{
+		switch(kind_) {
+		case Kind::ANY:		return true;
+		case Kind::INVERT:
+		case Kind::EXACT:	return str == pattern_;
+		case Kind::PREFIX:
+			// n.b. string_match() needs at least one character for the '*' to match.
+			return str.size() > prefix_.size() && str.compare(0, prefix_.size(), prefix_) == 0;
+		case Kind::FIND_SUFFIX: {
+			if(str.size() <= prefix_.size() || str.compare(0, prefix_.size(), prefix_) != 0) {
+				return false;
+			}
+			const auto pos = str.find(find_, prefix_.size());
+			return pos != std::string::npos && str.compare(pos + 1, std::string::npos, suffix_) == 0;
+		}
+		case Kind::GLOB:	break;
+		}
+		return string_match(pattern_, str);
+	}
+
+	void TerrainPattern::buildTable(const std::vector<string_id>& codes)
+	{
+		for(auto code : codes) {
+			ASSERT_LOG(code >= 0, "Invalid terrain code id: " << code);
+			if(code >= static_cast<int>(table_.size())) {
+				table_.resize(code + 1, -1);
+			}
+			table_[code] = match(get_interned_string(code)) ? 1 : 0;
+		}
+	}
+
+	const TerrainPattern* TerrainPattern::get(const std::string& pattern)
+	{
+		static std::map<std::string, std::unique_ptr<TerrainPattern>> patterns;
+		auto it = patterns.find(pattern);
+		if(it == patterns.end()) {
+			std::unique_ptr<TerrainPattern> tp(new TerrainPattern(pattern));
+			tp->buildTable(get_tile_type_ids());
+			it = patterns.emplace(pattern, std::move(tp)).first;
+		}
+		return it->second.get();
+	}
+}
+
+UNIT_TEST(string_match)
+{
+	CHECK_EQ(hex::string_match("*", "Any string"), true);
+	CHECK_EQ(hex::string_match("Chs", "Ch"), false);
+	CHECK_EQ(hex::string_match("G*", "Gg"), true);
+	CHECK_EQ(hex::string_match("G*^Fp", "Gg^Fp"), true);
+	CHECK_EQ(hex::string_match("Re", "Rd"), false);
+	CHECK_EQ(hex::string_match("*^Bsb|", "Gg^Bsb|"), true);
+	CHECK_EQ(hex::string_match("*^Bsb|", "Gg^Fp"), false);
+	//CHECK_EQ(hex::string_match("Aa", "Aa^Fpa"), true);
+}
+
+UNIT_TEST(terrain_pattern)
+{
+	using hex::TerrainPattern;
+	CHECK_EQ(TerrainPattern("*").getKind() == TerrainPattern::Kind::ANY, true);
+	CHECK_EQ(TerrainPattern("!").getKind() == TerrainPattern::Kind::INVERT, true);
+	CHECK_EQ(TerrainPattern("Gg").getKind() == TerrainPattern::Kind::EXACT, true);
+	CHECK_EQ(TerrainPattern("G*").getKind() == TerrainPattern::Kind::PREFIX, true);
+	CHECK_EQ(TerrainPattern("*^Fp").getKind() == TerrainPattern::Kind::FIND_SUFFIX, true);
+	CHECK_EQ(TerrainPattern("*^Bw|*").getKind() == TerrainPattern::Kind::GLOB, true);
+
+	// The compiled patterns must agree with string_match() everywhere, including its quirks.
+	const std::vector<std::string> patterns{ "Chs", "Re", "G*", "Gg*", "G*^Fp", "*^Bsb|", "*^Bw|*", "Q*^Bh|", "*^V*", "*^" };
+	const std::vector<std::string> codes{ "", "G", "Gg", "Gg^Fp", "Gs^Fp", "Gg^Bsb|", "Ch", "Chs", "Re", "Rd", 
+		"Qxu^Bh|", "Q^Bh|", "Ww^Bw|", "Ww^Bw|x", "Gg^Vh", "Gg^V", "Gg^", "Gg^X^Fp" };
+	for(const auto& p : patterns) {
+		TerrainPattern tp(p);
+		for(const auto& c : codes) {
+			CHECK_EQ(tp.match(c), hex::string_match(p, c));
+		}
+	}
+
+	// Table look-ups give the same answers as matching the string.
+	TerrainPattern tp("G*^Fp");
+	const hex::string_id yes = hex::intern_string("Gg^Fp"), no = hex::intern_string("Gg^Fpa");
+	tp.buildTable(std::vector<hex::string_id>{ yes, no });
+	CHECK_EQ(tp.match(yes), true);
+	CHECK_EQ(tp.match(no), false);
+	CHECK_EQ(tp.match(hex::intern_string("Gs^Fp")), true);
+}
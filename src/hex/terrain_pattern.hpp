@@ -0,0 +1,88 @@
+/*
+	Copyright (C) 2013-2016 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "string_intern.hpp"
+
+namespace hex
+{
+	// Matches terrain type patterns such as "Gg", "G*", "*^Fp" or "!" against a terrain code.
+	// '*' skips up to the first occurrence of the character following it, or matches the rest of the
+	// string if it is the last character of the pattern.
+	bool string_match(const std::string& pattern, const std::string& str);
+
+	// A terrain type pattern from a tile rule compiled when the rules are loaded. The common forms are
+	// matched without walking the pattern and the results for all the terrain codes known at load 
+	// time are kept in a table indexed by the interned code, so matching a hex is normally a lookup.
+	// Results are the same as string_match(), except that "*" also matches an empty string.
+	class TerrainPattern
+	{
+	public:
+		enum class Kind {
+			// "*", matches anything.
+			ANY,
+			// "!", not a pattern but inverts the sense of the patterns that follow it.
+			INVERT,
+			// No wildcards, e.g. "Gg".
+			EXACT,
+			// Single trailing wildcard, e.g. "G*".
+			PREFIX,
+			// Single wildcard followed by more of the pattern, e.g. "*^Fp", "Q*^Bh|".
+			FIND_SUFFIX,
+			// Anything else, falls back to string_match().
+			GLOB,
+		};
+
+		explicit TerrainPattern(const std::string& pattern);
+		Kind getKind() const { return kind_; }
+		const std::string& toString() const { return pattern_; }
+
+		bool match(const std::string& str) const;
+		bool match(string_id str) const {
+			if(str >= 0 && str < static_cast<int>(table_.size()) && table_[str] >= 0) {
+				return table_[str] != 0;
+			}
+			return match(get_interned_string(str));
+		}
+		// Pre-computes the result for each of the given codes.
+		void buildTable(const std::vector<string_id>& codes);
+
+		// Returns the compiled form of pattern, shared between all the rules using it and with its
+		// table built for the codes from terrain.cfg. Not thread-safe, intended for use while loading.
+		static const TerrainPattern* get(const std::string& pattern);
+	private:
+		Kind kind_;
+		std::string pattern_;
+		// PREFIX and FIND_SUFFIX: the part of the pattern before the '*'.
+		std::string prefix_;
+		// FIND_SUFFIX: the character the '*' searches for and the rest of the pattern after it.
+		char find_;
+		std::string suffix_;
+		// Indexed by interned code: 1 matches, 0 doesn't, -1 not computed.
+		std::vector<signed char> table_;
+	};
+}
@@ -21,21 +21,52 @@
 	   distribution.
 */
 
+#include <algorithm>
 #include <iomanip>
+#include <numeric>
 #include <boost/algorithm/string.hpp>
 
 #include "hex_helper.hpp"
 #include "hex_loader.hpp"
 #include "hex_map.hpp"
+#include "rule_cache.hpp"
+#include "terrain_pattern.hpp"
 #include "tile_rules.hpp"
 
-#include "random.hpp"
+#include "JobSystem.hpp"
+
 #include "unit_test.hpp"
 
 namespace 
 {
 	const int HexTileSize = 72;	// XXX abstract this elsewhere.
 
+	uint32_t mix_bits(uint32_t h)
+	{
+		h ^= h >> 16;
+		h *= 0x85ebca6bU;
+		h ^= h >> 13;
+		h *= 0xc2b2ae35U;
+		h ^= h >> 16;
+		return h;
+	}
+
+	// Random number for a choice made by a rule where it matches. It only depends on the rule, 
+	// the hex, the rotation and which choice it is, so a hex gets the same images whether the 
+	// whole map or just the part around it is built, and building doesn't use up the global 
+	// random number generator.
+	unsigned hex_random(int rule, const point& p, int rot, int choice)
+	{
+		uint32_t h = mix_bits(static_cast<uint32_t>(rule) + 0x9e3779b9U);
+		h = mix_bits(h ^ static_cast<uint32_t>(p.x));
+		h = mix_bits(h ^ static_cast<uint32_t>(p.y));
+		return mix_bits(h ^ (static_cast<uint32_t>(rot) << 16 | static_cast<uint32_t>(choice)));
+	}
+
+	// hex_random() choices other than the rule's images, which use their index.
+	const int probability_choice = 0xfffe;
+	const int tile_image_choice = 0xffff;
+
 	std::string rot_replace(const std::string& str, const std::vector<std::string>& rotations, int rot)
 	{
 		//if(rot == 0) {
@@ -62,6 +93,19 @@ namespace
 		return res;
 	}
 
+	// Flag numbers of the flags with any @R references substituted for the given rotation. The 
+	// flags are numbered as the rules are loaded, so maps can size their flag bit sets up front.
+	std::vector<int> rotate_flags(const std::vector<std::string>& flags, const std::vector<std::string>& rotations, int rot)
+	{
+		std::vector<int> res;
+		res.reserve(flags.size());
+		for(const auto& f : flags) {
+			ASSERT_LOG(!rotations.empty() || f.find("@R") == std::string::npos, "Flag uses @R in a rule with no rotations: " << f);
+			res.emplace_back(hex::flag_index(hex::intern_string(rot_replace(f, rotations, rot))));
+		}
+		return res;
+	}
+
 	// n*60 is the degrees of rotation
 	// c is the center point
 	// p is the co-ordinate to rotate.
@@ -95,37 +139,6 @@ namespace
 		return res;
 	}
 
-	bool string_match(const std::string& s1, const std::string& s2)
-	{
-		std::string::const_iterator s1it = s1.cbegin();
-		std::string::const_iterator s2it = s2.cbegin();
-		while(s1it != s1.cend() && s2it != s2.cend()) {
-			if(*s1it == '*') {
-				++s1it;
-				if(s1it == s1.cend()) {
-					// an asterisk at the end of the string matches all, so just return a match.
-					return true;
-				}
-				while(s2it != s2.cend() && *s2it != *s1it) {
-					++s2it;
-				}
-				if(s2it == s2.cend() && s1it != s1.cend()) {
-					return false;
-				}
-				++s1it;
-				++s2it;
-			} else {
-				if(*s1it++ != *s2it++) {
-					return false;
-				}
-			}
-		}
-		if(s1it != s1.cend() || s2it != s2.cend()) {
-			return false;
-		}
-		return true;
-	}
-
 	point add_hex_coord(const point& p1, const point& p2) 
 	{
 		int x_p1, y_p1, z_p1;
@@ -182,7 +195,12 @@ namespace hex
 		  tile_data_(),
 		  image_(),
 		  pos_offset_(),
-		  probability_(v["probability"].as_int32(100))
+		  probability_(v["probability"].as_int32(100)),
+		  anchor_(nullptr),
+		  self_dependent_(false),
+		  footprint_size_(0),
+		  reach_(),
+		  index_(0)
 	{
 		if(v.has_key("x")) {
 			absolute_position_ = std::unique_ptr<point>(new point(v["x"].as_int32()));
@@ -390,6 +408,72 @@ namespace hex
 		}
 	}
 
+	void TerrainRule::buildMatchData()
+	{
+		for(auto& td : tile_data_) {
+			td->buildVariants(*this);
+		}
+
+		// The tile at the center is the same hex for every rotation, so if its types can't match a hex 
+		// there is no point in trying the rule there at all.
+		for(auto& td : tile_data_) {
+			const auto& positions = td->getPosition();
+			if(std::find(positions.cbegin(), positions.cend(), center_) == positions.cend()) {
+				continue;
+			}
+			// The index built on the anchor assumes its types are the same for every rotation.
+			const auto& types = td->getTypes();
+			const bool rotated_types = std::find_if(types.cbegin(), types.cend(), [](const std::string& t) { 
+				return t.find("@R") != std::string::npos; 
+			}) != types.cend();
+			if(!rotated_types && std::find_if(types.cbegin(), types.cend(), [](const std::string& t) { return t != "*"; }) != types.cend()) {
+				anchor_ = td.get();
+			}
+			break;
+		}
+
+		std::vector<CubeOffset> offsets;
+		for(auto& td : tile_data_) {
+			offsets.insert(offsets.end(), td->getOffsets(0).cbegin(), td->getOffsets(0).cend());
+		}
+		for(const auto& o1 : offsets) {
+			for(const auto& o2 : offsets) {
+				footprint_size_ = std::max(footprint_size_, hex::distance(o1.x, o1.y, o1.z, o2.x, o2.y, o2.z));
+			}
+		}
+
+		reach_.assign(1, CubeOffset(0, 0, 0));
+		for(auto& td : tile_data_) {
+			for(int rot = 0; rot != td->getRotationCount(); ++rot) {
+				for(const auto& offs : td->getOffsets(rot)) {
+					if(std::find_if(reach_.cbegin(), reach_.cend(), [&offs](const CubeOffset& r) { 
+						return r.x == offs.x && r.y == offs.y && r.z == offs.z; 
+					}) == reach_.cend()) {
+						reach_.emplace_back(offs);
+					}
+				}
+			}
+		}
+
+		// Rules that look for a flag they set themselves can't be matched speculatively, see matchCandidates().
+		std::vector<int> set_flags;
+		for(auto& td : tile_data_) {
+			for(int rot = 0; rot != td->getRotationCount(); ++rot) {
+				set_flags.insert(set_flags.end(), td->getSetFlags(rot).cbegin(), td->getSetFlags(rot).cend());
+			}
+		}
+		std::sort(set_flags.begin(), set_flags.end());
+		for(auto& td : tile_data_) {
+			for(int rot = 0; rot != td->getRotationCount(); ++rot) {
+				for(auto f : td->getHasFlags(rot)) {
+					if(std::binary_search(set_flags.cbegin(), set_flags.cend(), f)) {
+						self_dependent_ = true;
+					}
+				}
+			}
+		}
+	}
+
 	point TerrainRule::calcOffsetForRotation(int rot)
 	{
 		if(image_.empty()) {
@@ -429,9 +513,9 @@ namespace hex
 	void TerrainRule::applyImage(HexObject* hex, int rot)
 	{
 		point offs = calcOffsetForRotation(rot);
-		for(const auto& img : image_) {
-			if(img) {
-				hex->addImage(img->genHolder(rot, offs));
+		for(int n = 0; n != static_cast<int>(image_.size()); ++n) {
+			if(image_[n]) {
+				hex->addImage(image_[n]->genHolder(rot, offs, hex_random(index_, hex->getPosition(), rot, n)));
 			}
 		}
 	}
@@ -440,9 +524,94 @@ namespace hex
 	{
 		auto tr = std::make_shared<TerrainRule>(v);
 		tr->preProcessMap(v["tile"]);
+		tr->buildMatchData();
 		return tr;
 	}
 
+	TerrainRule::TerrainRule(cache::Reader& r)
+		: absolute_position_(),
+		  mod_position_(),
+		  rotations_(),
+		  set_flag_(),
+		  no_flag_(),
+		  has_flag_(),
+		  map_(),
+		  center_(),
+		  tile_data_(),
+		  image_(),
+		  pos_offset_(),
+		  probability_(100),
+		  anchor_(nullptr),
+		  self_dependent_(false),
+		  footprint_size_(0),
+		  reach_(),
+		  index_(0)
+	{
+		if(r.readBool()) {
+			absolute_position_.reset(new point(r.readPoint()));
+		}
+		if(r.readBool()) {
+			mod_position_.reset(new point(r.readPoint()));
+		}
+		rotations_ = r.readStrings();
+		set_flag_ = r.readStrings();
+		no_flag_ = r.readStrings();
+		has_flag_ = r.readStrings();
+		map_ = r.readStrings();
+		center_ = r.readPoint();
+		probability_ = r.readInt();
+		const int image_count = r.readCount();
+		for(int n = 0; n != image_count; ++n) {
+			image_.emplace_back(new TileImage(r));
+		}
+		const int offset_count = r.readCount();
+		for(int n = 0; n != offset_count; ++n) {
+			pos_offset_.emplace_back(r.readPoint());
+		}
+	}
+
+	TerrainRulePtr TerrainRule::create(cache::Reader& r)
+	{
+		auto tr = std::make_shared<TerrainRule>(r);
+		const int tile_count = r.readCount();
+		for(int n = 0; n != tile_count; ++n) {
+			tr->tile_data_.emplace_back(new TileRule(tr, r));
+		}
+		tr->buildMatchData();
+		return tr;
+	}
+
+	void TerrainRule::writeCache(cache::Writer& w) const
+	{
+		w.writeBool(absolute_position_ != nullptr);
+		if(absolute_position_) {
+			w.writePoint(*absolute_position_);
+		}
+		w.writeBool(mod_position_ != nullptr);
+		if(mod_position_) {
+			w.writePoint(*mod_position_);
+		}
+		w.writeStrings(rotations_);
+		w.writeStrings(set_flag_);
+		w.writeStrings(no_flag_);
+		w.writeStrings(has_flag_);
+		w.writeStrings(map_);
+		w.writePoint(center_);
+		w.writeInt(probability_);
+		w.writeInt(static_cast<int>(image_.size()));
+		for(const auto& img : image_) {
+			img->writeCache(w);
+		}
+		w.writeInt(static_cast<int>(pos_offset_.size()));
+		for(const auto& p : pos_offset_) {
+			w.writePoint(p);
+		}
+		w.writeInt(static_cast<int>(tile_data_.size()));
+		for(const auto& td : tile_data_) {
+			td->writeCache(w);
+		}
+	}
+
 	TileRule::TileRule(TerrainRulePtr parent, const variant& v)
 		: parent_(parent),
 		  position_(),
@@ -452,8 +621,7 @@ namespace hex
 		  no_flag_(),
 		  has_flag_(),
 		  image_(nullptr),
-		  pos_rotations_(),
-		  min_pos_()
+		  variants_()
 	{
 		if(v.has_key("x") || v.has_key("y")) {
 			position_.emplace_back(v["x"].as_int32(0), v["y"].as_int32(0));
@@ -496,12 +664,53 @@ namespace hex
 		  no_flag_(),
 		  has_flag_(),
 		  image_(nullptr),
-		  pos_rotations_(),
-		  min_pos_()
+		  variants_()
 	{
 		type_.emplace_back("*");
 	}
 
+	TileRule::TileRule(TerrainRulePtr parent, cache::Reader& r)
+		: parent_(parent),
+		  position_(),
+		  pos_(0),
+		  type_(),
+		  set_flag_(),
+		  no_flag_(),
+		  has_flag_(),
+		  image_(nullptr),
+		  variants_()
+	{
+		const int position_count = r.readCount();
+		for(int n = 0; n != position_count; ++n) {
+			position_.emplace_back(r.readPoint());
+		}
+		pos_ = r.readInt();
+		type_ = r.readStrings();
+		set_flag_ = r.readStrings();
+		no_flag_ = r.readStrings();
+		has_flag_ = r.readStrings();
+		if(r.readBool()) {
+			image_.reset(new TileImage(r));
+		}
+	}
+
+	void TileRule::writeCache(cache::Writer& w) const
+	{
+		w.writeInt(static_cast<int>(position_.size()));
+		for(const auto& p : position_) {
+			w.writePoint(p);
+		}
+		w.writeInt(pos_);
+		w.writeStrings(type_);
+		w.writeStrings(set_flag_);
+		w.writeStrings(no_flag_);
+		w.writeStrings(has_flag_);
+		w.writeBool(image_ != nullptr);
+		if(image_) {
+			image_->writeCache(w);
+		}
+	}
+
 	void TileRule::center(const point& from_center, const point& to_center)
 	{
 		for(auto& p : position_) {
@@ -590,24 +799,52 @@ namespace hex
 		return ss.str();
 	}
 
-	bool TileRule::matchFlags(const HexObject* obj, TerrainRule* tr, const std::vector<std::string>& rs, int rot)
+	void TileRule::buildVariants(const TerrainRule& tr)
 	{
-		const auto& has_flag = has_flag_.empty() ? tr->getHasFlags() : has_flag_;
-		for(auto& f : has_flag) {
-			if(!obj->hasFlag(rot_replace(f, rs, rot))) {
+		const auto& rotations = tr.getRotations();
+		const auto& set_flag = set_flag_.empty() ? tr.getSetFlags() : set_flag_;
+		const auto& no_flag = no_flag_.empty() ? tr.getNoFlags() : no_flag_;
+		const auto& has_flag = has_flag_.empty() ? tr.getHasFlags() : has_flag_;
+
+		int x_c, y_c, z_c;
+		hex::evenq_to_cube_coords(tr.getCenter(), &x_c, &y_c, &z_c);
+
+		variants_.clear();
+		variants_.resize(rotations.empty() ? 1 : rotations.size());
+		for(int rot = 0; rot != static_cast<int>(variants_.size()); ++rot) {
+			auto& var = variants_[rot];
+			// Rotating p about (center + hex) is the same as rotating p about the center then adding the hex.
+			for(const auto& p : position_) {
+				int x, y, z;
+				hex::evenq_to_cube_coords(rotate_point(rot, tr.getCenter(), p), &x, &y, &z);
+				var.offsets.emplace_back(x, y, z);
+			}
+			for(const auto& type : type_) {
+				var.types.emplace_back(TerrainPattern::get(rotations.empty() ? type : rot_replace(type, rotations, rot)));
+			}
+			var.set_flags = rotate_flags(set_flag, rotations, rot);
+			var.no_flags = rotate_flags(no_flag, rotations, rot);
+			var.has_flags = rotate_flags(has_flag, rotations, rot);
+		}
+	}
+
+	bool TileRule::matchFlags(const HexObject* obj, int rot) const
+	{
+		const auto& var = variants_[rot];
+		for(auto f : var.has_flags) {
+			if(!obj->hasFlagIndex(f)) {
 				return false;
 			}
 		}
-		const auto& no_flag = no_flag_.empty() ? tr->getNoFlags() : no_flag_;
-		for(auto& f : no_flag) {
-			if(obj->hasFlag(rot_replace(f, rs, rot))) {
+		for(auto f : var.no_flags) {
+			if(obj->hasFlagIndex(f)) {
 				return false;
 			}
 		}
 		return true;
 	}
 
-	bool TileRule::match(const HexObject* obj, TerrainRule* tr, const std::vector<std::string>& rs, int rot)
+	bool TileRule::match(const HexObject* obj, int rot) const
 	{
 		if(obj == nullptr) {
 			/*for(auto& type : type_) {
@@ -618,17 +855,31 @@ namespace hex
 			return false;
 		}
 
-		const std::string& hex_type_full = obj->getFullTypeString();
-		const std::string& hex_type = obj->getTypeString();
+		const bool tile_match = matchType(obj->getFullTypeId(), obj->getTypeId(), rot);
+
+		if(tile_match) {
+			if(!matchFlags(obj, rot)) {
+				return false;
+			}
+
+			for(auto f : variants_[rot].set_flags) {
+				obj->addTempFlagIndex(f);
+			}
+		}
+
+		return tile_match;
+	}
+
+	bool TileRule::matchType(string_id hex_type_full, string_id hex_type, int rot) const
+	{
 		bool invert_match = false;
 		bool tile_match = true;
-		for(auto& type : type_) {
-			type = rot_replace(type, rs, rot);
-			if(type == "!") {
+		for(auto type : variants_[rot].types) {
+			if(type->getKind() == TerrainPattern::Kind::INVERT) {
 				invert_match = !invert_match;
 				continue;
 			}
-			const bool matches = type == "*" || string_match(type, hex_type_full) || string_match(type, hex_type);
+			const bool matches = type->match(hex_type_full) || type->match(hex_type);
 			if(!matches) {
 				if(invert_match == true) {
 					tile_match = true;
@@ -644,27 +895,13 @@ namespace hex
 				}
 			}
 		}
-
-		if(tile_match) {
-			if(!matchFlags(obj, tr, rs, rot)) {
-				return false;
-			}
-
-			const auto& set_flag = set_flag_.empty() ? tr->getSetFlags() : set_flag_;
-			for(auto& f : set_flag) {
-				if(obj != nullptr) {
-					obj->addTempFlag(rot_replace(f, rs, rot));
-				}
-			}
-		}
-
 		return tile_match;
 	}
 
-	void TileRule::applyImage(HexObject* hex, int rot)
+	void TileRule::applyImage(HexObject* hex, int rot, unsigned random)
 	{
 		if(image_) {
-			hex->addImage(image_->genHolder(rot, point()));
+			hex->addImage(image_->genHolder(rot, point(), random));
 		}
 	}
 
@@ -721,7 +958,61 @@ namespace hex
 		}
 	}
 
-	const std::string& TileImage::getNameForRotation(int rot)
+	TileImage::TileImage(cache::Reader& r)
+		: layer_(r.readInt()),
+		  image_name_(r.readString()),
+		  random_start_(r.readBool()),
+		  base_(r.readPoint()),
+		  center_(r.readPoint()),
+		  opacity_(r.readFloat()),
+		  crop_(r.readRect()),
+		  variants_(),
+		  variations_(),
+		  image_files_(),
+		  animation_frames_(),
+		  animation_timing_(0),
+		  is_animated_(false)
+	{
+		const int variant_count = r.readCount();
+		for(int n = 0; n != variant_count; ++n) {
+			variants_.emplace_back(r);
+		}
+		variations_ = r.readStrings();
+		const int rotation_count = r.readCount();
+		for(int n = 0; n != rotation_count; ++n) {
+			const int rot = r.readInt();
+			image_files_[rot] = r.readStrings();
+		}
+		animation_frames_ = r.readInts();
+		animation_timing_ = r.readInt();
+		is_animated_ = r.readBool();
+	}
+
+	void TileImage::writeCache(cache::Writer& w) const
+	{
+		w.writeInt(layer_);
+		w.writeString(image_name_);
+		w.writeBool(random_start_);
+		w.writePoint(base_);
+		w.writePoint(center_);
+		w.writeFloat(opacity_);
+		w.writeRect(crop_);
+		w.writeInt(static_cast<int>(variants_.size()));
+		for(const auto& var : variants_) {
+			var.writeCache(w);
+		}
+		w.writeStrings(variations_);
+		w.writeInt(static_cast<int>(image_files_.size()));
+		for(const auto& files : image_files_) {
+			w.writeInt(files.first);
+			w.writeStrings(files.second);
+		}
+		w.writeInts(animation_frames_);
+		w.writeInt(animation_timing_);
+		w.writeBool(is_animated_);
+	}
+
+	const std::string& TileImage::getNameForRotation(int rot, unsigned random)
 	{
 		auto it = image_files_.find(rot);
 		if(it == image_files_.end()) {
@@ -730,7 +1021,7 @@ namespace hex
 		}
 		ASSERT_LOG(it != image_files_.end(), "No image for rotation: " << rot << " : " << toString());
 		ASSERT_LOG(!it->second.empty(), "No files for rotation: " << rot);
-		return it->second[rng::generate() % it->second.size()];
+		return it->second[random % it->second.size()];
 	}
 
 	bool TileImage::isValidForRotation(int rot)
@@ -751,10 +1042,10 @@ namespace hex
 		return ss.str();
 	}
 
-	ImageHolder TileImage::genHolder(int rot, const point& offs)
+	ImageHolder TileImage::genHolder(int rot, const point& offs, unsigned random)
 	{
 		ImageHolder res;
-		res.name = getNameForRotation(rot);
+		res.name = getNameForRotation(rot, random);
 		res.base = getBase();
 		res.center = getCenter();
 		res.crop = getCropRect();
@@ -763,7 +1054,11 @@ namespace hex
 		res.offset = offs;
 		res.opacity = getOpacity();
 		if(is_animated_) {
-			res.animation_frames = image_files_[rot];
+			// n.b. Don't use operator[] here, it would add an empty entry making the rotation look valid.
+			auto it = image_files_.find(rot);
+			if(it != image_files_.end()) {
+				res.animation_frames = it->second;
+			}
 		}
 		res.animation_timing = animation_timing_;
 		return res;
@@ -859,111 +1154,242 @@ namespace hex
 		}
 	}
 
-	std::string TileImage::getName() const
+	TileImageVariant::TileImageVariant(cache::Reader& r)
+		: tod_(r.readString()),
+		  name_(r.readString()),
+		  random_start_(r.readBool()),
+		  has_flag_(r.readStrings()),
+		  crop_(r.readRect()),
+		  animation_frames_(r.readInts()),
+		  animation_timing_(r.readInt()),
+		  layer_(r.readInt())
+	{
+	}
+
+	void TileImageVariant::writeCache(cache::Writer& w) const
+	{
+		w.writeString(tod_);
+		w.writeString(name_);
+		w.writeBool(random_start_);
+		w.writeStrings(has_flag_);
+		w.writeRect(crop_);
+		w.writeInts(animation_frames_);
+		w.writeInt(animation_timing_);
+		w.writeInt(layer_);
+	}
+
+	std::string TileImage::getName(unsigned random) const
 	{
 		// XXX WIP
 		std::string name = image_name_;
 		auto pos = name.find("@V");
 		if(!variations_.empty() && pos != std::string::npos) {
-			int index = rng::generate() % variations_.size();
+			int index = random % variations_.size();
 			const std::string& var = variations_[index];
 			name = name.substr(0, pos) + var + name.substr(pos + 2);
 		}
 		return name;
 	}
 
-	bool TerrainRule::match(const HexMapPtr& hmap)
+	bool TerrainRule::match(const HexMapPtr& hmap, int threads)
+	{
+		if(absolute_position_) {
+			ASSERT_LOG(tile_data_.size() != 1, "Number of tiles is not correct in rule.");
+			if(!tile_data_[0]->match(hmap->getTileAt(*absolute_position_), 0)) {
+				return false;
+			}
+		}
+
+		auto& tiles = hmap->getTilesMutable();
+		if(threads > 1 && !self_dependent_) {
+			std::vector<int> candidates(tiles.size());
+			std::iota(candidates.begin(), candidates.end(), 0);
+			matchCandidates(hmap, candidates, threads);
+		} else {
+			for(auto& hex : tiles) {
+				matchAt(hmap, &hex);
+			}
+		}
+		return false;
+	}
+
+	bool TerrainRule::match(const HexMapPtr& hmap, const std::vector<int>& anchor_hexes, int threads)
 	{
 		if(absolute_position_) {
 			ASSERT_LOG(tile_data_.size() != 1, "Number of tiles is not correct in rule.");
-			if(!tile_data_[0]->match(hmap->getTileAt(*absolute_position_), this, std::vector<std::string>(), 0)) {
+			if(!tile_data_[0]->match(hmap->getTileAt(*absolute_position_), 0)) {
 				return false;
 			}
 		}
 
+		// The anchor tile for a hex is at hex + center_, so work backwards to the hexes to try.
+		// These need to be tried in map order, the same as the full scan does, since flags set
+		// by one match are visible to the next.
+		auto& tiles = hmap->getTilesMutable();
+		std::vector<int> candidates;
+		candidates.reserve(anchor_hexes.size());
+		for(const int index : anchor_hexes) {
+			const HexObject* hex = hmap->getTileAt(sub_hex_coord(tiles[index].getPosition(), center_));
+			if(hex != nullptr) {
+				candidates.emplace_back(static_cast<int>(hex - tiles.data()));
+			}
+		}
+		std::sort(candidates.begin(), candidates.end());
+		matchCandidates(hmap, candidates, threads);
+		return false;
+	}
+
+	void TerrainRule::matchCandidates(const HexMapPtr& hmap, const std::vector<int>& candidates, int threads)
+	{
+		// Below this it costs more to hand out the jobs than to just do the matching.
+		const int min_parallel_candidates = 1024;
+
+		auto& tiles = hmap->getTilesMutable();
+		const int count = static_cast<int>(candidates.size());
+		if(threads <= 1 || self_dependent_ || count < min_parallel_candidates) {
+			for(const int index : candidates) {
+				matchAt(hmap, &tiles[index]);
+			}
+			return;
+		}
+
+		// Work out which rotations could match at each candidate given the flags as they are before
+		// the rule is applied, split between the threads. Nothing is written to the map meanwhile.
+		std::vector<int> rotation_masks(count);
+		const int n_incr = (count + threads - 1) / threads;
+		KRE::JobSystem::getInstance().parallelFor(0, count, n_incr, [this, &hmap, &tiles, &candidates, &rotation_masks](int n, int n2) {
+			for(int ndx = n; ndx != n2; ++ndx) {
+				rotation_masks[ndx] = possibleRotations(hmap, tiles[candidates[ndx]]);
+			}
+		});
+
+		// Then match for real in map order, so flags and images come out exactly as they do for a
+		// serial scan. Flags are only added while the rule is applied and the rule 
+		// doesn't require any flag it sets, so a rotation that can't match now can't match later on.
+		for(int ndx = 0; ndx != count; ++ndx) {
+			if(rotation_masks[ndx] != 0) {
+				matchAt(hmap, &tiles[candidates[ndx]], rotation_masks[ndx]);
+			}
+		}
+	}
+
+	int TerrainRule::possibleRotations(const HexMapPtr& hmap, const HexObject& hex) const
+	{
+		const int max_loop = rotations_.empty() ? 1 : rotations_.size();
+
+		int x_h, y_h, z_h;
+		hex::evenq_to_cube_coords(hex.getPosition(), &x_h, &y_h, &z_h);
+
+		int mask = 0;
+		for(int rot = 0; rot != max_loop; ++rot) {
+			bool match_pos = true;
+			for(auto td_it = tile_data_.cbegin(); td_it != tile_data_.cend() && match_pos; ++td_it) {
+				const auto& td = *td_it;
+				for(const auto& offs : td->getOffsets(rot)) {
+					const HexObject* obj = hmap->getTileAt(hex::cube_to_evenq_coords(x_h + offs.x, y_h + offs.y, z_h + offs.z));
+					if(obj == nullptr || !td->matchType(obj->getFullTypeId(), obj->getTypeId(), rot) || !td->matchFlags(obj, rot)) {
+						match_pos = false;
+						break;
+					}
+				}
+			}
+			if(match_pos) {
+				mask |= 1 << rot;
+			}
+		}
+		return mask;
+	}
+
+	void TerrainRule::matchAt(const HexMapPtr& hmap, HexObject* hexp, int rotation_mask)
+	{
+		auto& hex = *hexp;
 		// check rotations.
 		ASSERT_LOG(rotations_.size() == 6 || rotations_.empty(), "Set of rotations not of size 6(" << rotations_.size() << ").");
 		const int max_loop = rotations_.empty() ? 1 : rotations_.size();
 
-		for(auto& hex : hmap->getTilesMutable()) {
-			for(int rot = 0; rot != max_loop; ++rot) {
-				if(mod_position_) {
-					auto& pos = hex.getPosition();
-					if((pos.x % mod_position_->x) != 0 || (pos.y % mod_position_->y) != 0) {
-						continue;
-					}
+		int x_h, y_h, z_h;
+		hex::evenq_to_cube_coords(hex.getPosition(), &x_h, &y_h, &z_h);
+
+		// Everything the match does is recorded against the rule and hex, see HexMap::setTile().
+		hmap->beginMatch(index_, hex.getPosition());
+		for(int rot = 0; rot != max_loop; ++rot) {
+			if((rotation_mask & (1 << rot)) == 0) {
+				continue;
+			}
+			if(mod_position_) {
+				auto& pos = hex.getPosition();
+				if((pos.x % mod_position_->x) != 0 || (pos.y % mod_position_->y) != 0) {
+					continue;
 				}
+			}
 
-				std::vector<std::pair<HexObject*, TileRule*>> obj_to_set_flags;
-				// We expect tiles to have position data.
-				bool tile_match = true;
+			std::vector<std::pair<HexObject*, TileRule*>> obj_to_set_flags;
+			// We expect tiles to have position data.
+			bool tile_match = true;
 
-				if(!image_.empty()) {
-					bool res = false;
-					for(const auto& img : image_) {
-						res |= img->isValidForRotation(rot);
-					}
-					if(!res) {
-						// XXX should we check for images in tile tags?
-						continue;
-					}
+			if(!image_.empty()) {
+				bool res = false;
+				for(const auto& img : image_) {
+					res |= img->isValidForRotation(rot);
 				}
+				if(!res) {
+					// XXX should we check for images in tile tags?
+					continue;
+				}
+			}
 
-				bool match_pos = true;
-				auto td_it = tile_data_.cbegin();
-				for(; td_it != tile_data_.cend() && match_pos; ++td_it) {
-					const auto& td = *td_it;
-					ASSERT_LOG(td->hasPosition(), "tile data doesn't have an x,y position.");
-					const auto& pos_data = td->getPosition();
-
-					for(const auto& p : pos_data) {
-						//point rot_p = sub_hex_coord(add_hex_coord(hex.getPosition(), rotate_point(rot, center_, p)), center_);
-						point rot_p = rotate_point(rot, add_hex_coord(center_, hex.getPosition()), add_hex_coord(p, hex.getPosition()));
-						auto new_obj = const_cast<HexObject*>(hmap->getTileAt(rot_p));
-						if(td->match(new_obj, this, rotations_, rot)) {
-							//match_pos = true;
-							if(new_obj) {
-								obj_to_set_flags.emplace_back(std::make_pair(new_obj, td.get()));
-							}
-						} else {
-							match_pos = false;
-							if(new_obj) {
-								new_obj->clearTempFlags();
-							}
-							break;
+			bool match_pos = true;
+			auto td_it = tile_data_.cbegin();
+			for(; td_it != tile_data_.cend() && match_pos; ++td_it) {
+				const auto& td = *td_it;
+				ASSERT_LOG(td->hasPosition(), "tile data doesn't have an x,y position.");
+
+				for(const auto& offs : td->getOffsets(rot)) {
+					point rot_p = hex::cube_to_evenq_coords(x_h + offs.x, y_h + offs.y, z_h + offs.z);
+					auto new_obj = const_cast<HexObject*>(hmap->getTileAt(rot_p));
+					if(td->match(new_obj, rot)) {
+						//match_pos = true;
+						if(new_obj) {
+							obj_to_set_flags.emplace_back(std::make_pair(new_obj, td.get()));
 						}
+					} else {
+						match_pos = false;
+						if(new_obj) {
+							new_obj->clearTempFlags();
+						}
+						break;
 					}
 				}
-				if(!match_pos) {
-					tile_match = false;
-					for(auto& obj : obj_to_set_flags) {
-						obj.first->clearTempFlags();
-					}
-					obj_to_set_flags.clear();
+			}
+			if(!match_pos) {
+				tile_match = false;
+				for(auto& obj : obj_to_set_flags) {
+					obj.first->clearTempFlags();
 				}
+				obj_to_set_flags.clear();
+			}
 
-				if(tile_match) {
-					if(probability_ != 100) {
-						auto rand_no = rng::generate() % 100;
-						if(rand_no > probability_) {
-							for(auto& obj : obj_to_set_flags) {
-								obj.first->clearTempFlags();
-							}
-							obj_to_set_flags.clear();
-							continue;
+			if(tile_match) {
+				if(probability_ != 100) {
+					auto rand_no = hex_random(index_, hex.getPosition(), rot, probability_choice) % 100;
+					if(rand_no > probability_) {
+						for(auto& obj : obj_to_set_flags) {
+							obj.first->clearTempFlags();
 						}
+						obj_to_set_flags.clear();
+						continue;
 					}
-					// XXX need to fix issues when other tiles have images that need to match a different hex
-					//tile_data_.front()->applyImage(&hex, rotations_, rot);
-					applyImage(&hex, rot);
-					for(auto& obj : obj_to_set_flags) {
-						obj.first->setTempFlags();
-						obj.second->applyImage(obj.first, rot);
-					}
+				}
+				// XXX need to fix issues when other tiles have images that need to match a different hex
+				//tile_data_.front()->applyImage(&hex, rotations_, rot);
+				applyImage(&hex, rot);
+				for(auto& obj : obj_to_set_flags) {
+					obj.first->setTempFlags();
+					obj.second->applyImage(obj.first, rot, hex_random(index_, obj.first->getPosition(), rot, tile_image_choice));
 				}
 			}
 		}
-		return false;
+		hmap->endMatch();
 	}
 }
 
@@ -978,18 +1404,6 @@ UNIT_TEST(point_rotate)
 	CHECK_EQ(rotate_point(1, point(3, 3), point(3, 2)), point(4, 2));
 }
 
-UNIT_TEST(string_match)
-{
-	CHECK_EQ(string_match("*", "Any string"), true);
-	CHECK_EQ(string_match("Chs", "Ch"), false);
-	CHECK_EQ(string_match("G*", "Gg"), true);
-	CHECK_EQ(string_match("G*^Fp", "Gg^Fp"), true);
-	CHECK_EQ(string_match("Re", "Rd"), false);
-	CHECK_EQ(string_match("*^Bsb|", "Gg^Bsb|"), true);
-	CHECK_EQ(string_match("*^Bsb|", "Gg^Fp"), false);
-	//CHECK_EQ(string_match("Aa", "Aa^Fpa"), true);
-}
-
 UNIT_TEST(rot_replace)
 {
 	CHECK_EQ(rot_replace("transition-@R0-@R1-x", std::vector<std::string>{"n", "ne", "se", "s", "sw", "nw"}, 1), "transition-ne-se-x");
@@ -29,6 +29,8 @@
 #include "variant.hpp"
 
 #include "hex_fwd.hpp"
+#include "string_intern.hpp"
+#include "terrain_pattern.hpp"
 
 namespace hex
 {
@@ -36,6 +38,8 @@ namespace hex
 	{
 	public:
 		TileImageVariant(const variant& v);
+		explicit TileImageVariant(cache::Reader& r);
+		void writeCache(cache::Writer& w) const;
 	private:
 		std::string tod_;
 		std::string name_;
@@ -51,7 +55,9 @@ namespace hex
 	{
 	public:
 		explicit TileImage(const variant& v);
-		std::string getName() const;
+		explicit TileImage(cache::Reader& r);
+		void writeCache(cache::Writer& w) const;
+		std::string getName(unsigned random) const;
 		int getLayer() const { return layer_; }
 		const point& getBase() const { return base_; }
 		const point& getCenter() const { return center_; }
@@ -59,9 +65,10 @@ namespace hex
 		const rect& getCropRect() const { return crop_; }
 		bool eliminate(const std::vector<std::string>& rotations);
 		std::string toString() const;
-		const std::string& getNameForRotation(int rot);
+		// random picks between the files for the rotation.
+		const std::string& getNameForRotation(int rot, unsigned random);
 		bool isValidForRotation(int rot);
-		ImageHolder genHolder(int rot, const point& offs);
+		ImageHolder genHolder(int rot, const point& offs, unsigned random);
 	private:
 		int layer_;
 		std::string image_name_;
@@ -80,24 +87,43 @@ namespace hex
 		bool is_animated_;
 	};
 
+	// Offset from the hex being matched, in cube co-ordinates.
+	struct CubeOffset
+	{
+		CubeOffset(int xx, int yy, int zz) : x(xx), y(yy), z(zz) {}
+		int x;
+		int y;
+		int z;
+	};
+
 	class TileRule
 	{
 	public:
 		explicit TileRule(TerrainRulePtr parent, const variant& v);
 		explicit TileRule(TerrainRulePtr parent);
+		explicit TileRule(TerrainRulePtr parent, cache::Reader& r);
+		void writeCache(cache::Writer& w) const;
 		bool hasPosition() const { return !position_.empty(); }
 		const std::vector<point>& getPosition() const { return position_; }
 		void addPosition(const point& p) { position_.emplace_back(p); }
 		int getMapPos() const { return pos_; }
-		bool match(const HexObject* obj, TerrainRule* tr, const std::vector<std::string>& rotations, int rot);
+		bool match(const HexObject* obj, int rot) const;
+		bool matchType(string_id full_type, string_id type, int rot=0) const;
+		const std::vector<std::string>& getTypes() const { return type_; }
 		std::string toString();
-		void applyImage(HexObject* hex, int rot);
-		bool matchFlags(const HexObject* hex, TerrainRule* tr, const std::vector<std::string>& rs=std::vector<std::string>(), int rot=0);
+		void applyImage(HexObject* hex, int rot, unsigned random);
+		bool matchFlags(const HexObject* hex, int rot=0) const;
+		// Builds the data used for matching against each rotation of the rule, see RotationVariant.
+		void buildVariants(const TerrainRule& tr);
+		// Offsets, from the hex being matched, of the hexes this tile applies to for a given rotation.
+		const std::vector<CubeOffset>& getOffsets(int rot) const { return variants_[rot].offsets; }
+		// The flag_index() numbers of the flags for a given rotation.
+		const std::vector<int>& getSetFlags(int rot) const { return variants_[rot].set_flags; }
+		const std::vector<int>& getHasFlags(int rot) const { return variants_[rot].has_flags; }
+		int getRotationCount() const { return static_cast<int>(variants_.size()); }
 		void center(const point& from_center, const point& to_center);
 		bool eliminate(const std::vector<std::string>& rotations);
 		bool hasImage() const { return image_ != nullptr; }
-		const std::vector<point>& getPositionRotations(int rot) const { return pos_rotations_[rot]; }
-		const point& getMinPos() const { return min_pos_; }
 	private:
 		std::weak_ptr<TerrainRule> parent_;
 		std::vector<point> position_;
@@ -107,8 +133,18 @@ namespace hex
 		std::vector<std::string> no_flag_;
 		std::vector<std::string> has_flag_;
 		std::unique_ptr<TileImage> image_;
-		std::vector<std::vector<point>> pos_rotations_;
-		point min_pos_;
+		// Everything needed to match a particular rotation with any @R references substituted, 
+		// positions already rotated and flags falling back to the rule if the tile has none.
+		// These don't change once built.
+		struct RotationVariant
+		{
+			std::vector<CubeOffset> offsets;
+			std::vector<const TerrainPattern*> types;
+			std::vector<int> set_flags;
+			std::vector<int> no_flags;
+			std::vector<int> has_flags;
+		};
+		std::vector<RotationVariant> variants_;
 	};
 
 	typedef std::unique_ptr<TileRule> TileRulePtr;
@@ -117,23 +153,55 @@ namespace hex
 	{
 	public:
 		explicit TerrainRule(const variant& v);
+		// Reads everything except the tiles, use create() instead.
+		explicit TerrainRule(cache::Reader& r);
 		const std::vector<std::string>& getSetFlags() const { return set_flag_; }
 		const std::vector<std::string>& getNoFlags() const { return no_flag_; }
 		const std::vector<std::string>& getHasFlags() const { return has_flag_; }
 		const std::vector<std::string>& getRotations() const { return rotations_; }
 		const std::vector<std::string>& getMap() const { return map_; }
+		const point& getCenter() const { return center_; }
 		const std::vector<std::unique_ptr<TileImage>>& getImages() const { return image_; }
 
-		bool match(const HexMapPtr& hmap);
+		// If threads is more than one the search for matches is split into that many jobs on the
+		// shared job system, with the same results as a single thread.
+		bool match(const HexMapPtr& hmap, int threads=1);
+		// As match() but only tries the hexes whose index in the map is listed in anchor_hexes,
+		// i.e. hexes whose type is known to be matched by getAnchor().
+		bool match(const HexMapPtr& hmap, const std::vector<int>& anchor_hexes, int threads=1);
+		// Tile rule located at the rule center, which is unaffected by rotation. nullptr if the
+		// rule has no such tile or it matches any terrain type.
+		const TileRule* getAnchor() const { return anchor_; }
+		// Largest distance between any two hexes the rule covers.
+		int getFootprintSize() const { return footprint_size_; }
+		// Offsets from the hex the rule is matched at of every hex a match there reads or changes, 
+		// over all rotations and including the hex itself.
+		const std::vector<CubeOffset>& getReach() const { return reach_; }
+		// Whether the rule is only tried if the hex at a fixed position on the map matches.
+		bool hasAbsolutePosition() const { return absolute_position_ != nullptr; }
+		// Position of the rule in get_terrain_rules(), which its random choices are seeded from.
+		int getIndex() const { return index_; }
+		void setIndex(int index) { index_ = index; }
+		// Tries the rule at hex alone, with the rotations in rotation_mask.
+		void matchAt(const HexMapPtr& hmap, HexObject* hex, int rotation_mask=0x3f);
 		void preProcessMap(const variant& tiles);
 
 		static TerrainRulePtr create(const variant& v);
+		static TerrainRulePtr create(cache::Reader& r);
+		// Writes the rule as it is after tryEliminate(), the data used for matching is rebuilt on reading.
+		void writeCache(cache::Writer& w) const;
 		void applyImage(HexObject* hex, int rot);
 		bool tryEliminate();
 
 		std::string toString() const;
 		point calcOffsetForRotation(int rot);
 	private:
+		// Pre-computes the data used by match(), called once the tile data is complete.
+		void buildMatchData();
+		// Tries the rule at each of the hexes with the given indexes, which must be in map order.
+		void matchCandidates(const HexMapPtr& hmap, const std::vector<int>& candidates, int threads);
+		// Bit mask of the rotations whose types and flags match at hex, without changing anything.
+		int possibleRotations(const HexMapPtr& hmap, const HexObject& hex) const;
 		// constrains the rule to given absolute map coordinates
 		std::unique_ptr<point> absolute_position_;
 		// constrains the rule to absolute map coordinates which are multiples of the given values
@@ -150,5 +218,12 @@ namespace hex
 		std::vector<std::unique_ptr<TileImage>> image_;
 		std::vector<point> pos_offset_;
 		int probability_;
+		TileRule* anchor_;
+		// Whether the rule requires flags that it sets itself, in which case whether it matches at a
+		// hex depends on the hexes matched before it.
+		bool self_dependent_;
+		int footprint_size_;
+		std::vector<CubeOffset> reach_;
+		int index_;
 	};
 }
@@ -1,11 +1,16 @@
-#include <deque>
+#include <algorithm>
+#include <cerrno>
 #include <cstdint>
-#include <tuple>
+#include <cstdlib>
+#include <boost/functional/hash.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
+#include "asserts.hpp"
 #include "filesystem.hpp"
 #include "formatter.hpp"
 #include "json.hpp"
-#include "lexical_cast.hpp"
+#include "unit_test.hpp"
 
 namespace json
 {
@@ -19,87 +24,16 @@ namespace json
 
 	bool is_digit(int c)
 	{
-		if(c == '0' || c == '1' || c == '2' || c == '3' 
-			|| c == '4' || c == '5' || c == '6' || c == '7' 
-			|| c == '8' || c == '9') {
-			return true;
-		}
-		return false;
+		return c >= '0' && c <= '9';
 	}
 
-	class lexer
+	namespace
 	{
-	public:
-		enum json_token
-		{
-			LEFT_BRACE,
-			RIGHT_BRACE,
-			LEFT_BRACKET,
-			RIGHT_BRACKET,
-			COLON,
-			COMMA,
-			STRING_LITERAL,
-			INTEGER,
-			FLOAT,
-			LIT_TRUE,
-			LIT_FALSE,
-			LIT_NULL,
-			LITERAL,
-			DOCUMENT_END,
-		};
-
-		lexer(const std::string& s)
-			: lex_str_(s)
-		{
-			it_ = lex_str_.begin();
-		}
-
-		static bool is_simple_value(json_token tok)
+		bool is_delimiter(int c)
 		{
-			if(tok == STRING_LITERAL || tok == INTEGER || tok == FLOAT
-				|| tok == LIT_TRUE || tok == LIT_FALSE || tok == LIT_NULL) {
-				return true;
-			}
-			return false;
+			return c == '{' || c == '}' || c == '[' || c == ']' || c == ',' || c == ':' || c == '"' || is_space(c);
 		}
 
-		static std::string token_as_string(json_token tok)
-		{
-			switch(tok) {
-			case LEFT_BRACE:
-				return "LEFT BRACE";
-			case RIGHT_BRACE:
-				return "RIGHT BRACE";
-			case LEFT_BRACKET:
-				return "LEFT BRACKET";
-			case RIGHT_BRACKET:
-				return "RIGHT BRACKET";
-			case COLON:
-				return "COLON";
-			case COMMA:
-				return "COMMA";
-			case STRING_LITERAL:
-				return "STRING LITERAL";
-			case INTEGER:
-				return "INTEGER";
-			case FLOAT:
-				return "FLOAT";
-			case LIT_TRUE:
-				return "LITERAL TRUE";
-			case LIT_FALSE:
-				return "LITERAL FALSE";
-			case LIT_NULL:
-				return "LITERAL NULL";
-			case LITERAL:
-				return "LITERAL";
-			case DOCUMENT_END:
-				return "DOCUMENT END";
-			default:
-				throw parse_error(formatter() << "unknown token type in token_as_string: " << tok);
-			}
-			return "";
-		}
-		
 		uint16_t decode_hex_nibble(char c)
 		{
 			if(c >= '0' && c <= '9') {
@@ -112,303 +46,516 @@ namespace json
 			throw parse_error(formatter() << "Invalid character in decode: " << c);
 		}
 
-		void push_back(json_token tok, variant value)
-		{
-			pushed_back_tokens.push_back(std::make_pair(tok, value));
-		}
-		
-		std::tuple<json_token, variant> get_next_token()
+		// Single pass recursive descent parser, which passes values straight to the handler as
+		// they are read. Accepts trailing commas in objects and arrays and unquoted object keys.
+		class parser
 		{
-			if(pushed_back_tokens.empty() == false) {
-				std::pair<json_token, variant> pr = pushed_back_tokens.front();
-				pushed_back_tokens.pop_front();
-				return std::make_tuple(pr.first, pr.second);
+		public:
+			parser(const char* first, const char* last, sax_handler& handler)
+				: first_(first),
+				  it_(first),
+				  last_(last),
+				  handler_(handler),
+				  scratch_()
+			{
+			}
+
+			void parseDocument()
+			{
+				skipSpace();
+				if(it_ != last_ && (*it_ == '{' || *it_ == '[')) {
+					parseValue();
+				} else {
+					error("Expecting array or object");
+				}
+				skipSpace();
+				if(it_ != last_) {
+					error("Unexpected data after end of document");
+				}
+			}
+		private:
+			void error(const std::string& msg) const
+			{
+				const int line = static_cast<int>(std::count(first_, it_, '\n')) + 1;
+				if(it_ == last_) {
+					throw parse_error(formatter() << msg << ", found end of document at line " << line);
+				}
+				throw parse_error(formatter() << msg << ", found '" << *it_ << "' at line " << line);
 			}
 
-			bool running = true;
-			bool in_string = false;
-			std::string::iterator start_it = it_;
-			std::string new_string;
-			while(running) {
-				if(it_ == lex_str_.end()) {
-					if(in_string) {
-						throw parse_error(formatter() << "End of data inside string");
+			void skipSpace()
+			{
+				while(it_ != last_ && is_space(*it_)) {
+					++it_;
+				}
+			}
+
+			// Skips whitespace then consumes c if it's the next character.
+			bool accept(char c)
+			{
+				skipSpace();
+				if(it_ != last_ && *it_ == c) {
+					++it_;
+					return true;
+				}
+				return false;
+			}
+
+			void parseValue()
+			{
+				skipSpace();
+				if(it_ == last_) {
+					error("Expected value");
+				}
+				const char c = *it_;
+				if(c == '{') {
+					++it_;
+					parseObject();
+				} else if(c == '[') {
+					++it_;
+					parseArray();
+				} else if(c == '"') {
+					++it_;
+					handler_.string_value(parseString());
+				} else if(is_digit(c) || c == '-') {
+					parseNumber();
+				} else {
+					const char* start = it_;
+					const boost::string_ref lit = parseLiteral();
+					if(lit == "true") {
+						handler_.bool_value(true);
+					} else if(lit == "false") {
+						handler_.bool_value(false);
+					} else if(lit == "null") {
+						handler_.null_value();
+					} else {
+						it_ = start;
+						error("Expected value");
 					}
-					return std::make_tuple(DOCUMENT_END, variant());
 				}
-				if(in_string) {
-					if(*it_ == '"' /*|| *it_ == '\''*/) {
-						++it_;
-						variant string_node(new_string);
-						//if(new_string == "true") {
-						//	return std::make_tuple(LIT_TRUE, variant::from_bool(true));
-						//} else if(new_string == "false") {
-						//	return std::make_tuple(LIT_FALSE, variant::from_bool(false));
-						//} else if(new_string == "null") {
-						//	return std::make_tuple(LIT_NULL, variant());
-						//}
-						return std::make_tuple(STRING_LITERAL, string_node);
-					} else if(*it_ == '\\') {
+			}
+
+			void parseObject()
+			{
+				handler_.begin_object();
+				while(!accept('}')) {
+					if(it_ == last_) {
+						error("Expected object key");
+					} else if(*it_ == '"') {
 						++it_;
-						if(it_ == lex_str_.end()) {
-							throw parse_error(formatter() << "End of data in quoted token");
-						}
-						if(*it_ == '"') {
-							new_string += '"';
-							++it_;
-						} else if(*it_ == '\\') {
-							new_string += '\\';
-							++it_;
-						} else if(*it_ == '/') {
-							new_string += '/';
-							++it_;
-						} else if(*it_ == 'b') {
-							new_string += '\b';
-							++it_;
-						} else if(*it_ == 'f') {
-							new_string += '\f';
-							++it_;
-						} else if(*it_ == 'n') {
-							new_string += '\n';
-							++it_;
-						} else if(*it_ == 'r') {
-							new_string += '\r';
-							++it_;
-						} else if(*it_ == 't') {
-							new_string += '\t';
-							++it_;
-						} else if(*it_ == 'u') {
-							++it_;
-							if((lex_str_.end() - it_) >= 4) {
-								uint16_t value = 0;
-								for(int n = 0; n != 4; ++n) {
-									value = (value << 4) | decode_hex_nibble(*it_++);
-								}
-								// Quick and dirty conversion from \uXXXX -> UTF-8
-								if(value >= 0 && value <= 127U) {
-									new_string += char(value);
-								} else if(value >= 128U && value <= 2047U) {
-									new_string += char(0xc0 | (value >> 6));
-									new_string += char(0x80 | (value & 0x3f));
-								} else if(value >= 2048U) {
-									new_string += char(0xe0 | (value >> 12));
-									new_string += char(0x80 | ((value >> 6) & 0x3f));
-									new_string += char(0x80 | (value & 0x3f));
-								}
-							} else {
-								throw parse_error(formatter() << "Expected 4 hexadecimal characters after \\u token");
-							}
-						} else {
-							throw parse_error(formatter() << "Unrecognised quoted token: " << *it_);
-						}
+						handler_.key(parseString());
+					} else if(!is_digit(*it_) && *it_ != '-' && !is_delimiter(*it_)) {
+						handler_.key(parseLiteral());
 					} else {
-						new_string += *it_++;
+						error("Expected string or literal as object key");
 					}
-				} else {
-					if(*it_ == '{' || *it_ == '}' || *it_ == '[' || *it_ == ']' || *it_ == ',' || *it_ == ':' || *it_ == '"' /*|| *it_ == '\''*/ || is_space(*it_)) {
-						if(new_string.empty() == false) {
-							if(new_string == "true") {
-								return std::make_tuple(LIT_TRUE, variant::from_bool(true));
-							} else if(new_string == "false") {
-								return std::make_tuple(LIT_FALSE, variant::from_bool(false));
-							} else if(new_string == "null") {
-								return std::make_tuple(LIT_NULL, variant());
-							} else {
-								return std::make_tuple(LITERAL, variant(new_string));
-							}
+					if(!accept(':')) {
+						error("Expected colon ':'");
+					}
+					parseValue();
+					if(!accept(',')) {
+						if(!accept('}')) {
+							error("Expected comma ',' or right brace '}'");
 						}
+						break;
 					}
-					if(*it_ == '{') {
-						++it_;
-						return std::make_tuple(LEFT_BRACE, variant());
-					} else if(*it_ == '}') {
-						++it_;
-						return std::make_tuple(RIGHT_BRACE, variant());
-					} else if(*it_ == '[') {
-						++it_;
-						return std::make_tuple(LEFT_BRACKET, variant());
-					} else if(*it_ == ']') {
-						++it_;
-						return std::make_tuple(RIGHT_BRACKET, variant());
-					} else if(*it_ == ',') {
-						++it_;
-						return std::make_tuple(COMMA, variant());
-					} else if(*it_ == ':') {
-						++it_;
-						return std::make_tuple(COLON, variant());
-					} else if(*it_ == '"' /*|| *it_ == '\''*/) {
-						in_string = true;
-						++it_;
-					} else if(is_digit(*it_) || *it_ == '-') {
-						bool is_float = false;
-						std::string num;
-						if(*it_ == '-') {
-							num += *it_;
-							++it_;
+				}
+				handler_.end_object();
+			}
+
+			void parseArray()
+			{
+				handler_.begin_array();
+				while(!accept(']')) {
+					parseValue();
+					if(!accept(',')) {
+						if(!accept(']')) {
+							error("Expected comma ',' or right bracket ']'");
 						}
-						while(is_digit(*it_)) {
-							num += *it_;
-							++it_;
+						break;
+					}
+				}
+				handler_.end_array();
+			}
+
+			// Called after the opening quote. Strings without escapes refer straight to the input.
+			boost::string_ref parseString()
+			{
+				const char* start = it_;
+				while(it_ != last_ && *it_ != '"' && *it_ != '\\') {
+					++it_;
+				}
+				if(it_ == last_) {
+					error("End of data inside string");
+				}
+				if(*it_ == '"') {
+					return boost::string_ref(start, it_++ - start);
+				}
+
+				scratch_.assign(start, it_);
+				while(it_ != last_ && *it_ != '"') {
+					if(*it_ != '\\') {
+						scratch_ += *it_++;
+						continue;
+					}
+					if(++it_ == last_) {
+						error("End of data in quoted token");
+					}
+					switch(*it_++) {
+					case '"':	scratch_ += '"'; break;
+					case '\\':	scratch_ += '\\'; break;
+					case '/':	scratch_ += '/'; break;
+					case 'b':	scratch_ += '\b'; break;
+					case 'f':	scratch_ += '\f'; break;
+					case 'n':	scratch_ += '\n'; break;
+					case 'r':	scratch_ += '\r'; break;
+					case 't':	scratch_ += '\t'; break;
+					case 'u': {
+						if(last_ - it_ < 4) {
+							error("Expected 4 hexadecimal characters after \\u token");
 						}
-						if(*it_ == '.') {
-							num += *it_;
-							++it_;
-							while(is_digit(*it_)) {
-								num += *it_;
-								++it_;
-							}
-							is_float = true;
-						} 
-						if(*it_ == 'e' || *it_ == 'E') {
-							is_float = true;
-							num += *it_;
-							++it_;
-							if(*it_ == '+') {
-								num += *it_;
-								++it_;
-							} else if(*it_ == '-') {
-								num += *it_;
-								++it_;
-							}
-							while(is_digit(*it_)) {
-								num += *it_;
-								++it_;
-							}
+						uint16_t value = 0;
+						for(int n = 0; n != 4; ++n) {
+							value = (value << 4) | decode_hex_nibble(*it_++);
 						}
-						if(is_float) {
-							//std::cerr << "Convert \"" << num << "\" to float" << std::endl;
-							try {
-								return std::make_tuple(FLOAT, variant(lex::lexical_cast<float>(num)));
-							} catch (lex::bad_lexical_cast&) {
-								throw parse_error(formatter() << "error converting value to float: " << num);
-							}
+						// Quick and dirty conversion from \uXXXX -> UTF-8
+						if(value <= 127U) {
+							scratch_ += char(value);
+						} else if(value <= 2047U) {
+							scratch_ += char(0xc0 | (value >> 6));
+							scratch_ += char(0x80 | (value & 0x3f));
 						} else {
-							//std::cerr << "Convert \"" << num << "\" to int" << std::endl;
-							try {
-								return std::make_tuple(INTEGER, variant(lex::lexical_cast<int64_t>(num)));
-							} catch (lex::bad_lexical_cast&) {
-								throw parse_error(formatter() << "error converting value to integer: " << num);
-							}
+							scratch_ += char(0xe0 | (value >> 12));
+							scratch_ += char(0x80 | ((value >> 6) & 0x3f));
+							scratch_ += char(0x80 | (value & 0x3f));
 						}
-					} else if(is_space(*it_)) {
-						++it_;
-					} else {
-						new_string += *it_;
-						++it_;
+						break;
+					}
+					default:
+						--it_;
+						error("Unrecognised quoted token");
 					}
 				}
+				if(it_ == last_) {
+					error("End of data inside string");
+				}
+				++it_;
+				return boost::string_ref(scratch_);
 			}
-			return std::make_tuple(DOCUMENT_END, variant());
-		}
-
-	private:
-		std::string lex_str_;
-		std::string::iterator it_;
-		std::deque<std::pair<json_token, variant> > pushed_back_tokens;
-	};
 
-	namespace 
-	{
-		variant read_array(lexer& lex);
-		variant read_object(lexer& lex);
+			boost::string_ref parseLiteral()
+			{
+				const char* start = it_;
+				while(it_ != last_ && !is_delimiter(*it_)) {
+					++it_;
+				}
+				return boost::string_ref(start, it_ - start);
+			}
 
-		variant read_array(lexer& lex)
-		{
-			std::vector<variant> res;
-			bool running = true;
-			while(running) {
-				lexer::json_token tok;
-				variant token_value;
-				std::tie(tok, token_value) = lex.get_next_token();
-				if(lexer::is_simple_value(tok)) {
-					res.push_back(token_value);
-				} else if(tok == lexer::LEFT_BRACE) {
-					res.push_back(read_object(lex));
-				} else if(tok == lexer::LEFT_BRACKET) {
-					res.push_back(read_array(lex));
-				} else {
-					throw parse_error(formatter() << "Expected colon ':' found " << lexer::token_as_string(tok));
+			void parseNumber()
+			{
+				const char* start = it_;
+				bool is_float = false;
+				if(*it_ == '-') {
+					++it_;
 				}
-				std::tie(tok, token_value) = lex.get_next_token();
-				if(tok == lexer::RIGHT_BRACKET) {
-					running = false;
-				} else if(tok == lexer::COMMA) {
-					std::tie(tok, token_value) = lex.get_next_token();
-					if(tok == lexer::RIGHT_BRACKET) {
-						running = false;
-					} else {
-						lex.push_back(tok, token_value);
+				skipDigits();
+				if(it_ != last_ && *it_ == '.') {
+					++it_;
+					skipDigits();
+					is_float = true;
+				}
+				if(it_ != last_ && (*it_ == 'e' || *it_ == 'E')) {
+					++it_;
+					if(it_ != last_ && (*it_ == '+' || *it_ == '-')) {
+						++it_;
 					}
+					skipDigits();
+					is_float = true;
 				}
-			}
-			return variant(res);
-		}
 
-		variant read_object(lexer& lex)
-		{
-			std::map<variant, variant> res;
-			bool running = true;
-			while(running) {
-				lexer::json_token tok;
-				variant token_value;
-				std::tie(tok, token_value) = lex.get_next_token();
-				variant key;
-				if(tok == lexer::LITERAL || tok == lexer::STRING_LITERAL) {
-					key = token_value;
-				} else {
-					throw parse_error(formatter() << "Unexpected token type: " << lexer::token_as_string(tok) << " expected string or literal : " << token_value.to_debug_string());
-				}
-				std::tie(tok, token_value) = lex.get_next_token();
-				if(tok != lexer::COLON) {
-					throw parse_error(formatter() << "Expected colon ':' found " << lexer::token_as_string(tok) << " : " << token_value.to_debug_string());
+				// The input isn't necessarily null terminated, so convert from a copy.
+				char buf[64];
+				const size_t len = it_ - start;
+				if(len >= sizeof(buf)) {
+					it_ = start;
+					error("Number too long");
 				}
-				std::tie(tok, token_value) = lex.get_next_token();
-				if(lexer::is_simple_value(tok)) {
-					res[key] = token_value;
-				} else if(tok == lexer::LEFT_BRACE) {
-					res[key] = read_object(lex);
-				} else if(tok == lexer::LEFT_BRACKET) {
-					res[key] = read_array(lex);
+				std::copy(start, it_, buf);
+				buf[len] = '\0';
+				char* end = nullptr;
+				errno = 0;
+				if(is_float) {
+					const float f = std::strtof(buf, &end);
+					if(end != buf + len) {
+						it_ = start;
+						error(formatter() << "error converting value to float: " << buf);
+					}
+					handler_.float_value(f);
 				} else {
-					throw parse_error(formatter() << "Expected colon ':' found " << lexer::token_as_string(tok) << " : " << token_value.to_debug_string());
-				}
-				std::tie(tok, token_value) = lex.get_next_token();
-				if(tok == lexer::RIGHT_BRACE) {
-					running = false;
-				} else if(tok == lexer::COMMA) {
-					std::tie(tok, token_value) = lex.get_next_token();
-					if(tok == lexer::RIGHT_BRACE) {
-						running = false;
-					} else {
-						lex.push_back(tok, token_value);
+					const long long n = std::strtoll(buf, &end, 10);
+					if(end != buf + len || errno == ERANGE) {
+						it_ = start;
+						error(formatter() << "error converting value to integer: " << buf);
 					}
+					handler_.int_value(static_cast<int64_t>(n));
 				}
 			}
-			return variant(res);
+
+			void skipDigits()
+			{
+				while(it_ != last_ && is_digit(*it_)) {
+					++it_;
+				}
+			}
+
+			const char* first_;
+			const char* it_;
+			const char* last_;
+			sax_handler& handler_;
+			// Holds strings which needed escapes decoding.
+			std::string scratch_;
+		};
+	}
+
+	variant_builder::variant_builder(bool use_arena)
+		: stack_(),
+		  depth_(0),
+		  keys_(),
+		  arena_(use_arena ? variant_arena::create() : nullptr),
+		  result_(),
+		  callback_depth_(-1),
+		  callback_()
+	{
+	}
+
+	variant_builder::variant_builder(int depth, std::function<void(const variant&)> fn, bool use_arena)
+		: stack_(),
+		  depth_(0),
+		  keys_(),
+		  arena_(use_arena ? variant_arena::create() : nullptr),
+		  result_(),
+		  callback_depth_(depth),
+		  callback_(fn)
+	{
+	}
+
+	variant_builder::~variant_builder()
+	{
+		// Anything allocated from the arena holds a reference to it as well.
+		if(arena_) {
+			arena_->release();
 		}
 	}
 
-	variant parse(const std::string& s)
+	void variant_builder::beginContainer(bool is_map)
 	{
-		lexer lex(s);
-		lexer::json_token tok;
-		variant token_value;
-		std::tie(tok, token_value) = lex.get_next_token();
-		if(tok == lexer::LEFT_BRACE) {
-			return read_object(lex);
-		} else if(tok == lexer::LEFT_BRACKET) {
-			return read_array(lex);
-		} else {
-			throw parse_error(formatter() << "Expecting array or object, found " << lexer::token_as_string(tok));
+		if(depth_ == static_cast<int>(stack_.size())) {
+			stack_.emplace_back();
+		}
+		stack_[depth_++].is_map = is_map;
+	}
+
+	void variant_builder::begin_object()
+	{
+		beginContainer(true);
+	}
+
+	void variant_builder::end_object()
+	{
+		variant value = variant::create_map(&stack_[--depth_].elements, arena_);
+		addValue(std::move(value));
+	}
+
+	void variant_builder::begin_array()
+	{
+		beginContainer(false);
+	}
+
+	void variant_builder::end_array()
+	{
+		auto& list = stack_[--depth_].list;
+		variant value = variant::create_list(list.data(), list.data() + list.size(), arena_);
+		list.clear();
+		addValue(std::move(value));
+	}
+
+	size_t variant_builder::KeyHash::operator()(const boost::string_ref& s) const
+	{
+		return boost::hash_range(s.begin(), s.end());
+	}
+
+	void variant_builder::key(const boost::string_ref& k)
+	{
+		auto it = keys_.find(k);
+		if(it == keys_.end()) {
+			variant key_str = variant::create_string(k.data(), k.size(), arena_);
+			it = keys_.emplace(key_str.as_string_ref(), key_str).first;
 		}
+		stack_[depth_ - 1].key = it->second;
+	}
+
+	void variant_builder::string_value(const boost::string_ref& s)
+	{
+		addValue(variant::create_string(s.data(), s.size(), arena_));
+	}
+
+	void variant_builder::int_value(int64_t n)
+	{
+		addValue(variant(n));
+	}
+
+	void variant_builder::float_value(float f)
+	{
+		addValue(variant(f));
+	}
+
+	void variant_builder::bool_value(bool b)
+	{
+		addValue(variant::from_bool(b));
+	}
+
+	void variant_builder::null_value()
+	{
+		addValue(variant());
 	}
 
-	variant parse_from_file(const std::string& fname)
+	void variant_builder::addValue(variant&& value)
 	{
-		if(sys::file_exists(fname)) {
-			return parse(sys::read_file(fname));
+		if(callback_ && depth_ == callback_depth_) {
+			callback_(value);
+		} else if(depth_ == 0) {
+			result_ = std::move(value);
+		} else if(stack_[depth_ - 1].is_map) {
+			// Sorted when the object is complete, with later duplicate keys replacing earlier ones.
+			auto& c = stack_[depth_ - 1];
+			c.elements.emplace_back(c.key, std::move(value));
 		} else {
+			stack_[depth_ - 1].list.emplace_back(std::move(value));
+		}
+	}
+
+	void parse(const char* first, const char* last, sax_handler& handler)
+	{
+		parser(first, last, handler).parseDocument();
+	}
+
+	void parse_from_file(const std::string& fname, sax_handler& handler)
+	{
+		if(!sys::file_exists(fname)) {
 			throw parse_error(formatter() << "File \"" <<  fname << "\" doesn't exist");
 		}
+		try {
+			using namespace boost::interprocess;
+			file_mapping file(fname.c_str(), read_only);
+			mapped_region region(file, read_only);
+			const char* data = static_cast<const char*>(region.get_address());
+			parse(data, data + region.get_size(), handler);
+		} catch(boost::interprocess::interprocess_exception& e) {
+			throw parse_error(formatter() << "Unable to read file \"" << fname << "\": " << e.what());
+		}
+	}
+
+	variant parse(const std::string& s, bool use_arena)
+	{
+		variant_builder builder(use_arena);
+		parse(s.data(), s.data() + s.size(), builder);
+		return std::move(builder.get());
+	}
+
+	variant parse_from_file(const std::string& fname, bool use_arena)
+	{
+		variant_builder builder(use_arena);
+		parse_from_file(fname, builder);
+		return std::move(builder.get());
+	}
+}
+
+namespace
+{
+	// Does nothing with the values, to measure the parser alone.
+	class null_handler : public json::sax_handler
+	{
+	public:
+		void begin_object() override {}
+		void end_object() override {}
+		void begin_array() override {}
+		void end_array() override {}
+		void key(const boost::string_ref& k) override {}
+		void string_value(const boost::string_ref& s) override {}
+		void int_value(int64_t n) override {}
+		void float_value(float f) override {}
+		void bool_value(bool b) override {}
+		void null_value() override {}
+	};
+
+	bool parse_fails(const std::string& s)
+	{
+		try {
+			json::parse(s);
+		} catch(json::parse_error&) {
+			return true;
+		}
+		return false;
+	}
+}
+
+UNIT_TEST(json_parse)
+{
+	variant v = json::parse("{ \"a\": [1, -2.5, true, null, \"x\\n\\u00e9\",], b : { \"c\": 1e2, }, \"a2\": [] }");
+	CHECK_EQ(v["a"].num_elements(), 5);
+	CHECK_EQ(v["a"][0].as_int(), 1);
+	CHECK(v["a"][1].is_float(), "expected float");
+	CHECK_EQ(v["a"][1].as_float(), -2.5f);
+	CHECK(v["a"][2].as_bool(), "expected true");
+	CHECK(v["a"][3].is_null(), "expected null");
+	CHECK_EQ(v["a"][4].as_string(), "x\n\xc3\xa9");
+	CHECK_EQ(v["b"]["c"].as_float(), 100.0f);
+	CHECK_EQ(v["a2"].num_elements(), 0);
+
+	CHECK(parse_fails("[1 2]"), "missing comma accepted");
+	CHECK(parse_fails("{\"a\" 1}"), "missing colon accepted");
+	CHECK(parse_fails("[\"abc]"), "unterminated string accepted");
+	CHECK(parse_fails("[1] x"), "trailing data accepted");
+	CHECK(parse_fails("\"abc\""), "non-container document accepted");
+
+	// Items at depth 2 are passed to the callback rather than stored.
+	std::vector<int> items;
+	json::variant_builder builder(2, [&items](const variant& item) { items.emplace_back(item["n"].as_int32()); });
+	const std::string doc = "{ \"items\": [ { \"n\": 1 }, { \"n\": 2 } ] }";
+	json::parse(doc.data(), doc.data() + doc.size(), builder);
+	CHECK_EQ(items.size(), 2);
+	CHECK_EQ(items[1], 2);
+	CHECK_EQ(builder.get()["items"].num_elements(), 0);
+
+	// Parts of a document allocated from an arena outlive the rest of it.
+	variant item;
+	{
+		variant doc = json::parse("{ \"a\": [ { \"name\": \"grass\" } ] }", true);
+		item = doc["a"][0];
+	}
+	CHECK_EQ(item["name"].as_string(), "grass");
+	variant copy = item;
+	copy.as_mutable_map()[variant(std::string("name"))] = variant(std::string("water"));
+	CHECK_EQ(item["name"].as_string(), "grass");
+	CHECK_EQ(copy["name"].as_string(), "water");
+}
+
+BENCHMARK_ARG(json_parse, const std::string& fname)
+{
+	BENCHMARK_LOOP {
+		json::parse_from_file(fname);
 	}
 }
+
+BENCHMARK_ARG_CALL(json_parse, terrain_graphics, "data/terrain-graphics.cfg")
+
+BENCHMARK_ARG(json_parse_sax, const std::string& fname)
+{
+	null_handler handler;
+	BENCHMARK_LOOP {
+		json::parse_from_file(fname, handler);
+	}
+}
+
+BENCHMARK_ARG_CALL(json_parse_sax, terrain_graphics, "data/terrain-graphics.cfg")
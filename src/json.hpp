@@ -1,5 +1,9 @@
 #pragma once
 
+#include <functional>
+#include <unordered_map>
+#include <boost/utility/string_ref.hpp>
+
 #include "variant.hpp"
 
 
@@ -13,7 +17,85 @@ namespace json
 		{}
 	};
 
-	variant parse(const std::string& s);
-	variant parse_from_file(const std::string& fname);
+	// Receives the contents of a document, in order, as it is parsed. Strings refer directly to
+	// the text being parsed, or to a temporary copy if they contained escapes, so are only valid
+	// for the duration of the call.
+	class sax_handler
+	{
+	public:
+		virtual ~sax_handler() {}
+		virtual void begin_object() = 0;
+		virtual void end_object() = 0;
+		virtual void begin_array() = 0;
+		virtual void end_array() = 0;
+		virtual void key(const boost::string_ref& k) = 0;
+		virtual void string_value(const boost::string_ref& s) = 0;
+		virtual void int_value(int64_t n) = 0;
+		virtual void float_value(float f) = 0;
+		virtual void bool_value(bool b) = 0;
+		virtual void null_value() = 0;
+	};
+
+	// sax_handler which builds the document as a variant. If use_arena is set the variants are
+	// allocated from a variant_arena, which is much quicker to build and free, but the memory for
+	// the whole document is kept until every part of it has been released.
+	class variant_builder : public sax_handler
+	{
+	public:
+		explicit variant_builder(bool use_arena=false);
+		// Values completed at the given depth (0 being the document itself, 1 the items in it, etc)
+		// are passed to fn instead of being added to their parent. Used to process large documents
+		// one piece at a time.
+		variant_builder(int depth, std::function<void(const variant&)> fn, bool use_arena=false);
+		~variant_builder();
+		variant& get() { return result_; }
+
+		void begin_object() override;
+		void end_object() override;
+		void begin_array() override;
+		void end_array() override;
+		void key(const boost::string_ref& k) override;
+		void string_value(const boost::string_ref& s) override;
+		void int_value(int64_t n) override;
+		void float_value(float f) override;
+		void bool_value(bool b) override;
+		void null_value() override;
+	private:
+		variant_builder(const variant_builder&);
+		void operator=(const variant_builder&);
+
+		void beginContainer(bool is_map);
+		void addValue(variant&& value);
+		// A container being built, only one of elements or list is used. These are kept once
+		// the container is complete and reused for the next one at the same depth.
+		struct Container
+		{
+			bool is_map;
+			std::vector<variant_map::value_type> elements;
+			std::vector<variant> list;
+			variant key;
+		};
+		std::vector<Container> stack_;
+		int depth_;
+		struct KeyHash
+		{
+			size_t operator()(const boost::string_ref& s) const;
+		};
+		// Keys seen so far, so that all uses of the same key share one string. Each key refers 
+		// to the characters of its shared string, so looking one up doesn't copy it.
+		std::unordered_map<boost::string_ref, variant, KeyHash> keys_;
+		variant_arena* arena_;
+		variant result_;
+		int callback_depth_;
+		std::function<void(const variant&)> callback_;
+	};
+
+	// Parses the text in [first, last), which needn't be null terminated.
+	void parse(const char* first, const char* last, sax_handler& handler);
+	// Parses a file without reading it into memory first.
+	void parse_from_file(const std::string& fname, sax_handler& handler);
+
+	variant parse(const std::string& s, bool use_arena=false);
+	variant parse_from_file(const std::string& fname, bool use_arena=false);
 	void write(std::ostream& os, const variant& n, bool pretty=true);
 }
@@ -112,6 +112,7 @@ namespace KRE
 	{
 		index_type_ = IndexType::INDEX_UCHAR;
 		index8_.swap(*value);
+		count_ = index8_.size();
 		handleIndexUpdate();
 	}
 
@@ -119,6 +120,7 @@ namespace KRE
 	{
 		index_type_ = IndexType::INDEX_USHORT;
 		index16_.swap(*value);
+		count_ = index16_.size();
 		handleIndexUpdate();
 	}
 
@@ -126,6 +128,7 @@ namespace KRE
 	{
 		index_type_ = IndexType::INDEX_ULONG;
 		index32_.swap(*value);
+		count_ = index32_.size();
 		handleIndexUpdate();
 	}
 
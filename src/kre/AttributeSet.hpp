@@ -235,6 +235,20 @@ namespace KRE
 				getParent()->setCount(elements_.size());
 			}
 		}
+		// Overwrites the elements starting at offset with src, only sending those to the device.
+		// The existing number of elements isn't changed, so src must fit.
+		void updateRange(const Container<T>& src, size_type offset) {
+			ASSERT_LOG(offset + src.size() <= elements_.size(), "Range update goes past the end of the attribute data: " << (offset + src.size()) << " > " << elements_.size());
+			std::copy(src.begin(), src.end(), elements_.begin() + offset);
+			if(getDeviceBufferData() && src.size() > 0) {
+				if(offset == 0) {
+					// Device buffers treat an update at offset 0 as replacing the whole store.
+					getDeviceBufferData()->update(&elements_[0], 0, elements_.size() * sizeof(T));
+				} else {
+					getDeviceBufferData()->update(&elements_[offset], offset * sizeof(T), src.size() * sizeof(T));
+				}
+			}
+		}
 		void addMultiDraw(Container<T>* src) {
 			ASSERT_LOG(getParent() != nullptr && getParent()->isMultiDrawEnabled(), "Parent attribute set not enabled for multi-draw. Call enableMultiDraw() on parent.");
 			std::ptrdiff_t dst1 = elements_.size();
@@ -28,6 +28,7 @@
 #include "asserts.hpp"
 #include "BlendModeScope.hpp"
 #include "BlendOGL.hpp"
+#include "DisplayDevice.hpp"
 
 namespace KRE
 {
@@ -78,6 +79,20 @@ namespace KRE
 			return GL_ZERO;
 		}
 
+		// Blend scopes restore the previous mode when they end, so consecutive renderables with the
+		// same mode would otherwise set it twice each.
+		void set_blend_func(GLenum src, GLenum dst)
+		{
+			static std::pair<GLenum, GLenum> current(GL_NONE, GL_NONE);
+			if(current.first == src && current.second == dst) {
+				++DisplayDevice::getStateChangeCounters().blend_changes_skipped;
+				return;
+			}
+			glBlendFunc(src, dst);
+			current = std::make_pair(src, dst);
+			++DisplayDevice::getStateChangeCounters().blend_changes;
+		}
+
 		std::stack<BlendEquation>& get_equation_stack()
 		{
 			static std::stack<BlendEquation> res;
@@ -169,12 +184,12 @@ namespace KRE
 		if(sv.isBlendModeSet() && bm != BlendMode()) {
 			get_blend_mode_stack().emplace(bm);
 			stored_ = true;
-			glBlendFunc(convert_blend_mode(bm.src()), convert_blend_mode(bm.dst()));
+			set_blend_func(convert_blend_mode(bm.src()), convert_blend_mode(bm.dst()));
 		} else if(BlendModeScope::getCurrentMode() != BlendMode()) {
 			auto& bm = BlendModeScope::getCurrentMode();
 			get_blend_mode_stack().emplace(bm);
 			stored_ = true;
-			glBlendFunc(convert_blend_mode(bm.src()), convert_blend_mode(bm.dst()));
+			set_blend_func(convert_blend_mode(bm.src()), convert_blend_mode(bm.dst()));
 		}
 	}
 
@@ -185,9 +200,9 @@ namespace KRE
 			get_blend_mode_stack().pop();
 			if(!get_blend_mode_stack().empty()) {
 				BlendMode& bm = get_blend_mode_stack().top();
-				glBlendFunc(convert_blend_mode(bm.src()), convert_blend_mode(bm.dst()));
+				set_blend_func(convert_blend_mode(bm.src()), convert_blend_mode(bm.dst()));
 			} else {
-				glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+				set_blend_func(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 			}
 		}
 
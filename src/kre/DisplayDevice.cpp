@@ -188,6 +188,12 @@ namespace KRE
 		return DisplayDevice::getCurrent()->handleCreateRenderTarget(node);
 	}
 
+	StateChangeCounters& DisplayDevice::getStateChangeCounters()
+	{
+		static StateChangeCounters res;
+		return res;
+	}
+
 	bool DisplayDevice::checkForFeature(DisplayDeviceCapabilties cap)
 	{
 		return DisplayDevice::getCurrent()->doCheckForFeature(cap);
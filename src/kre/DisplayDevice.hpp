@@ -44,10 +44,13 @@ namespace KRE
 		RENDER_TO_TEXTURE,
 		SHADERS,
 		UNIFORM_BUFFERS,
+		// Per-instance attributes, set with AttributeDesc divisors, and instanced draws.
+		INSTANCED_ARRAYS,
 	};
 
 	enum class DisplayDeviceParameters {
 		MAX_TEXTURE_UNITS,
+		MAX_TEXTURE_SIZE,
 	};
 
 	enum class ClearFlags {
@@ -90,6 +93,25 @@ namespace KRE
 		BGRA_INT,
 	};
 
+	// Render state changes made by the display device and those skipped as the state was 
+	// already current.
+	struct StateChangeCounters
+	{
+		StateChangeCounters() 
+			: shader_changes(0), shader_changes_skipped(0), 
+			  texture_binds(0), texture_binds_skipped(0), 
+			  uniform_uploads(0), uniform_uploads_skipped(0), 
+			  blend_changes(0), blend_changes_skipped(0) {}
+		int shader_changes;
+		int shader_changes_skipped;
+		int texture_binds;
+		int texture_binds_skipped;
+		int uniform_uploads;
+		int uniform_uploads_skipped;
+		int blend_changes;
+		int blend_changes_skipped;
+	};
+
 	class DisplayDevice
 	{
 	public:
@@ -193,6 +215,9 @@ namespace KRE
 
 		static bool checkForFeature(DisplayDeviceCapabilties cap);
 
+		// Reset by assigning StateChangeCounters().
+		static StateChangeCounters& getStateChangeCounters();
+
 		static void registerFactoryFunction(const std::string& type, std::function<DisplayDevicePtr(WindowPtr)>);
 	private:
 		std::weak_ptr<Window> parent_;
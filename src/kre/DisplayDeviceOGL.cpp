@@ -107,6 +107,33 @@ namespace KRE
 			return GL_NONE;
 		}
 
+		size_t get_index_size(IndexType it)
+		{
+			switch(it) {
+				case IndexType::INDEX_NONE:		break;
+				case IndexType::INDEX_UCHAR:		return sizeof(GLubyte);
+				case IndexType::INDEX_USHORT:		return sizeof(GLushort);
+				case IndexType::INDEX_ULONG:		return sizeof(GLuint);
+			}
+			ASSERT_LOG(false, "Unrecognised value for index type.");
+			return 0;
+		}
+
+		// Points the per-instance attributes of as at instance first, so that a range of instances
+		// can be drawn on its own.
+		void apply_instance_attributes(const ShaderProgramPtr& shader, const AttributeSetPtr& as, int first)
+		{
+			for(auto& attr : as->getAttributes()) {
+				if(!attr->isEnabled() || attr->getAttrDesc().empty() || attr->getAttrDesc().front().getDivisor() == 0) {
+					continue;
+				}
+				const ptrdiff_t offset = attr->getOffset();
+				attr->setOffset(offset + first * attr->getAttrDesc().front().getStride());
+				shader->applyAttribute(attr);
+				attr->setOffset(offset);
+			}
+		}
+
 		static const StencilSettings keep_stencil_settings(true,
 			StencilFace::FRONT_AND_BACK, 
 			StencilFunc::EQUAL, 
@@ -124,9 +151,11 @@ namespace KRE
 		  have_render_to_texture_(false),
 		  npot_textures_(false),
 		  hardware_uniform_buffers_(false),
+		  instanced_arrays_(false),
 		  major_version_(0),
 		  minor_version_(0),
-		  max_texture_units_(-1)
+		  max_texture_units_(-1),
+		  max_texture_size_(-1)
 	{
 	}
 
@@ -174,6 +203,10 @@ namespace KRE
 		if((err = glGetError()) != GL_NONE) {
 			LOG_ERROR("Failed query for GL_MAX_TEXTURE_IMAGE_UNITS: 0x" << std::hex << err);
 		}
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size_);
+		if((err = glGetError()) != GL_NONE) {
+			LOG_ERROR("Failed query for GL_MAX_TEXTURE_SIZE: 0x" << std::hex << err);
+		}
 		glGetIntegerv(GL_MINOR_VERSION, &minor_version_);
 		glGetIntegerv(GL_MAJOR_VERSION, &major_version_);
 		if((err = glGetError()) != GL_NONE) {
@@ -186,6 +219,8 @@ namespace KRE
 			major_version_ = static_cast<int>(integral);
 		}
 
+		instanced_arrays_ = (GLEW_VERSION_3_3 || GLEW_ARB_instanced_arrays) && (GLEW_VERSION_3_1 || GLEW_ARB_draw_instanced);
+
 		glEnable(GL_POINT_SPRITE);
 	}
 
@@ -225,6 +260,7 @@ namespace KRE
 		switch (param)
 		{
 		case DisplayDeviceParameters::MAX_TEXTURE_UNITS:	return max_texture_units_;
+		case DisplayDeviceParameters::MAX_TEXTURE_SIZE:		return max_texture_size_;
 		default: break;
 		}
 		ASSERT_LOG(false, "Invalid Parameter requested: " << static_cast<int>(param));
@@ -430,19 +466,39 @@ namespace KRE
 			}
 
 			if(as->isInstanced()) {
-				if(as->isIndexed()) {
-					as->bindIndex();
-					// XXX as->GetIndexArray() should be as->GetIndexArray()+as->GetOffset()
-					glDrawElementsInstanced(draw_mode, static_cast<GLsizei>(as->getCount()), convert_index_type(as->getIndexType()), as->getIndexArray(), as->getInstanceCount());
-					as->unbindIndex();
-				} else {
-					glDrawArraysInstanced(draw_mode, static_cast<GLint>(as->getOffset()), static_cast<GLsizei>(as->getCount()), as->getInstanceCount());
+				// Multi-draw ranges on an instanced set are ranges of instances, drawn one at a time.
+				const int draws = as->isMultiDrawEnabled() ? as->getMultiDrawCount() : 1;
+				for(int n = 0; n != draws; ++n) {
+					GLsizei instance_count = as->getInstanceCount();
+					if(as->isMultiDrawEnabled()) {
+						apply_instance_attributes(shader, as, as->getMultiOffsetArray()[n]);
+						instance_count = as->getMultiCountArray()[n];
+					}
+					if(as->isIndexed()) {
+						as->bindIndex();
+						// XXX as->GetIndexArray() should be as->GetIndexArray()+as->GetOffset()
+						glDrawElementsInstanced(draw_mode, static_cast<GLsizei>(as->getCount()), convert_index_type(as->getIndexType()), as->getIndexArray(), instance_count);
+						as->unbindIndex();
+					} else {
+						glDrawArraysInstanced(draw_mode, static_cast<GLint>(as->getOffset()), static_cast<GLsizei>(as->getCount()), instance_count);
+					}
 				}
 			} else {
 				if(as->isIndexed()) {
 					as->bindIndex();
 					// XXX as->GetIndexArray() should be as->GetIndexArray()+as->GetOffset()
-					glDrawElements(draw_mode, static_cast<GLsizei>(as->getCount()), convert_index_type(as->getIndexType()), as->getIndexArray());
+					if(as->isMultiDrawEnabled()) {
+						// Multi-draw offsets are counted in indices, but are passed as byte offsets into the index buffer.
+						const size_t index_size = get_index_size(as->getIndexType());
+						std::vector<const GLvoid*> offsets;
+						offsets.reserve(as->getMultiDrawCount());
+						for(const int offset : as->getMultiOffsetArray()) {
+							offsets.emplace_back(static_cast<const char*>(as->getIndexArray()) + offset * index_size);
+						}
+						glMultiDrawElements(draw_mode, as->getMultiCountArray().data(), convert_index_type(as->getIndexType()), offsets.data(), as->getMultiDrawCount());
+					} else {
+						glDrawElements(draw_mode, static_cast<GLsizei>(as->getCount()), convert_index_type(as->getIndexType()), as->getIndexArray());
+					}
 					as->unbindIndex();
 				} else {
 					if(as->isMultiDrawEnabled()) {
@@ -599,6 +655,8 @@ namespace KRE
 			return true;
 		case DisplayDeviceCapabilties::UNIFORM_BUFFERS:
 			return hardware_uniform_buffers_;
+		case DisplayDeviceCapabilties::INSTANCED_ARRAYS:
+			return instanced_arrays_;
 		default:
 			ASSERT_LOG(false, "Unknown value for DisplayDeviceCapabilties given.");
 		}
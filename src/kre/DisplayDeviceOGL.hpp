@@ -117,7 +117,9 @@ namespace KRE
 		bool have_render_to_texture_;
 		bool npot_textures_;
 		bool hardware_uniform_buffers_;
+		bool instanced_arrays_;
 		int max_texture_units_;
+		int max_texture_size_;
 
 		int major_version_;
 		int minor_version_;
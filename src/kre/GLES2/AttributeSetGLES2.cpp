@@ -96,7 +96,7 @@ namespace KRE
 				<< " > " 
 				<< size_);
 			glBufferSubData(GL_ARRAY_BUFFER, offset, size, value);
-			size_ = size + offset;
+			size_ = std::max(size_, size + offset);
 		}
 		glBindBuffer(GL_ARRAY_BUFFER, 0);
 	}
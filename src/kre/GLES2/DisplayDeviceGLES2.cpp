@@ -104,6 +104,21 @@ namespace KRE
 			return GL_NONE;
 		}
 
+		// Moves the per-instance attributes along to start at instance first, for drawing one
+		// multi-draw range of an instanced attribute set.
+		void apply_instance_attributes(const ShaderProgramPtr& shader, const AttributeSetPtr& as, int first)
+		{
+			for(auto& attr : as->getAttributes()) {
+				if(!attr->isEnabled() || attr->getAttrDesc().empty() || attr->getAttrDesc().front().getDivisor() == 0) {
+					continue;
+				}
+				const ptrdiff_t offset = attr->getOffset();
+				attr->setOffset(offset + first * attr->getAttrDesc().front().getStride());
+				shader->applyAttribute(attr);
+				attr->setOffset(offset);
+			}
+		}
+
 		static const StencilSettings keep_stencil_settings(true,
 			StencilFace::FRONT_AND_BACK, 
 			StencilFunc::EQUAL, 
@@ -121,9 +136,11 @@ namespace KRE
 		  have_render_to_texture_(false),
 		  npot_textures_(false),
 		  hardware_uniform_buffers_(false),
+		  instanced_arrays_(false),
 		  major_version_(0),
 		  minor_version_(0),
-		  max_texture_units_(-1)
+		  max_texture_units_(-1),
+		  max_texture_size_(-1)
 	{
 	}
 
@@ -153,11 +170,29 @@ namespace KRE
 		npot_textures_ = extensions_.find("GL_ARB_texture_non_power_of_two") != extensions_.end();
 		hardware_uniform_buffers_ = extensions_.find("GL_ARB_uniform_buffer_object") != extensions_.end();
 
+		auto& iaf = GLESv2::get_instanced_array_functions();
+		for(const std::string suffix : { "EXT", "ANGLE" }) {
+			if(extensions_.find("GL_" + suffix + "_instanced_arrays") == extensions_.end()) {
+				continue;
+			}
+			iaf.vertex_attrib_divisor = reinterpret_cast<decltype(iaf.vertex_attrib_divisor)>(SDL_GL_GetProcAddress(("glVertexAttribDivisor" + suffix).c_str()));
+			iaf.draw_arrays_instanced = reinterpret_cast<decltype(iaf.draw_arrays_instanced)>(SDL_GL_GetProcAddress(("glDrawArraysInstanced" + suffix).c_str()));
+			iaf.draw_elements_instanced = reinterpret_cast<decltype(iaf.draw_elements_instanced)>(SDL_GL_GetProcAddress(("glDrawElementsInstanced" + suffix).c_str()));
+			instanced_arrays_ = iaf.vertex_attrib_divisor != nullptr && iaf.draw_arrays_instanced != nullptr && iaf.draw_elements_instanced != nullptr;
+			if(instanced_arrays_) {
+				break;
+			}
+		}
+
 		GLenum err = GL_NONE;
 		glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &max_texture_units_);
 		if((err = glGetError()) != GL_NONE) {
 			LOG_ERROR("Failed query for GL_MAX_TEXTURE_IMAGE_UNITS: 0x" << std::hex << err);
 		}
+		glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_texture_size_);
+		if((err = glGetError()) != GL_NONE) {
+			LOG_ERROR("Failed query for GL_MAX_TEXTURE_SIZE: 0x" << std::hex << err);
+		}
 		const char* version_str = reinterpret_cast<const char*>(glGetString(GL_VERSION));
 		if(version_str != NULL) {
 			std::stringstream ss(version_str);
@@ -209,6 +244,7 @@ namespace KRE
 		switch (param)
 		{
 		case DisplayDeviceParameters::MAX_TEXTURE_UNITS:	return max_texture_units_;
+		case DisplayDeviceParameters::MAX_TEXTURE_SIZE:		return max_texture_size_;
 		default: break;
 		}
 		ASSERT_LOG(false, "Invalid Parameter requested: " << static_cast<int>(param));
@@ -414,15 +450,27 @@ namespace KRE
 			}
 
 			if(as->isInstanced()) {
-				if(as->isIndexed()) {
-					as->bindIndex();
-					// XXX as->GetIndexArray() should be as->GetIndexArray()+as->GetOffset()
-					//glDrawElementsInstanced(draw_mode, static_cast<GLsizei>(as->getCount()), convert_index_type(as->getIndexType()), as->getIndexArray(), as->getInstanceCount());
-					LOG_ERROR("TODO: emulate glDrawElementsInstanced for GLESv2");
-					as->unbindIndex();
+				const auto& iaf = GLESv2::get_instanced_array_functions();
+				if(iaf.draw_arrays_instanced == nullptr) {
+					LOG_ERROR("Instanced draws need GL_EXT_instanced_arrays or GL_ANGLE_instanced_arrays, check for DisplayDeviceCapabilties::INSTANCED_ARRAYS.");
 				} else {
-					//glDrawArraysInstanced(draw_mode, static_cast<GLint>(as->getOffset()), static_cast<GLsizei>(as->getCount()), as->getInstanceCount());
-					LOG_ERROR("TODO: emulate glDrawElementsInstanced for GLESv2");
+					// Multi-draw ranges on an instanced set are ranges of instances, drawn one at a time.
+					const int draws = as->isMultiDrawEnabled() ? as->getMultiDrawCount() : 1;
+					for(int n = 0; n != draws; ++n) {
+						GLsizei instance_count = as->getInstanceCount();
+						if(as->isMultiDrawEnabled()) {
+							apply_instance_attributes(shader, as, as->getMultiOffsetArray()[n]);
+							instance_count = as->getMultiCountArray()[n];
+						}
+						if(as->isIndexed()) {
+							as->bindIndex();
+							// XXX as->GetIndexArray() should be as->GetIndexArray()+as->GetOffset()
+							iaf.draw_elements_instanced(draw_mode, static_cast<GLsizei>(as->getCount()), convert_index_type(as->getIndexType()), as->getIndexArray(), instance_count);
+							as->unbindIndex();
+						} else {
+							iaf.draw_arrays_instanced(draw_mode, static_cast<GLint>(as->getOffset()), static_cast<GLsizei>(as->getCount()), instance_count);
+						}
+					}
 				}
 			} else {
 				if(as->isIndexed()) {
@@ -576,6 +624,8 @@ namespace KRE
 			return true;
 		case DisplayDeviceCapabilties::UNIFORM_BUFFERS:
 			return hardware_uniform_buffers_;
+		case DisplayDeviceCapabilties::INSTANCED_ARRAYS:
+			return instanced_arrays_;
 		default:
 			ASSERT_LOG(false, "Unknown value for DisplayDeviceCapabilties given.");
 		}
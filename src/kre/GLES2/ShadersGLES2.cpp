@@ -614,7 +614,8 @@ namespace KRE
 			  u_palette_map_(-1),
 			  u_mix_palettes_(-1),
 			  u_mix_(-1),
-			  enabled_attribs_()
+			  enabled_attribs_(),
+			  divisor_attribs_()
 		{
 			init(name, vs, fs);
 		}
@@ -648,7 +649,8 @@ namespace KRE
 			  u_palette_map_(-1),
 			  u_mix_palettes_(-1),
 			  u_mix_(-1),
-			  enabled_attribs_()
+			  enabled_attribs_(),
+			  divisor_attribs_()
 		{
 			std::vector<Shader> shader_programs;
 			for(auto& sd : shader_data) {
@@ -1327,10 +1329,18 @@ namespace KRE
 			}*/
 		}
 
+		InstancedArrayFunctions& get_instanced_array_functions()
+		{
+			static InstancedArrayFunctions res;
+			return res;
+		}
+
 		void ShaderProgram::applyAttribute(AttributeBasePtr attr) 
 		{
 			auto attr_hw = attr->getDeviceBufferData();
 			attr_hw->bind();
+			// Divisors only apply to instanced draws, elsewhere every attribute is per-vertex.
+			const bool instanced = attr->getParent()->isInstanced();
 			for(auto& attrdesc : attr->getAttrDesc()) {
 				auto loc = attrdesc.getLocation();
 				glEnableVertexAttribArray(loc);					
@@ -1341,6 +1351,11 @@ namespace KRE
 					static_cast<GLsizei>(attrdesc.getStride()), 
 					reinterpret_cast<const GLvoid*>(attr_hw->value() + attr->getOffset() + attrdesc.getOffset()));
 				enabled_attribs_.emplace_back(loc);
+				if(instanced && attrdesc.getDivisor() != 0) {
+					ASSERT_LOG(get_instanced_array_functions().vertex_attrib_divisor != nullptr, "Instanced attributes need GL_EXT_instanced_arrays or GL_ANGLE_instanced_arrays.");
+					get_instanced_array_functions().vertex_attrib_divisor(loc, static_cast<GLuint>(attrdesc.getDivisor()));
+					divisor_attribs_.emplace_back(loc);
+				}
 			}
 		}
 
@@ -1366,6 +1381,10 @@ namespace KRE
 				glDisableVertexAttribArray(attrib);
 			}
 			enabled_attribs_.clear();
+			for(auto attrib : divisor_attribs_) {
+				get_instanced_array_functions().vertex_attrib_divisor(attrib, 0);
+			}
+			divisor_attribs_.clear();
 		}
 
 		void ShaderProgram::setUniformsForTexture(const TexturePtr& tex) const
@@ -68,6 +68,17 @@ namespace KRE
 
 		typedef std::pair<std::string,std::string> ShaderDef;
 
+		// Instancing isn't part of GLESv2, these are the entry points from GL_EXT_instanced_arrays or
+		// GL_ANGLE_instanced_arrays. They're null unless DisplayDeviceGLESv2::init() found one.
+		struct InstancedArrayFunctions
+		{
+			InstancedArrayFunctions() : vertex_attrib_divisor(nullptr), draw_arrays_instanced(nullptr), draw_elements_instanced(nullptr) {}
+			void (GL_APIENTRYP vertex_attrib_divisor)(GLuint index, GLuint divisor);
+			void (GL_APIENTRYP draw_arrays_instanced)(GLenum mode, GLint first, GLsizei count, GLsizei primcount);
+			void (GL_APIENTRYP draw_elements_instanced)(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei primcount);
+		};
+		InstancedArrayFunctions& get_instanced_array_functions();
+
 		typedef std::map<std::string, Actives> ActivesMap;
 
 		class ShaderProgram;
@@ -99,6 +110,7 @@ namespace KRE
 			void setUniformFromVariant(int uid, const variant& value) const override;
 
 			void makeActive() override;
+			unsigned id() const override { return object_; }
 
 			void configureActives(AttributeSetPtr attrset) override;
 			void configureAttribute(AttributeBasePtr attr) override;
@@ -177,6 +189,8 @@ namespace KRE
 			int u_mix_;
 
 			std::vector<GLuint> enabled_attribs_;
+			// Attributes with a divisor set for the current draw.
+			std::vector<GLuint> divisor_attribs_;
 		};
 	}
 }
@@ -0,0 +1,489 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "asserts.hpp"
+#include "JobSystem.hpp"
+#include "unit_test.hpp"
+
+namespace KRE
+{
+	namespace
+	{
+		// Worker count for JobSystem::getInstance(), -1 for one per hardware thread but one.
+		int instance_threads = -1;
+		std::atomic<bool> instance_created(false);
+	}
+
+	JobGroup::JobGroup()
+		: pending_(0),
+		  mutex_(),
+		  continuations_(),
+		  exception_()
+	{
+	}
+
+	JobGroup::~JobGroup()
+	{
+		// Waits for the job which finished the group to let go of it.
+		std::lock_guard<std::mutex> lock(mutex_);
+		ASSERT_LOG(pending_ == 0, "Job group destroyed with " << pending_ << " jobs still to finish.");
+	}
+
+	JobSystem::JobSystem(int threads)
+		: queues_(),
+		  main_queue_(),
+		  threads_(),
+		  thread_ids_(),
+		  main_thread_id_(std::this_thread::get_id()),
+		  queued_(0),
+		  main_queued_(0),
+		  sleep_mutex_(),
+		  wake_cv_(),
+		  stopping_(false)
+	{
+		ASSERT_LOG(threads >= 0, "Bad job system thread count: " << threads);
+		for(int n = 0; n != threads + 1; ++n) {
+			queues_.emplace_back(new Queue);
+		}
+		threads_.reserve(threads);
+		thread_ids_.reserve(threads);
+		for(int n = 0; n != threads; ++n) {
+			threads_.emplace_back(&JobSystem::workerLoop, this, n);
+			thread_ids_.emplace_back(threads_.back().get_id());
+		}
+	}
+
+	JobSystem::~JobSystem()
+	{
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex_);
+			stopping_ = true;
+		}
+		wake_cv_.notify_all();
+		for(auto& t : threads_) {
+			t.join();
+		}
+	}
+
+	JobSystem& JobSystem::getInstance()
+	{
+		instance_created = true;
+		static JobSystem res(instance_threads >= 0 ? instance_threads : std::max(1U, std::thread::hardware_concurrency()) - 1);
+		return res;
+	}
+
+	void JobSystem::setInstanceThreadCount(int threads)
+	{
+		ASSERT_LOG(!instance_created, "JobSystem::setInstanceThreadCount() called after the job system was created.");
+		ASSERT_LOG(threads >= 0, "Bad job system thread count: " << threads);
+		instance_threads = threads;
+	}
+
+	int JobSystem::getQueueIndex() const
+	{
+		const auto id = std::this_thread::get_id();
+		for(int n = 0; n != static_cast<int>(thread_ids_.size()); ++n) {
+			if(thread_ids_[n] == id) {
+				return n;
+			}
+		}
+		return static_cast<int>(thread_ids_.size());
+	}
+
+	void JobSystem::run(JobGroup& group, Job job)
+	{
+		++group.pending_;
+		push(Task(std::move(job), &group), false);
+	}
+
+	void JobSystem::runOnMainThread(JobGroup& group, Job job)
+	{
+		++group.pending_;
+		push(Task(std::move(job), &group), true);
+	}
+
+	void JobSystem::runAfter(JobGroup& dependency, JobGroup& group, Job job, bool main_thread)
+	{
+		ASSERT_LOG(&dependency != &group, "A job group can't depend on itself.");
+		++group.pending_;
+		std::exception_ptr failed;
+		{
+			std::lock_guard<std::mutex> lock(dependency.mutex_);
+			if(!dependency.done()) {
+				JobGroup::Continuation c = { std::move(job), &group, main_thread };
+				dependency.continuations_.emplace_back(std::move(c));
+				return;
+			}
+			failed = dependency.exception_;
+		}
+		if(failed) {
+			{
+				std::lock_guard<std::mutex> lock(group.mutex_);
+				if(!group.exception_) {
+					group.exception_ = failed;
+				}
+			}
+			finish(&group);
+			return;
+		}
+		push(Task(std::move(job), &group), main_thread);
+	}
+
+	void JobSystem::parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& fn)
+	{
+		const int count = end - begin;
+		if(count <= 0) {
+			return;
+		}
+		if(grain <= 0) {
+			const int pieces = 4 * (getThreadCount() + 1);
+			grain = std::max(1, (count + pieces - 1) / pieces);
+		}
+		JobGroup group;
+		for(int n = begin; n < end; n += grain) {
+			const int n2 = std::min(end, n + grain);
+			if(n2 == end) {
+				// The last piece is run here rather than waiting idle.
+				++group.pending_;
+				Task task([&fn, n, n2]() { fn(n, n2); }, &group);
+				execute(task);
+				break;
+			}
+			run(group, [&fn, n, n2]() { fn(n, n2); });
+		}
+		wait(group);
+	}
+
+	void JobSystem::wait(JobGroup& group)
+	{
+		const int index = getQueueIndex();
+		const bool main_thread = isMainThread();
+		while(!group.done()) {
+			if(main_thread && runMainThreadJob()) {
+				continue;
+			}
+			if(!runOne(index)) {
+				std::this_thread::yield();
+			}
+		}
+		std::exception_ptr e;
+		{
+			std::lock_guard<std::mutex> lock(group.mutex_);
+			e = group.exception_;
+			group.exception_ = nullptr;
+		}
+		if(e) {
+			std::rethrow_exception(e);
+		}
+	}
+
+	void JobSystem::runMainThreadJobs()
+	{
+		ASSERT_LOG(isMainThread(), "JobSystem::runMainThreadJobs() called from another thread.");
+		while(runMainThreadJob()) {
+		}
+	}
+
+	void JobSystem::push(Task task, bool main_thread)
+	{
+		if(main_thread) {
+			std::lock_guard<std::mutex> lock(main_queue_.mutex);
+			main_queue_.tasks.emplace_back(std::move(task));
+			++main_queued_;
+			return;
+		}
+		Queue& q = *queues_[getQueueIndex()];
+		{
+			std::lock_guard<std::mutex> lock(q.mutex);
+			q.tasks.emplace_back(std::move(task));
+		}
+		++queued_;
+		// Taking the lock means a worker can't miss the notification between checking for
+		// work and going to sleep.
+		{
+			std::lock_guard<std::mutex> lock(sleep_mutex_);
+		}
+		wake_cv_.notify_one();
+	}
+
+	void JobSystem::execute(Task& task)
+	{
+		try {
+			task.job();
+		} catch(...) {
+			std::lock_guard<std::mutex> lock(task.group->mutex_);
+			if(!task.group->exception_) {
+				task.group->exception_ = std::current_exception();
+			}
+		}
+		finish(task.group);
+	}
+
+	void JobSystem::finish(JobGroup* group)
+	{
+		std::vector<JobGroup::Continuation> next;
+		std::exception_ptr failed;
+		{
+			std::lock_guard<std::mutex> lock(group->mutex_);
+			if(--group->pending_ == 0) {
+				next.swap(group->continuations_);
+				failed = group->exception_;
+			}
+		}
+		for(auto& c : next) {
+			if(failed) {
+				// The job depended on work which didn't complete, so its group fails too.
+				{
+					std::lock_guard<std::mutex> lock(c.group->mutex_);
+					if(!c.group->exception_) {
+						c.group->exception_ = failed;
+					}
+				}
+				finish(c.group);
+			} else {
+				push(Task(std::move(c.job), c.group), c.main_thread);
+			}
+		}
+	}
+
+	bool JobSystem::runOne(int index)
+	{
+		if(queued_ == 0) {
+			return false;
+		}
+		const int nqueues = static_cast<int>(queues_.size());
+		for(int n = 0; n != nqueues; ++n) {
+			Queue& q = *queues_[(index + n) % nqueues];
+			std::unique_lock<std::mutex> lock(q.mutex);
+			if(q.tasks.empty()) {
+				continue;
+			}
+			// Our own newest job is the one most likely to still be in the cache, other
+			// thread's oldest jobs are the ones they're least likely to want next.
+			Task task = n == 0 ? std::move(q.tasks.back()) : std::move(q.tasks.front());
+			if(n == 0) {
+				q.tasks.pop_back();
+			} else {
+				q.tasks.pop_front();
+			}
+			lock.unlock();
+			--queued_;
+			execute(task);
+			return true;
+		}
+		return false;
+	}
+
+	bool JobSystem::runMainThreadJob()
+	{
+		if(main_queued_ == 0) {
+			return false;
+		}
+		std::unique_lock<std::mutex> lock(main_queue_.mutex);
+		if(main_queue_.tasks.empty()) {
+			return false;
+		}
+		Task task = std::move(main_queue_.tasks.front());
+		main_queue_.tasks.pop_front();
+		lock.unlock();
+		--main_queued_;
+		execute(task);
+		return true;
+	}
+
+	void JobSystem::workerLoop(int index)
+	{
+		for(;;) {
+			if(runOne(index)) {
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(sleep_mutex_);
+			wake_cv_.wait(lock, [this]() { return stopping_ || queued_ > 0; });
+			if(stopping_ && queued_ == 0) {
+				return;
+			}
+		}
+	}
+}
+
+UNIT_TEST(job_system_contention)
+{
+	// Jobs started from several threads at once, some of them waiting on jobs of their own.
+	KRE::JobSystem js(4);
+	std::atomic<int> count(0);
+	KRE::JobGroup group;
+	for(int n = 0; n != 16; ++n) {
+		js.run(group, [&js, &count]() {
+			KRE::JobGroup inner;
+			for(int m = 0; m != 500; ++m) {
+				js.run(inner, [&count]() { ++count; });
+			}
+			js.wait(inner);
+		});
+	}
+	for(int m = 0; m != 500; ++m) {
+		js.run(group, [&count]() { ++count; });
+	}
+	js.wait(group);
+	CHECK_EQ(count, 16 * 500 + 500);
+}
+
+UNIT_TEST(job_system_parallel_for)
+{
+	KRE::JobSystem js(4);
+	for(int grain : { 0, 1, 13, 100000 }) {
+		std::vector<int> hits(10007);
+		js.parallelFor(0, static_cast<int>(hits.size()), grain, [&hits](int n1, int n2) {
+			for(int n = n1; n != n2; ++n) {
+				++hits[n];
+			}
+		});
+		CHECK_EQ(std::count(hits.begin(), hits.end(), 1), static_cast<int>(hits.size()));
+	}
+	bool called = false;
+	js.parallelFor(5, 5, 0, [&called](int, int) { called = true; });
+	CHECK_EQ(called, false);
+}
+
+UNIT_TEST(job_system_dependencies)
+{
+	KRE::JobSystem js(4);
+	std::atomic<int> count(0);
+	std::atomic<int> seen_by_second(-1);
+	std::atomic<int> seen_by_third(-1);
+	std::atomic<bool> third_on_main(false);
+	KRE::JobGroup first, second, third;
+	for(int n = 0; n != 200; ++n) {
+		js.run(first, [&count]() { ++count; });
+	}
+	js.runAfter(first, second, [&]() { seen_by_second = count.load(); ++count; });
+	js.runAfter(second, third, [&]() { 
+		seen_by_third = count.load(); 
+		third_on_main = js.isMainThread();
+	}, true);
+	js.wait(third);
+	CHECK_EQ(seen_by_second, 200);
+	CHECK_EQ(seen_by_third, 201);
+	CHECK_EQ(third_on_main, true);
+	CHECK_EQ(second.done(), true);
+
+	// A dependency which has already finished doesn't hold anything up.
+	js.runAfter(first, second, [&count]() { ++count; });
+	js.wait(second);
+	CHECK_EQ(count, 202);
+}
+
+UNIT_TEST(job_system_main_thread)
+{
+	KRE::JobSystem js(4);
+	std::atomic<int> on_main(0);
+	KRE::JobGroup group;
+	for(int n = 0; n != 50; ++n) {
+		js.run(group, [&]() {
+			js.runOnMainThread(group, [&]() {
+				if(js.isMainThread()) {
+					++on_main;
+				}
+			});
+		});
+	}
+	js.wait(group);
+	CHECK_EQ(on_main, 50);
+}
+
+UNIT_TEST(job_system_exceptions)
+{
+	KRE::JobSystem js(4);
+	std::atomic<int> count(0);
+	std::atomic<bool> dependent_ran(false);
+	KRE::JobGroup group, dependent;
+	for(int n = 0; n != 100; ++n) {
+		js.run(group, [&count, n]() {
+			if(n == 50) {
+				throw std::runtime_error("job failed");
+			}
+			++count;
+		});
+	}
+	js.runAfter(group, dependent, [&dependent_ran]() { dependent_ran = true; });
+	bool thrown = false;
+	try {
+		js.wait(group);
+	} catch(const std::runtime_error&) {
+		thrown = true;
+	}
+	CHECK_EQ(thrown, true);
+	CHECK_EQ(count, 99);
+	thrown = false;
+	try {
+		js.wait(dependent);
+	} catch(const std::runtime_error&) {
+		thrown = true;
+	}
+	CHECK_EQ(thrown, true);
+	CHECK_EQ(dependent_ran, false);
+
+	// The exception is only reported once, the group can be used again afterwards.
+	js.run(group, [&count]() { ++count; });
+	js.wait(group);
+	CHECK_EQ(count, 100);
+
+	thrown = false;
+	try {
+		js.parallelFor(0, 1000, 10, [](int n1, int n2) {
+			if(n2 == 1000) {
+				throw std::runtime_error("last piece failed");
+			}
+		});
+	} catch(const std::runtime_error&) {
+		thrown = true;
+	}
+	CHECK_EQ(thrown, true);
+}
+
+BENCHMARK(job_system_run)
+{
+	auto& js = KRE::JobSystem::getInstance();
+	KRE::JobGroup group;
+	int queued = 0;
+	BENCHMARK_LOOP {
+		js.run(group, []() {});
+		// Stops the queues growing without limit.
+		if(++queued == 1024) {
+			js.wait(group);
+			queued = 0;
+		}
+	}
+	js.wait(group);
+}
+
+BENCHMARK(job_system_parallel_for)
+{
+	auto& js = KRE::JobSystem::getInstance();
+	BENCHMARK_LOOP {
+		js.parallelFor(0, 64, 1, [](int, int) {});
+	}
+}
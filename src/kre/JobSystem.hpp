@@ -0,0 +1,147 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace KRE
+{
+	// Counts the jobs run in the group which haven't finished yet. It must outlive its jobs.
+	// If a job throws, the rest of the group still runs and JobSystem::wait() rethrows the
+	// first exception. Jobs started with runAfter() on a group which failed aren't run, their
+	// group fails with the same exception.
+	class JobGroup
+	{
+	public:
+		JobGroup();
+		~JobGroup();
+		bool done() const { return pending_ == 0; }
+	private:
+		JobGroup(const JobGroup&);
+		void operator=(const JobGroup&);
+
+		struct Continuation
+		{
+			std::function<void()> job;
+			JobGroup* group;
+			bool main_thread;
+		};
+
+		std::atomic<int> pending_;
+		// Guards exception_, continuations_ and the last decrement of pending_, so that a group isn't
+		// destroyed while the job finishing it is still using it.
+		std::mutex mutex_;
+		// Jobs to start once everything in the group has finished, see JobSystem::runAfter().
+		std::vector<Continuation> continuations_;
+		std::exception_ptr exception_;
+		friend class JobSystem;
+	};
+
+	// Pool of worker threads running short jobs. Each thread has its own queue, taking the
+	// newest job from it and stealing the oldest from the others when it's empty. Jobs run
+	// from threads outside the pool go in a shared queue. Jobs which have to run on the main
+	// thread, such as ones making GL calls, have a queue of their own.
+	class JobSystem
+	{
+	public:
+		typedef std::function<void()> Job;
+
+		// The calling thread is taken to be the main thread.
+		explicit JobSystem(int threads);
+		~JobSystem();
+
+		// Pool with a worker for each hardware thread other than the calling one, unless 
+		// setInstanceThreadCount() was called first. Must first be called from the main thread.
+		static JobSystem& getInstance();
+		// Number of workers for getInstance() to create the pool with. Must be called before 
+		// the pool is first used.
+		static void setInstanceThreadCount(int threads);
+
+		int getThreadCount() const { return static_cast<int>(threads_.size()); }
+		bool isMainThread() const { return std::this_thread::get_id() == main_thread_id_; }
+
+		void run(JobGroup& group, Job job);
+		// The job is run when the main thread next calls wait() or runMainThreadJobs().
+		void runOnMainThread(JobGroup& group, Job job);
+		// Starts the job once everything in dependency has finished. The job counts as part of
+		// group straight away.
+		void runAfter(JobGroup& dependency, JobGroup& group, Job job, bool main_thread=false);
+
+		// Calls fn(n1, n2) for consecutive ranges of at most grain items covering [begin, end),
+		// returning once they're all done. A grain of 0 splits the range into a few pieces for
+		// each thread.
+		void parallelFor(int begin, int end, int grain, const std::function<void(int, int)>& fn);
+
+		// Runs jobs from the queues until everything in the group has finished, then rethrows
+		// the first exception thrown by its jobs, if any.
+		void wait(JobGroup& group);
+		// Runs the jobs queued for the main thread, call once a frame from the main loop.
+		void runMainThreadJobs();
+	private:
+		JobSystem(const JobSystem&);
+		void operator=(const JobSystem&);
+
+		struct Task
+		{
+			Task(Job j, JobGroup* g) : job(std::move(j)), group(g) {}
+			Job job;
+			JobGroup* group;
+		};
+		struct Queue
+		{
+			std::mutex mutex;
+			std::deque<Task> tasks;
+		};
+
+		// Index of the calling thread's queue.
+		int getQueueIndex() const;
+		void push(Task task, bool main_thread);
+		void execute(Task& task);
+		void finish(JobGroup* group);
+		bool runOne(int index);
+		bool runMainThreadJob();
+		void workerLoop(int index);
+
+		// One queue per worker, then the shared one.
+		std::vector<std::unique_ptr<Queue>> queues_;
+		Queue main_queue_;
+		std::vector<std::thread> threads_;
+		std::vector<std::thread::id> thread_ids_;
+		std::thread::id main_thread_id_;
+		// Number of tasks in queues_, then in main_queue_.
+		std::atomic<int> queued_;
+		std::atomic<int> main_queued_;
+		std::mutex sleep_mutex_;
+		std::condition_variable wake_cv_;
+		bool stopping_;
+	};
+}
@@ -0,0 +1,557 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define PARTICLE_STORE_SSE2
+#endif
+
+#include "asserts.hpp"
+#include "ParticleStore.hpp"
+#include "unit_test.hpp"
+
+namespace KRE
+{
+	namespace Particles
+	{
+		namespace
+		{
+			// The operations the kernels need on a group of values. Each kernel is written once
+			// against these and is run over as many particles at a time as the instruction set 
+			// allows, then one at a time over whatever is left at the end.
+			struct ScalarLanes
+			{
+				typedef float value;
+				typedef bool mask;
+				static const size_t width = 1;
+				static value load(const float* p) { return *p; }
+				static void store(float* p, value v) { *p = v; }
+				static value set(float f) { return f; }
+				static value add(value a, value b) { return a + b; }
+				static value sub(value a, value b) { return a - b; }
+				static value mul(value a, value b) { return a * b; }
+				static value div(value a, value b) { return a / b; }
+				static value sqrt(value a) { return std::sqrt(a); }
+				static value min(value a, value b) { return a < b ? a : b; }
+				static value max(value a, value b) { return a > b ? a : b; }
+				static value truncate(value a) { return static_cast<float>(static_cast<int>(a)); }
+				static mask greater(value a, value b) { return a > b; }
+				static mask less(value a, value b) { return a < b; }
+				static mask greaterEqual(value a, value b) { return a >= b; }
+				static value select(mask m, value a, value b) { return m ? a : b; }
+				static bool any(mask m) { return m; }
+			};
+
+#if defined(__AVX__)
+			struct SimdLanes
+			{
+				typedef __m256 value;
+				typedef __m256 mask;
+				static const size_t width = 8;
+				static value load(const float* p) { return _mm256_loadu_ps(p); }
+				static void store(float* p, value v) { _mm256_storeu_ps(p, v); }
+				static value set(float f) { return _mm256_set1_ps(f); }
+				static value add(value a, value b) { return _mm256_add_ps(a, b); }
+				static value sub(value a, value b) { return _mm256_sub_ps(a, b); }
+				static value mul(value a, value b) { return _mm256_mul_ps(a, b); }
+				static value div(value a, value b) { return _mm256_div_ps(a, b); }
+				static value sqrt(value a) { return _mm256_sqrt_ps(a); }
+				static value min(value a, value b) { return _mm256_min_ps(a, b); }
+				static value max(value a, value b) { return _mm256_max_ps(a, b); }
+				static value truncate(value a) { return _mm256_round_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+				static mask greater(value a, value b) { return _mm256_cmp_ps(a, b, _CMP_GT_OQ); }
+				static mask less(value a, value b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+				static mask greaterEqual(value a, value b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+				static value select(mask m, value a, value b) { return _mm256_blendv_ps(b, a, m); }
+				static bool any(mask m) { return _mm256_movemask_ps(m) != 0; }
+			};
+#elif defined(PARTICLE_STORE_SSE2)
+			struct SimdLanes
+			{
+				typedef __m128 value;
+				typedef __m128 mask;
+				static const size_t width = 4;
+				static value load(const float* p) { return _mm_loadu_ps(p); }
+				static void store(float* p, value v) { _mm_storeu_ps(p, v); }
+				static value set(float f) { return _mm_set1_ps(f); }
+				static value add(value a, value b) { return _mm_add_ps(a, b); }
+				static value sub(value a, value b) { return _mm_sub_ps(a, b); }
+				static value mul(value a, value b) { return _mm_mul_ps(a, b); }
+				static value div(value a, value b) { return _mm_div_ps(a, b); }
+				static value sqrt(value a) { return _mm_sqrt_ps(a); }
+				static value min(value a, value b) { return _mm_min_ps(a, b); }
+				static value max(value a, value b) { return _mm_max_ps(a, b); }
+				static value truncate(value a) { return _mm_cvtepi32_ps(_mm_cvttps_epi32(a)); }
+				static mask greater(value a, value b) { return _mm_cmpgt_ps(a, b); }
+				static mask less(value a, value b) { return _mm_cmplt_ps(a, b); }
+				static mask greaterEqual(value a, value b) { return _mm_cmpge_ps(a, b); }
+				static value select(mask m, value a, value b) { return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b)); }
+				static bool any(mask m) { return _mm_movemask_ps(m) != 0; }
+			};
+#else
+			typedef ScalarLanes SimdLanes;
+#endif
+
+			// Particle n onwards, while there are at least a full group of them left.
+			// Returns the index of the first particle not processed.
+			template<typename L>
+			size_t integrate_lanes(float* const* f, size_t n, size_t size, float t, float velocity_scale, const float* max_velocity)
+			{
+				const typename L::value vt = L::set(t);
+				const typename L::value vs = L::set(velocity_scale);
+				for(; n + L::width <= size; n += L::width) {
+					typename L::value dx = L::load(f[ParticleStore::DIRECTION_X] + n);
+					typename L::value dy = L::load(f[ParticleStore::DIRECTION_Y] + n);
+					typename L::value dz = L::load(f[ParticleStore::DIRECTION_Z] + n);
+					const typename L::value v = L::load(f[ParticleStore::VELOCITY] + n);
+					if(max_velocity != nullptr) {
+						const typename L::value max_v = L::set(*max_velocity);
+						const typename L::value len = L::sqrt(L::add(L::add(L::mul(dx, dx), L::mul(dy, dy)), L::mul(dz, dz)));
+						const typename L::mask too_fast = L::greater(L::mul(v, len), max_v);
+						if(L::any(too_fast)) {
+							const typename L::value scale = L::select(too_fast, L::div(max_v, len), L::set(1.0f));
+							dx = L::mul(dx, scale);
+							dy = L::mul(dy, scale);
+							dz = L::mul(dz, scale);
+							L::store(f[ParticleStore::DIRECTION_X] + n, dx);
+							L::store(f[ParticleStore::DIRECTION_Y] + n, dy);
+							L::store(f[ParticleStore::DIRECTION_Z] + n, dz);
+						}
+					}
+					float* px = f[ParticleStore::POSITION_X] + n;
+					float* py = f[ParticleStore::POSITION_Y] + n;
+					float* pz = f[ParticleStore::POSITION_Z] + n;
+					L::store(px, L::add(L::load(px), L::mul(L::mul(L::mul(dx, v), vs), vt)));
+					L::store(py, L::add(L::load(py), L::mul(L::mul(L::mul(dy, v), vs), vt)));
+					L::store(pz, L::add(L::load(pz), L::mul(L::mul(L::mul(dz, v), vs), vt)));
+				}
+				return n;
+			}
+
+			template<typename L>
+			size_t time_to_live_lanes(float* ttl, size_t n, size_t size, float t, bool* expired)
+			{
+				const typename L::value vt = L::set(t);
+				const typename L::value zero = L::set(0.0f);
+				for(; n + L::width <= size; n += L::width) {
+					const typename L::value v = L::sub(L::load(ttl + n), vt);
+					L::store(ttl + n, v);
+					if(L::any(L::less(v, zero))) {
+						*expired = true;
+					}
+				}
+				return n;
+			}
+
+			template<typename L>
+			size_t life_fraction_lanes(const float* const* f, size_t n, size_t size, float* out)
+			{
+				const typename L::value one = L::set(1.0f);
+				for(; n + L::width <= size; n += L::width) {
+					const typename L::value ttl = L::load(f[ParticleStore::TIME_TO_LIVE] + n);
+					const typename L::value initial_ttl = L::load(f[ParticleStore::INITIAL_TIME_TO_LIVE] + n);
+					L::store(out + n, L::sub(one, L::div(ttl, initial_ttl)));
+				}
+				return n;
+			}
+
+			// Picks the same key as TimeColorAffector did for each particle, i.e. the last one 
+			// at or before the particle's life fraction (or the first one), and interpolates 
+			// towards the next, unless it's the last key.
+			template<typename L>
+			size_t color_lanes(float* const* f, size_t n, size_t size, const std::vector<std::pair<float, glm::vec4>>& keys, bool multiply)
+			{
+				const typename L::value one = L::set(1.0f);
+				const typename L::value zero = L::set(0.0f);
+				const typename L::value full = L::set(255.0f);
+				for(; n + L::width <= size; n += L::width) {
+					const typename L::value ttl = L::load(f[ParticleStore::TIME_TO_LIVE] + n);
+					const typename L::value initial_ttl = L::load(f[ParticleStore::INITIAL_TIME_TO_LIVE] + n);
+					const typename L::value fraction = L::sub(one, L::div(ttl, initial_ttl));
+					typename L::value c[4];
+					for(int i = 0; i != 4; ++i) {
+						c[i] = L::set(keys.back().second[i]);
+					}
+					if(keys.size() > 1) {
+						typename L::value lerped[4];
+						for(size_t k = 0; k + 1 < keys.size(); ++k) {
+							const float t1 = keys[k].first;
+							const float t2 = keys[k + 1].first;
+							const typename L::value a = L::div(L::sub(fraction, L::set(t1)), L::set(t2 - t1));
+							const typename L::mask in_segment = L::greaterEqual(fraction, L::set(t1));
+							for(int i = 0; i != 4; ++i) {
+								const float c1 = keys[k].second[i];
+								const float c2 = keys[k + 1].second[i];
+								const typename L::value v = L::add(L::set(c1), L::mul(L::set(c2 - c1), a));
+								lerped[i] = k == 0 ? v : L::select(in_segment, v, lerped[i]);
+							}
+						}
+						const typename L::mask before_last = L::less(fraction, L::set(keys.back().first));
+						for(int i = 0; i != 4; ++i) {
+							c[i] = L::select(before_last, lerped[i], c[i]);
+						}
+					}
+					for(int i = 0; i != 4; ++i) {
+						const typename L::value scale = multiply ? L::load(f[ParticleStore::INITIAL_COLOR_R + i] + n) : full;
+						const typename L::value v = L::truncate(L::min(L::max(L::mul(c[i], scale), zero), full));
+						L::store(f[ParticleStore::COLOR_R + i] + n, v);
+					}
+				}
+				return n;
+			}
+
+			template<typename L>
+			size_t scale_lanes(float* dim, const float* initial_dim, size_t n, size_t size, const float* scales, float scale, float factor)
+			{
+				const typename L::value zero = L::set(0.0f);
+				const typename L::value vfactor = L::set(factor);
+				const typename L::value vscale = L::set(scale);
+				for(; n + L::width <= size; n += L::width) {
+					const typename L::value s = scales != nullptr ? L::load(scales + n) : vscale;
+					const typename L::value value = L::mul(L::mul(L::load(initial_dim + n), s), vfactor);
+					L::store(dim + n, L::select(L::greater(value, zero), value, L::load(dim + n)));
+				}
+				return n;
+			}
+		}
+
+		ParticleStore::ParticleStore()
+			: cold_()
+		{
+		}
+
+		void ParticleStore::reserve(size_t n)
+		{
+			for(auto& field : fields_) {
+				field.reserve(n);
+			}
+			cold_.reserve(n);
+		}
+
+		void ParticleStore::clear()
+		{
+			for(auto& field : fields_) {
+				field.clear();
+			}
+			cold_.clear();
+		}
+
+		void ParticleStore::add(const Particle& p)
+		{
+			for(auto& field : fields_) {
+				field.push_back(0.0f);
+			}
+			cold_.emplace_back();
+			set(size() - 1, p);
+		}
+
+		Particle ParticleStore::get(size_t n) const
+		{
+			ASSERT_LOG(n < size(), "Particle index out of range: " << n << " >= " << size());
+			Particle p;
+			p.current.position = glm::vec3(fields_[POSITION_X][n], fields_[POSITION_Y][n], fields_[POSITION_Z][n]);
+			p.current.direction = glm::vec3(fields_[DIRECTION_X][n], fields_[DIRECTION_Y][n], fields_[DIRECTION_Z][n]);
+			p.current.dimensions = glm::vec3(fields_[DIMENSIONS_X][n], fields_[DIMENSIONS_Y][n], fields_[DIMENSIONS_Z][n]);
+			p.current.color = color_vector(static_cast<unsigned char>(fields_[COLOR_R][n]), 
+				static_cast<unsigned char>(fields_[COLOR_G][n]), 
+				static_cast<unsigned char>(fields_[COLOR_B][n]), 
+				static_cast<unsigned char>(fields_[COLOR_A][n]));
+			p.current.velocity = fields_[VELOCITY][n];
+			p.current.mass = fields_[MASS][n];
+			p.current.time_to_live = fields_[TIME_TO_LIVE][n];
+			p.current.orientation = cold_[n].orientation;
+
+			p.initial.position = cold_[n].initial_position;
+			p.initial.direction = glm::vec3(fields_[INITIAL_DIRECTION_X][n], fields_[INITIAL_DIRECTION_Y][n], fields_[INITIAL_DIRECTION_Z][n]);
+			p.initial.dimensions = glm::vec3(fields_[INITIAL_DIMENSIONS_X][n], fields_[INITIAL_DIMENSIONS_Y][n], fields_[INITIAL_DIMENSIONS_Z][n]);
+			p.initial.color = color_vector(static_cast<unsigned char>(fields_[INITIAL_COLOR_R][n]), 
+				static_cast<unsigned char>(fields_[INITIAL_COLOR_G][n]), 
+				static_cast<unsigned char>(fields_[INITIAL_COLOR_B][n]), 
+				static_cast<unsigned char>(fields_[INITIAL_COLOR_A][n]));
+			p.initial.velocity = cold_[n].initial_velocity;
+			p.initial.mass = cold_[n].initial_mass;
+			p.initial.time_to_live = fields_[INITIAL_TIME_TO_LIVE][n];
+			p.initial.orientation = cold_[n].initial_orientation;
+
+			p.emitted_by = cold_[n].emitted_by;
+			return p;
+		}
+
+		void ParticleStore::set(size_t n, const Particle& p)
+		{
+			ASSERT_LOG(n < size(), "Particle index out of range: " << n << " >= " << size());
+			for(int i = 0; i != 3; ++i) {
+				fields_[POSITION_X + i][n] = p.current.position[i];
+				fields_[DIRECTION_X + i][n] = p.current.direction[i];
+				fields_[DIMENSIONS_X + i][n] = p.current.dimensions[i];
+				fields_[INITIAL_DIRECTION_X + i][n] = p.initial.direction[i];
+				fields_[INITIAL_DIMENSIONS_X + i][n] = p.initial.dimensions[i];
+			}
+			for(int i = 0; i != 4; ++i) {
+				fields_[COLOR_R + i][n] = p.current.color[i];
+				fields_[INITIAL_COLOR_R + i][n] = p.initial.color[i];
+			}
+			fields_[VELOCITY][n] = p.current.velocity;
+			fields_[MASS][n] = p.current.mass;
+			fields_[TIME_TO_LIVE][n] = p.current.time_to_live;
+			fields_[INITIAL_TIME_TO_LIVE][n] = p.initial.time_to_live;
+
+			ColdParameters& cold = cold_[n];
+			cold.orientation = p.current.orientation;
+			cold.initial_orientation = p.initial.orientation;
+			cold.initial_position = p.initial.position;
+			cold.initial_velocity = p.initial.velocity;
+			cold.initial_mass = p.initial.mass;
+			cold.emitted_by = p.emitted_by;
+		}
+
+		void ParticleStore::integrate(float t, float velocity_scale, const float* max_velocity)
+		{
+			float* f[FIELD_COUNT];
+			for(int i = 0; i != FIELD_COUNT; ++i) {
+				f[i] = fields_[i].data();
+			}
+			size_t n = integrate_lanes<SimdLanes>(f, 0, size(), t, velocity_scale, max_velocity);
+			integrate_lanes<ScalarLanes>(f, n, size(), t, velocity_scale, max_velocity);
+		}
+
+		void ParticleStore::updateTimeToLive(float t)
+		{
+			std::vector<float>& ttl = fields_[TIME_TO_LIVE];
+			bool expired = false;
+			size_t done = time_to_live_lanes<SimdLanes>(ttl.data(), 0, ttl.size(), t, &expired);
+			time_to_live_lanes<ScalarLanes>(ttl.data(), done, ttl.size(), t, &expired);
+			if(!expired) {
+				return;
+			}
+
+			// Compact each array in turn, leaving the times to live, which say what to keep, until last.
+			const size_t first = std::find_if(ttl.begin(), ttl.end(), [](float v) { return v < 0.0f; }) - ttl.begin();
+			size_t kept = first;
+			for(int i = 0; i != FIELD_COUNT; ++i) {
+				if(i == TIME_TO_LIVE) {
+					continue;
+				}
+				std::vector<float>& field = fields_[i];
+				kept = first;
+				for(size_t n = first; n != ttl.size(); ++n) {
+					if(!(ttl[n] < 0.0f)) {
+						field[kept++] = field[n];
+					}
+				}
+				field.resize(kept);
+			}
+			kept = first;
+			for(size_t n = first; n != ttl.size(); ++n) {
+				if(!(ttl[n] < 0.0f)) {
+					cold_[kept++] = cold_[n];
+				}
+			}
+			cold_.resize(kept);
+			ttl.erase(std::remove_if(ttl.begin() + first, ttl.end(), [](float v) { return v < 0.0f; }), ttl.end());
+		}
+
+		void ParticleStore::getLifeFractions(float* out) const
+		{
+			const float* f[FIELD_COUNT];
+			for(int i = 0; i != FIELD_COUNT; ++i) {
+				f[i] = fields_[i].data();
+			}
+			size_t n = life_fraction_lanes<SimdLanes>(f, 0, size(), out);
+			life_fraction_lanes<ScalarLanes>(f, n, size(), out);
+		}
+
+		void ParticleStore::interpolateColors(const std::vector<std::pair<float, glm::vec4>>& keys, bool multiply)
+		{
+			ASSERT_LOG(!keys.empty(), "No colors to interpolate between.");
+			float* f[FIELD_COUNT];
+			for(int i = 0; i != FIELD_COUNT; ++i) {
+				f[i] = fields_[i].data();
+			}
+			size_t n = color_lanes<SimdLanes>(f, 0, size(), keys, multiply);
+			color_lanes<ScalarLanes>(f, n, size(), keys, multiply);
+		}
+
+		void ParticleStore::scaleDimension(Field dim, Field initial_dim, const float* scales, float scale, float factor)
+		{
+			float* d = fields_[dim].data();
+			const float* id = fields_[initial_dim].data();
+			size_t n = scale_lanes<SimdLanes>(d, id, 0, size(), scales, scale, factor);
+			scale_lanes<ScalarLanes>(d, id, n, size(), scales, scale, factor);
+		}
+	}
+}
+
+namespace
+{
+	using namespace KRE::Particles;
+
+	typedef std::vector<std::pair<float, glm::vec4>> color_keys;
+
+	// One frame of the updates Technique and the color and scale affectors made to a 
+	// std::vector<Particle> before the store, to time the store against. The scale parameter 
+	// is 1 + the fraction of the particle's life. The affectors themselves are checked against 
+	// their internalApply() in ParticleSystemAffectors.cpp.
+	void update_particle_vector(std::vector<Particle>& particles, float t, float max_velocity, const color_keys& keys)
+	{
+		for(auto& p : particles) {
+			p.current.time_to_live -= t;
+		}
+		particles.erase(std::remove_if(particles.begin(), particles.end(), 
+			[](const Particle& p) { return p.current.time_to_live < 0.0f; }), 
+			particles.end());
+		for(auto& p : particles) {
+			if(p.current.velocity*glm::length(p.current.direction) > max_velocity) {
+				p.current.direction *= max_velocity / glm::length(p.current.direction);
+			}
+			p.current.position += p.current.direction * p.current.velocity * 1.0f * t;
+		}
+		for(auto& p : particles) {
+			const float fraction = 1.0f - p.current.time_to_live / p.initial.time_to_live;
+			auto it1 = keys.begin();
+			while(it1 + 1 != keys.end() && (it1 + 1)->first <= fraction) {
+				++it1;
+			}
+			auto it2 = it1 + 1;
+			glm::vec4 c = it1->second;
+			if(it2 != keys.end()) {
+				c = it1->second + ((it2->second - it1->second) * ((fraction - it1->first)/(it2->first - it1->first)));
+			}
+			p.current.color = color_vector(color_vector::value_type(c.r*255.0f), 
+				color_vector::value_type(c.g*255.0f), 
+				color_vector::value_type(c.b*255.0f), 
+				color_vector::value_type(c.a*255.0f));
+		}
+		for(auto& p : particles) {
+			const float scale = 1.0f + (1.0f - p.current.time_to_live / p.initial.time_to_live);
+			for(int i = 0; i != 3; ++i) {
+				const float value = p.initial.dimensions[i] * scale * 1.0f;
+				if(value > 0) {
+					p.current.dimensions[i] = value;
+				}
+			}
+		}
+	}
+
+	void update_particle_store(ParticleStore& store, float t, float max_velocity, const color_keys& keys, std::vector<float>* scales)
+	{
+		store.updateTimeToLive(t);
+		store.integrate(t, 1.0f, &max_velocity);
+		store.interpolateColors(keys, false);
+		scales->resize(store.size());
+		store.getLifeFractions(scales->data());
+		for(auto& s : *scales) {
+			s = 1.0f + s;
+		}
+		for(int i = 0; i != 3; ++i) {
+			store.scaleDimension(static_cast<ParticleStore::Field>(ParticleStore::DIMENSIONS_X + i), 
+				static_cast<ParticleStore::Field>(ParticleStore::INITIAL_DIMENSIONS_X + i), 
+				scales->data(), 1.0f, 1.0f);
+		}
+	}
+
+	Particle make_test_particle(int n, float time_to_live)
+	{
+		Particle p;
+		init_physics_parameters(p.initial);
+		p.initial.position = glm::vec3(n * 0.5f, n * -0.25f, 1.0f);
+		p.initial.direction = glm::vec3(std::sin(n * 0.1f), std::cos(n * 0.1f), (n % 5) * 0.2f);
+		p.initial.dimensions = glm::vec3(1.0f + n % 3, 2.0f, n % 4 == 0 ? 0.0f : 0.5f);
+		p.initial.velocity = 50.0f + n % 100;
+		p.initial.time_to_live = time_to_live;
+		p.initial.color = color_vector(n % 256, 255, 128, 64);
+		p.current = p.initial;
+		p.current.time_to_live = time_to_live - (n % 7) * 0.1f;
+		return p;
+	}
+
+	const color_keys& test_color_keys()
+	{
+		static color_keys keys;
+		if(keys.empty()) {
+			keys.emplace_back(0.0f, glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+			keys.emplace_back(0.5f, glm::vec4(1.0f, 0.5f, 0.0f, 0.75f));
+			keys.emplace_back(0.8f, glm::vec4(0.25f, 0.0f, 0.0f, 0.0f));
+		}
+		return keys;
+	}
+}
+
+UNIT_TEST(particle_store_matches_particle_vector)
+{
+	// Only the fields Technique updates are compared, the colors and dimensions are covered 
+	// by particle_affectors_match_internal_apply.
+	// An odd count leaves some particles for the scalar tail of each kernel.
+	std::vector<Particle> particles;
+	ParticleStore store;
+	for(int n = 0; n != 1003; ++n) {
+		particles.emplace_back(make_test_particle(n, 0.2f + (n % 11) * 0.1f));
+		store.add(particles.back());
+	}
+	std::vector<float> scales;
+	for(int frame = 0; frame != 4; ++frame) {
+		update_particle_vector(particles, 0.15f, 80.0f, test_color_keys());
+		update_particle_store(store, 0.15f, 80.0f, test_color_keys(), &scales);
+		CHECK_EQ(store.size(), particles.size());
+		for(size_t n = 0; n != particles.size(); ++n) {
+			const Particle p = store.get(n);
+			const Particle& expected = particles[n];
+			CHECK(p.current.position == expected.current.position, "particle " << n << " position differs");
+			CHECK(p.current.direction == expected.current.direction, "particle " << n << " direction differs");
+			CHECK_EQ(p.current.time_to_live, expected.current.time_to_live);
+			CHECK(p.initial.position == expected.initial.position, "particle " << n << " initial position differs");
+		}
+	}
+	CHECK_GT(store.size(), 0);
+	CHECK_LT(store.size(), 1003);
+}
+
+BENCHMARK_ARG(particle_update, const std::string& layout)
+{
+	const int count = 100000;
+	std::vector<Particle> particles;
+	ParticleStore store;
+	for(int n = 0; n != count; ++n) {
+		// Long enough lived that none expire during the benchmark.
+		particles.emplace_back(make_test_particle(n, 1.0e6f));
+		store.add(particles.back());
+	}
+	std::vector<float> scales;
+	const bool soa = layout == "store";
+	test::reset_benchmark_timer();
+	BENCHMARK_LOOP {
+		if(soa) {
+			update_particle_store(store, 0.01f, 80.0f, test_color_keys(), &scales);
+		} else {
+			update_particle_vector(particles, 0.01f, 80.0f, test_color_keys());
+		}
+	}
+}
+
+BENCHMARK_ARG_CALL(particle_update, vector100k, "vector")
+BENCHMARK_ARG_CALL(particle_update, store100k, "store")
@@ -0,0 +1,131 @@
+/*
+	Copyright (C) 2013-2014 by Kristina Simpson <sweet.kristas@gmail.com>
+	
+	This software is provided 'as-is', without any express or implied
+	warranty. In no event will the authors be held liable for any damages
+	arising from the use of this software.
+
+	Permission is granted to anyone to use this software for any purpose,
+	including commercial applications, and to alter it and redistribute it
+	freely, subject to the following restrictions:
+
+	   1. The origin of this software must not be misrepresented; you must not
+	   claim that you wrote the original software. If you use this software
+	   in a product, an acknowledgement in the product documentation would be
+	   appreciated but is not required.
+
+	   2. Altered source versions must be plainly marked as such, and must not be
+	   misrepresented as being the original software.
+
+	   3. This notice may not be removed or altered from any source
+	   distribution.
+*/
+
+#pragma once
+
+#include <utility>
+#include <vector>
+
+#include "ParticleSystemFwd.hpp"
+
+namespace KRE
+{
+	namespace Particles
+	{
+		typedef glm::tvec4<unsigned char> color_vector;
+
+		struct PhysicsParameters
+		{
+			glm::vec3 position;
+			color_vector color;
+			glm::vec3 dimensions;
+			float time_to_live;
+			float mass;
+			float velocity;
+			glm::vec3 direction;
+			glm::quat orientation;
+		};
+
+		void init_physics_parameters(PhysicsParameters& pp); 
+
+		// This structure should be POD (i.e. plain old data)
+		struct Particle
+		{
+			Particle() : emitted_by(nullptr) {}
+			PhysicsParameters current;
+			PhysicsParameters initial;
+			// Still wavering over whether this should be std::weak_ptr<Emitter>
+			Emitter* emitted_by;
+		};
+
+		// Active particles of a technique, stored as a structure of arrays. The fields which are 
+		// updated every frame each get their own array so the kernels below can work through them
+		// several particles at a time with SSE/AVX. Everything else is kept together per particle.
+		// Particles can be copied in and out as a Particle for code which works on one at a time.
+		class ParticleStore
+		{
+		public:
+			enum Field {
+				POSITION_X, POSITION_Y, POSITION_Z,
+				DIRECTION_X, DIRECTION_Y, DIRECTION_Z,
+				DIMENSIONS_X, DIMENSIONS_Y, DIMENSIONS_Z,
+				COLOR_R, COLOR_G, COLOR_B, COLOR_A,
+				VELOCITY,
+				MASS,
+				TIME_TO_LIVE,
+				INITIAL_DIRECTION_X, INITIAL_DIRECTION_Y, INITIAL_DIRECTION_Z,
+				INITIAL_DIMENSIONS_X, INITIAL_DIMENSIONS_Y, INITIAL_DIMENSIONS_Z,
+				INITIAL_COLOR_R, INITIAL_COLOR_G, INITIAL_COLOR_B, INITIAL_COLOR_A,
+				INITIAL_TIME_TO_LIVE,
+				FIELD_COUNT,
+			};
+
+			ParticleStore();
+
+			size_t size() const { return fields_[POSITION_X].size(); }
+			bool empty() const { return size() == 0; }
+			void reserve(size_t n);
+			void clear();
+
+			void add(const Particle& p);
+			Particle get(size_t n) const;
+			void set(size_t n, const Particle& p);
+			Emitter* getEmittedBy(size_t n) const { return cold_[n].emitted_by; }
+
+			// Colors are held as floats in the range 0 to 255.
+			float* getField(Field f) { return fields_[f].data(); }
+			const float* getField(Field f) const { return fields_[f].data(); }
+			glm::quat& getOrientation(size_t n) { return cold_[n].orientation; }
+
+			// Moves particles along their direction, limiting the speed to max_velocity if it 
+			// isn't null.
+			void integrate(float t, float velocity_scale, const float* max_velocity);
+			// Decrements the time to live of particles, removing the ones which expire. The order
+			// of the remaining particles is kept.
+			void updateTimeToLive(float t);
+			// Writes how far through its life each particle is, from 0 to 1, to out.
+			void getLifeFractions(float* out) const;
+			// Sets the color of each particle from the color keys, which are sorted by the fraction
+			// of the particle's life they apply at. The result is multiplied by the initial color
+			// if multiply is set.
+			void interpolateColors(const std::vector<std::pair<float, glm::vec4>>& keys, bool multiply);
+			// Sets dim to initial_dim*scale*factor for each particle where that is positive. The 
+			// scale is taken from scales[n], or is the same for every particle if scales is null.
+			void scaleDimension(Field dim, Field initial_dim, const float* scales, float scale, float factor);
+		private:
+			// The fields which no kernel touches.
+			struct ColdParameters
+			{
+				glm::quat orientation;
+				glm::quat initial_orientation;
+				glm::vec3 initial_position;
+				float initial_velocity;
+				float initial_mass;
+				Emitter* emitted_by;
+			};
+
+			std::vector<float> fields_[FIELD_COUNT];
+			std::vector<ColdParameters> cold_;
+		};
+	}
+}
@@ -23,6 +23,7 @@
 
 #include <cmath>
 #include <chrono>
+#include <thread>
 
 #include "ParticleSystem.hpp"
 #include "ParticleSystemAffectors.hpp"
@@ -42,14 +43,24 @@ namespace KRE
 		{
 			SceneNodeRegistrar<ParticleSystemContainer> psc_register("particle_system_container");
 
+#if defined(_MSC_VER) && _MSC_VER < 1900
+			// VS2013 has no thread_local, __declspec(thread) only works for plain data.
+			__declspec(thread) std::default_random_engine* rng_engine = nullptr;
+#else
+			thread_local std::default_random_engine* rng_engine = nullptr;
+#endif
+
+			// Particle systems may be processed on several threads at once, so each thread has an
+			// engine of its own. They're created on first use and kept for the life of the thread,
+			// the job system's workers last as long as the program.
 			std::default_random_engine& get_rng_engine() 
 			{
-				static std::unique_ptr<std::default_random_engine> res;
-				if(res == nullptr) {
+				if(rng_engine == nullptr) {
 					auto seed = std::chrono::system_clock::now().time_since_epoch().count();
-					res.reset(new std::default_random_engine(std::default_random_engine::result_type(seed)));
+					seed ^= std::hash<std::thread::id>()(std::this_thread::get_id());
+					rng_engine = new std::default_random_engine(std::default_random_engine::result_type(seed));
 				}
-				return *res;
+				return *rng_engine;
 			}
 		}
 
@@ -435,19 +446,13 @@ namespace KRE
 				a->emitProcess(t);
 			}
 
-			// Decrement the ttl on particles
-			for(auto& p : active_particles_) {
-				p.current.time_to_live -= t;
-			}
+			// Decrement the ttl on particles and kill end-of-life particles
+			active_particles_.updateTimeToLive(t);
 
 			for(auto& e : active_emitters_) {
 				e->current.time_to_live -= t;
 			}
 
-			// Kill end-of-life particles
-			active_particles_.erase(std::remove_if(active_particles_.begin(), active_particles_.end(),
-				[](decltype(active_particles_[0]) p){return p.current.time_to_live < 0.0f;}), 
-				active_particles_.end());
 			// Kill end-of-life emitters
 			active_emitters_.erase(std::remove_if(active_emitters_.begin(), active_emitters_.end(),
 				[](decltype(active_emitters_[0]) e){return e->current.time_to_live < 0.0f;}), 
@@ -474,17 +479,9 @@ namespace KRE
 			}*/
 
 			// update particle positions
-			for(auto& p : active_particles_) {
-				if(max_velocity_ && p.current.velocity*glm::length(p.current.direction) > *max_velocity_) {
-					p.current.direction *= *max_velocity_ / glm::length(p.current.direction);
-				}
-
-				p.current.position += p.current.direction * p.current.velocity * getParticleSystem()->getScaleVelocity() * t;
-
-				//std::cerr << p << std::endl;
-			}
+			active_particles_.integrate(t, getParticleSystem()->getScaleVelocity(), max_velocity_.get());
 			//if(active_particles_.size() > 0) {
-			//	std::cerr << active_particles_[0] << std::endl;
+			//	std::cerr << active_particles_.get(0) << std::endl;
 			//}
 
 			//std::cerr << "XXX: " << name() << " Active Particle Count: " << active_particles_.size() << std::endl;
@@ -526,22 +523,28 @@ namespace KRE
 			//LOG_DEBUG("Technique::preRender, particle count: " << active_particles_.size());
 			std::vector<vertex_texture_color3> vtc;
 			vtc.reserve(active_particles_.size() * 6);
-			for(auto& p : active_particles_) {
-				/*vtc.emplace_back(glm::vec3(p.current.position.x,p.current.position.y,p.current.position.z), glm::vec2(0.0f,0.0f), p.current.color);
-				vtc.emplace_back(glm::vec3(p.current.position.x,p.current.position.y+p.current.dimensions.y,p.current.position.z), glm::vec2(0.0f,1.0f), p.current.color);
-				vtc.emplace_back(glm::vec3(p.current.position.x+p.current.dimensions.x,p.current.position.y,p.current.position.z), glm::vec2(1.0f,0.0f), p.current.color);
-
-				vtc.emplace_back(glm::vec3(p.current.position.x+p.current.dimensions.x,p.current.position.y,p.current.position.z), glm::vec2(1.0f,0.0f), p.current.color);
-				vtc.emplace_back(glm::vec3(p.current.position.x,p.current.position.y+p.current.dimensions.y,p.current.position.z), glm::vec2(0.0f,1.0f), p.current.color);
-				vtc.emplace_back(glm::vec3(p.current.position.x+p.current.dimensions.x,p.current.position.y+p.current.dimensions.y,p.current.position.z), glm::vec2(1.0f,1.0f), p.current.color);*/
-
-				vtc.emplace_back(glm::vec3(p.current.position.x-p.current.dimensions.x/2,p.current.position.y-p.current.dimensions.y/2,p.current.position.z), glm::vec2(0.0f,0.0f), p.current.color);
-				vtc.emplace_back(glm::vec3(p.current.position.x-p.current.dimensions.x/2,p.current.position.y+p.current.dimensions.y/2,p.current.position.z), glm::vec2(0.0f,1.0f), p.current.color);
-				vtc.emplace_back(glm::vec3(p.current.position.x+p.current.dimensions.x/2,p.current.position.y-p.current.dimensions.y/2,p.current.position.z), glm::vec2(1.0f,0.0f), p.current.color);
-
-				vtc.emplace_back(glm::vec3(p.current.position.x+p.current.dimensions.x/2,p.current.position.y-p.current.dimensions.y/2,p.current.position.z), glm::vec2(1.0f,0.0f), p.current.color);
-				vtc.emplace_back(glm::vec3(p.current.position.x-p.current.dimensions.x/2,p.current.position.y+p.current.dimensions.y/2,p.current.position.z), glm::vec2(0.0f,1.0f), p.current.color);
-				vtc.emplace_back(glm::vec3(p.current.position.x+p.current.dimensions.x/2,p.current.position.y+p.current.dimensions.y/2,p.current.position.z), glm::vec2(1.0f,1.0f), p.current.color);
+			const float* px = active_particles_.getField(ParticleStore::POSITION_X);
+			const float* py = active_particles_.getField(ParticleStore::POSITION_Y);
+			const float* pz = active_particles_.getField(ParticleStore::POSITION_Z);
+			const float* dx = active_particles_.getField(ParticleStore::DIMENSIONS_X);
+			const float* dy = active_particles_.getField(ParticleStore::DIMENSIONS_Y);
+			const float* cr = active_particles_.getField(ParticleStore::COLOR_R);
+			const float* cg = active_particles_.getField(ParticleStore::COLOR_G);
+			const float* cb = active_particles_.getField(ParticleStore::COLOR_B);
+			const float* ca = active_particles_.getField(ParticleStore::COLOR_A);
+			for(size_t n = 0; n != active_particles_.size(); ++n) {
+				const glm::u8vec4 color(static_cast<unsigned char>(cr[n]), static_cast<unsigned char>(cg[n]), static_cast<unsigned char>(cb[n]), static_cast<unsigned char>(ca[n]));
+				const float x1 = px[n] - dx[n]/2;
+				const float x2 = px[n] + dx[n]/2;
+				const float y1 = py[n] - dy[n]/2;
+				const float y2 = py[n] + dy[n]/2;
+				vtc.emplace_back(glm::vec3(x1, y1, pz[n]), glm::vec2(0.0f,0.0f), color);
+				vtc.emplace_back(glm::vec3(x1, y2, pz[n]), glm::vec2(0.0f,1.0f), color);
+				vtc.emplace_back(glm::vec3(x2, y1, pz[n]), glm::vec2(1.0f,0.0f), color);
+
+				vtc.emplace_back(glm::vec3(x2, y1, pz[n]), glm::vec2(1.0f,0.0f), color);
+				vtc.emplace_back(glm::vec3(x1, y2, pz[n]), glm::vec2(0.0f,1.0f), color);
+				vtc.emplace_back(glm::vec3(x2, y2, pz[n]), glm::vec2(1.0f,1.0f), color);
 			}
 			arv_->update(&vtc);
 		}
@@ -563,6 +566,8 @@ namespace KRE
 		ParticleSystemContainer::ParticleSystemContainer(std::weak_ptr<SceneGraph> sg, const variant& node) 
 			: SceneNode(sg, node)
 		{
+			// Only the container's own particle systems are changed when it's processed.
+			setThreadSafe();
 		}
 
 		void ParticleSystemContainer::notifyNodeAttached(std::weak_ptr<SceneNode> parent)
@@ -31,6 +31,7 @@
 
 #include "asserts.hpp"
 #include "AttributeSet.hpp"
+#include "ParticleStore.hpp"
 #include "ParticleSystemFwd.hpp"
 #include "SceneNode.hpp"
 #include "SceneObject.hpp"
@@ -41,8 +42,6 @@ namespace KRE
 {
 	namespace Particles
 	{
-		typedef glm::tvec4<unsigned char> color_vector;
-
 		struct vertex_texture_color3
 		{
 			vertex_texture_color3(const glm::vec3& v, const glm::vec2& t, const glm::u8vec4& c)
@@ -59,30 +58,6 @@ namespace KRE
 			glm::u8vec4 color;
 		};
 
-		struct PhysicsParameters
-		{
-			glm::vec3 position;
-			color_vector color;
-			glm::vec3 dimensions;
-			float time_to_live;
-			float mass;
-			float velocity;
-			glm::vec3 direction;
-			glm::quat orientation;
-		};
-
-		void init_physics_parameters(PhysicsParameters& pp); 
-
-		// This structure should be POD (i.e. plain old data)
-		struct Particle
-		{
-			Particle() : emitted_by(nullptr) {}
-			PhysicsParameters current;
-			PhysicsParameters initial;
-			// Still wavering over whether this should be std::weak_ptr<Emitter>
-			Emitter* emitted_by;
-		};
-
 		// General class for emitter objects which encapsulate and exposes physical parameters
 		// Used as a base class for everything that is not 
 		class EmitObject : public Particle
@@ -134,7 +109,7 @@ namespace KRE
 			EmitObjectPtr getEmitObject(const std::string& name);
 			void setParent(std::weak_ptr<ParticleSystem> parent);
 			// Direct access here for *speed* reasons.
-			std::vector<Particle>& getActiveParticles() { return active_particles_; }
+			ParticleStore& getActiveParticles() { return active_particles_; }
 			std::vector<EmitterPtr>& getActiveEmitters() { return active_emitters_; }
 			std::vector<AffectorPtr>& getActiveAffectors() { return active_affectors_; }
 			void preRender(const WindowPtr& wnd) override;
@@ -170,7 +145,7 @@ namespace KRE
 			std::vector<AffectorPtr> child_affectors_;
 
 			// List of particles currently active.
-			std::vector<Particle> active_particles_;
+			ParticleStore active_particles_;
 
 			// Parent particle system
 			std::weak_ptr<ParticleSystem> parent_particle_system_;
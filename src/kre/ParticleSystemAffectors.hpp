@@ -52,6 +52,13 @@ namespace KRE
 		protected:
 			virtual void handleEmitProcess(float t);
 			virtual void internalApply(Particle& p, float t) = 0;
+			// Applies the affector to the technique's particles. By default each particle is 
+			// copied out, passed to internalApply() and copied back, which moves every field of 
+			// the particle. Affectors should override this to work on just the arrays they use.
+			virtual void applyParticles(ParticleStore& particles, float t);
+			bool hasExcludedEmitters() const { return !excluded_emitters_.empty(); }
+			// Whether the n'th particle wasn't emitted by an excluded emitter.
+			bool isParticleAffected(const ParticleStore& particles, size_t n) const;
 		private:
 			virtual void init(const variant& node) = 0;
 			float mass_;
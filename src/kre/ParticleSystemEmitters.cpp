@@ -374,8 +374,7 @@ namespace KRE
 		void Emitter::visualEmitProcess(float t)
 		{
 			auto tq = getTechnique();
-			std::vector<Particle>& particles = tq->getActiveParticles();
-			std::vector<Particle>::iterator start;
+			ParticleStore& particles = tq->getActiveParticles();
 
 			int cnt = calculateParticlesToEmit(t, particles_remaining_, particles.size());
 			if(duration_) {
@@ -387,24 +386,13 @@ namespace KRE
 
 			//LOG_DEBUG(name() << " emits " << cnt << " particles, " << particles_remaining_ << " remain. active_particles=" << particles.size() << ", t=" << getTechnique()->getParticleSystem()->getElapsedTime());
 
-			// XXX: techincally this shouldn't be needed as we reserve the default quota upon initialising
-			// the particle list. We could hit some pathological case where we allocate particles past
-			// the quota (since it isn't enforced yet). This saves us from start from being invalidated
-			// if push_back were to cause a reallocation.
-			auto last_index = particles.size();
-			particles.resize(particles.size() + cnt);
-			//start = particles.end();
 			for(int n = 0; n != cnt; ++n) {
 				Particle p;
 				initParticle(p, t);
-				particles[n+last_index] = p;
+				internalCreate(p, t);
+				setParticleStartingValues(p);
+				particles.add(p);
 			}
-
-			start = particles.begin() + last_index;
-			for(auto it = start; it != particles.end(); ++it) {
-				internalCreate(*it, t);
-			}
-			setParticleStartingValues(start, particles.end());
 		}
 
 		void Emitter::emitterEmitProcess(float t)
@@ -508,11 +496,9 @@ namespace KRE
 		{
 		}
 
-		void Emitter::setParticleStartingValues(const std::vector<Particle>::iterator& start, const std::vector<Particle>::iterator& end)
+		void Emitter::setParticleStartingValues(Particle& p)
 		{
-			for(auto p = start; p != end; ++p) {
-				memcpy(&p->current, &p->initial, sizeof(p->current));
-			}
+			memcpy(&p.current, &p.initial, sizeof(p.current));
 		}
 
 		void Emitter::initParticle(Particle& p, float t)
@@ -89,7 +89,7 @@ namespace KRE
 			std::string emits_name_;
 
 			void initParticle(Particle& p, float t);
-			void setParticleStartingValues(const std::vector<Particle>::iterator& start, const std::vector<Particle>::iterator& end);
+			void setParticleStartingValues(Particle& p);
 			void createParticles(std::vector<Particle>& particles, std::vector<Particle>::iterator& start, std::vector<Particle>::iterator& end, float t);
 			int calculateParticlesToEmit(float t, int quota, int current_size);
 			void calculateQuota();
@@ -135,6 +135,7 @@ namespace KRE
 		}
 
 		FixedParameter::FixedParameter(const variant& node)
+			: Parameter(ParameterType::FIXED)
 		{
 			value_ = node["value"].as_float();
 		}
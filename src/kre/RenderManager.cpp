@@ -28,6 +28,8 @@
 namespace KRE
 {
 	RenderManager::RenderManager()
+		: render_queues_(),
+		  retained_(false)
 	{
 	}
 
@@ -40,6 +42,7 @@ namespace KRE
 	RenderQueuePtr RenderManager::addQueue(int priority, const std::string& queue_name)
 	{
 		RenderQueuePtr queue = RenderQueue::create(queue_name);
+		queue->setRetained(retained_);
 		auto it = render_queues_.find(priority);
 		if(it != render_queues_.end()) {
 			LOG_WARN("Replacing queue " << it->second->name() << " at priority " << priority << " with queue " << queue->name());
@@ -74,4 +77,19 @@ namespace KRE
 		ASSERT_LOG(it != render_queues_.end(), "Tried to add renderable to non-existant render queue at priority: " << q);
 		it->second->enQueue(order, r);
 	}
+
+	void RenderManager::removeRenderableFromQueue(size_t q, const RenderablePtr& r)
+	{
+		auto it = render_queues_.find(q);
+		ASSERT_LOG(it != render_queues_.end(), "Tried to remove renderable from non-existant render queue at priority: " << q);
+		it->second->remove(r);
+	}
+
+	void RenderManager::setRetained(bool retained)
+	{
+		retained_ = retained;
+		for(auto& q : render_queues_) {
+			q.second->setRetained(retained);
+		}
+	}
 }
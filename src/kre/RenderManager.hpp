@@ -39,11 +39,18 @@ namespace KRE
 
 		void render(const WindowPtr& wm) const;
 		void addRenderableToQueue(size_t q, size_t order, const RenderablePtr& r);
+		void removeRenderableFromQueue(size_t q, const RenderablePtr& r);
+
+		// In retained mode renderables stay in their queues until they are removed, rather
+		// than having to be added again for every frame.
+		bool isRetained() const { return retained_; }
+		void setRetained(bool retained);
 
 		static RenderManagerPtr getInstance();
 	private:
 		typedef std::map<size_t,RenderQueuePtr> RenderQueueList;
 		RenderQueueList render_queues_;
+		bool retained_;
 
 		RenderManager(const RenderManager&);
 	};
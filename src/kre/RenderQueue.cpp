@@ -21,15 +21,24 @@
 	   distribution.
 */
 
+#include <algorithm>
+
 #include "asserts.hpp"
 #include "Renderable.hpp"
 #include "RenderQueue.hpp"
+#include "Shaders.hpp"
+#include "Texture.hpp"
 #include "WindowManager.hpp"
 
 namespace KRE
 {
 	RenderQueue::RenderQueue(const std::string& name) 
-		: name_(name)
+		: renderables_(),
+		  index_(),
+		  index_valid_(false),
+		  has_removed_(false),
+		  name_(name),
+		  retained_(false)
 	{
 	}
 
@@ -40,35 +49,107 @@ namespace KRE
 
 	void RenderQueue::enQueue(uint64_t order, RenderablePtr p)
 	{
-		renderables_[order] = p;
+		renderables_.emplace_back(order, p);
+		if(index_valid_) {
+			index_.emplace(p.get(), renderables_.size() - 1);
+		}
 	}
 
 	void RenderQueue::deQueue(uint64_t order)
 	{
-		auto it = renderables_.find(order);
+		auto it = std::remove_if(renderables_.begin(), renderables_.end(), [order](const Entry& e) { return e.order == order; });
 		ASSERT_LOG(it != renderables_.end(), "RenderQueue(" << name() << ") nothing to dequeue at order: " << order);
-		renderables_.erase(it);
+		renderables_.erase(it, renderables_.end());
+		index_valid_ = false;
+	}
+
+	void RenderQueue::buildIndex()
+	{
+		index_.clear();
+		for(size_t n = 0; n != renderables_.size(); ++n) {
+			if(renderables_[n].renderable != nullptr) {
+				index_.emplace(renderables_[n].renderable.get(), n);
+			}
+		}
+		index_valid_ = true;
+	}
+
+	void RenderQueue::remove(const RenderablePtr& p)
+	{
+		if(!index_valid_) {
+			buildIndex();
+		}
+		auto it = index_.find(p.get());
+		ASSERT_LOG(it != index_.end(), "RenderQueue(" << name() << ") renderable to remove wasn't queued.");
+		renderables_[it->second].renderable.reset();
+		index_.erase(it);
+		has_removed_ = true;
 	}
 
 	void RenderQueue::preRender(const WindowPtr& wm)
 	{
-		for(auto r : renderables_) {
-			r.second->preRender(wm);
+		for(auto& e : renderables_) {
+			if(e.renderable != nullptr) {
+				e.renderable->preRender(wm);
+			}
+		}
+
+		// The state is read after preRender() as it may be changed there. Shaders are ordered by
+		// program rather than address, so the order is the same from run to run and clones of a
+		// program are drawn together.
+		for(auto& e : renderables_) {
+			const auto& r = e.renderable;
+			if(r == nullptr) {
+				continue;
+			}
+			e.shader = r->getShader() != nullptr ? r->getShader()->id() : 0;
+			e.texture = r->getTexture() != nullptr ? r->getTexture()->id() : 0;
+			e.blend = r->isBlendModeSet() ? ((static_cast<int>(r->getBlendMode().src()) << 8) | static_cast<int>(r->getBlendMode().dst())) + 1 : 0;
+		}
+		// Stable so that things queued at the same order with the same state are drawn in the
+		// order they were queued. A retained queue is usually still sorted from the last frame.
+		auto less = [](const Entry& a, const Entry& b) {
+			if(a.order != b.order) {
+				return a.order < b.order;
+			}
+			if(a.shader != b.shader) {
+				return a.shader < b.shader;
+			}
+			if(a.texture != b.texture) {
+				return a.texture < b.texture;
+			}
+			return a.blend < b.blend;
+		};
+		if(!std::is_sorted(renderables_.begin(), renderables_.end(), less)) {
+			std::stable_sort(renderables_.begin(), renderables_.end(), less);
+			index_valid_ = false;
 		}
 	}
 
 	void RenderQueue::render(const WindowPtr& wm) const 
 	{
-		for(auto r : renderables_) {
-			wm->render(r.second.get());
+		for(auto& e : renderables_) {
+			if(e.renderable != nullptr) {
+				wm->render(e.renderable.get());
+			}
 		}
 	}
 
 	void RenderQueue::postRender(const WindowPtr& wm)
 	{
-		for(auto r : renderables_) {
-			r.second->postRender(wm);
+		for(auto& e : renderables_) {
+			if(e.renderable != nullptr) {
+				e.renderable->postRender(wm);
+			}
+		}
+		if(!retained_) {
+			renderables_.clear();
+			index_.clear();
+			index_valid_ = false;
+		} else if(has_removed_) {
+			renderables_.erase(std::remove_if(renderables_.begin(), renderables_.end(), [](const Entry& e) { return e.renderable == nullptr; }), renderables_.end());
+			index_valid_ = false;
 		}
-		renderables_.clear();
+		has_removed_ = false;
 	}
 }
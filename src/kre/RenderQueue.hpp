@@ -23,14 +23,20 @@
 
 #pragma once
 
-#include <map>
 #include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "RenderFwd.hpp"
 #include "WindowManagerFwd.hpp"
 
 namespace KRE
 {
+	// Renderables are drawn in order, then grouped by shader, texture and blend mode so that
+	// the display device can skip state which is already current.
+	// A retained queue keeps its renderables from frame to frame until they're removed,
+	// otherwise the queue is emptied after each frame is drawn.
 	class RenderQueue
 	{
 	public:
@@ -38,7 +44,12 @@ namespace KRE
 		const std::string& name() const { return name_; }
 
 		void enQueue(uint64_t order, RenderablePtr p);	
+		// Removes everything queued at order.
 		void deQueue(uint64_t order);
+		void remove(const RenderablePtr& p);
+
+		bool isRetained() const { return retained_; }
+		void setRetained(bool retained) { retained_ = retained; }
 
 		void preRender(const WindowPtr& wm);
 		void render(const WindowPtr& wm) const;
@@ -46,8 +57,27 @@ namespace KRE
 
 		static RenderQueuePtr create(const std::string& name);
 	private:
-		std::map<uint64_t, RenderablePtr> renderables_;
+		// A removed entry is left with a null renderable until postRender().
+		struct Entry
+		{
+			Entry(uint64_t o, const RenderablePtr& r) : order(o), shader(0), texture(0), blend(0), renderable(r) {}
+			uint64_t order;
+			unsigned shader;
+			unsigned texture;
+			int blend;
+			RenderablePtr renderable;
+		};
+		void buildIndex();
+
+		std::vector<Entry> renderables_;
+		// Position in renderables_ of each queued renderable, built by the first remove() after 
+		// the entries move.
+		std::unordered_multimap<const Renderable*, size_t> index_;
+		bool index_valid_;
+		bool has_removed_;
 		std::string name_;
+		bool retained_;
+
 		RenderQueue();
 		RenderQueue(const RenderQueue&);
 	};
@@ -21,13 +21,19 @@
 	   distribution.
 */
 
+#include <deque>
 #include <functional>
 #include <map>
 
 #include "asserts.hpp"
+#include "JobSystem.hpp"
+#include "RenderManager.hpp"
+#include "RenderQueue.hpp"
 #include "SceneGraph.hpp"
 #include "SceneNode.hpp"
 #include "SceneObject.hpp"
+#include "WindowManager.hpp"
+#include "unit_test.hpp"
 
 namespace KRE
 {
@@ -39,10 +45,38 @@ namespace KRE
 			static SceneNodeRegistry res;
 			return res;
 		}
+
+		// Adds the nodes in the subtree to the list in pre-order.
+		void get_subtree_nodes(the::subtree<SceneNodePtr> sub, std::vector<SceneNodePtr>* nodes)
+		{
+			typedef the::tree<SceneNodePtr>::sub_child_iterator child_iterator;
+			nodes->emplace_back(sub.root());
+			if(sub.childless()) {
+				return;
+			}
+			std::vector<std::pair<child_iterator, child_iterator>> stack;
+			stack.emplace_back(sub.begin_sub_child(), sub.end_sub_child());
+			while(!stack.empty()) {
+				auto& level = stack.back();
+				if(level.first == level.second) {
+					stack.pop_back();
+					continue;
+				}
+				auto child = *level.first++;
+				nodes->emplace_back(child.root());
+				if(!child.childless()) {
+					stack.emplace_back(child.begin_sub_child(), child.end_sub_child());
+				}
+			}
+		}
 	}
 		
 	SceneGraph::SceneGraph(const std::string& name) 
-		: name_(name) 
+		: name_(name),
+		  graph_(),
+		  retained_(false),
+		  frame_(0),
+		  submitted_nodes_()
 	{
 	}
 
@@ -78,8 +112,10 @@ namespace KRE
 		the::tree<SceneNodePtr>::pre_iterator it = graph_.begin();
 		for(; it != graph_.end(); ++it) {
 			if(*it == parent.lock()) {
-				//graph_.insert(it, node);
-				graph_.insert_below(it, node);
+				// Added after the parent's other children. insert_below() would put it between
+				// the parent and its children instead.
+				the::tree<SceneNodePtr>::sub_pre_iterator parent_it = it;
+				graph_.insert((*parent_it).end_child(), node);
 				node->notifyNodeAttached(parent);
 				return;
 			}
@@ -115,34 +151,110 @@ namespace KRE
 		
 	}
 
-	void SceneGraph::renderSceneHelper(const RenderManagerPtr& renderer, 
-		the::tree<SceneNodePtr>::pre_iterator& it, 
-		SceneNodeParams* snp)
+	template<typename F> void SceneGraph::walkNodes(const F& fn)
 	{
-		if(it == graph_.end()) {
-			return;
+		typedef the::tree<SceneNodePtr>::sub_child_iterator child_iterator;
+		// Children still to be visited at each level, with the parameters they inherit.
+		struct Level
+		{
+			child_iterator it;
+			child_iterator end;
+			const SceneNodeParams* params;
+		};
+		// Only nodes which set a camera, lights or render target need their own copy of the
+		// parameters, everything else shares its parent's.
+		std::deque<SceneNodeParams> params_store;
+		const SceneNodeParams base_params;
+		std::vector<Level> stack;
+		stack.push_back(Level{ graph_.begin_sub(), graph_.end_sub(), &base_params });
+		while(!stack.empty()) {
+			Level& level = stack.back();
+			if(level.it == level.end) {
+				stack.pop_back();
+				continue;
+			}
+			auto sub = *level.it++;
+			const SceneNodePtr& node = sub.root();
+			const SceneNodeParams* params = level.params;
+			if(node->hasNodeParams()) {
+				params_store.emplace_back(*params);
+				node->applyNodeParams(&params_store.back());
+				params = &params_store.back();
+			}
+			fn(node, *params);
+			if(!sub.childless()) {
+				stack.push_back(Level{ sub.begin_sub_child(), sub.end_sub_child(), params });
+			}
 		}
-		// XXX the logic isn't quite right here, snp needs to be cleared at some point.
-		(*it)->renderNode(renderer, snp);
-		renderSceneHelper(renderer, ++it, snp);
 	}
 
 	void SceneGraph::renderScene(const RenderManagerPtr& renderer)
 	{
-		the::tree<SceneNodePtr>::pre_iterator it = graph_.begin();
-		//LOG_DEBUG("RenderScene: " << (*it)->NodeName());
-		SceneNodeParams snp;
-		renderSceneHelper(renderer, it, &snp);
+		if(retained_) {
+			ASSERT_LOG(renderer->isRetained(), "SceneGraph(" << name_ << ") is retained but the render manager isn't.");
+			++frame_;
+			std::vector<SceneNodePtr> submitted;
+			walkNodes([&](const SceneNodePtr& node, const SceneNodeParams& snp) {
+				node->submitNode(renderer, snp);
+				node->submit_frame_ = frame_;
+				submitted.emplace_back(node);
+			});
+			// Anything not reached this time has been removed from the graph.
+			for(auto& node : submitted_nodes_) {
+				if(node->submit_frame_ != frame_) {
+					node->withdrawNode(renderer);
+				}
+			}
+			submitted_nodes_.swap(submitted);
+			return;
+		}
+		walkNodes([&renderer](const SceneNodePtr& node, const SceneNodeParams& snp) {
+			node->renderNode(renderer, snp);
+		});
 	}
 
 	void SceneGraph::process(float elapsed_time)
 	{
-		the::tree<SceneNodePtr>::pre_iterator it = graph_.begin();
-		for(; it != graph_.end(); ++it) {
-			(*it)->process(elapsed_time);
+		// Thread safe subtrees are processed as jobs while the rest of the nodes are processed
+		// here, in order. The jobs are given a list of their nodes so that they don't read the
+		// tree, which may be changed by the nodes processed here.
+		typedef the::tree<SceneNodePtr>::sub_child_iterator child_iterator;
+		JobGroup group;
+		std::vector<std::pair<child_iterator, child_iterator>> stack;
+		stack.emplace_back(graph_.begin_sub(), graph_.end_sub());
+		while(!stack.empty()) {
+			auto& level = stack.back();
+			if(level.first == level.second) {
+				stack.pop_back();
+				continue;
+			}
+			auto sub = *level.first++;
+			if(sub.root()->isThreadSafe()) {
+				auto nodes = std::make_shared<std::vector<SceneNodePtr>>();
+				get_subtree_nodes(sub, nodes.get());
+				JobSystem::getInstance().run(group, [nodes, elapsed_time]() {
+					for(auto& node : *nodes) {
+						node->process(elapsed_time);
+					}
+				});
+				continue;
+			}
+			sub.root()->process(elapsed_time);
+			if(!sub.childless()) {
+				stack.emplace_back(sub.begin_sub_child(), sub.end_sub_child());
+			}
+		}
+		if(!group.done()) {
+			JobSystem::getInstance().wait(group);
 		}
 	}
 
+	void SceneGraph::setRetained(bool retained)
+	{
+		ASSERT_LOG(submitted_nodes_.empty(), "SceneGraph(" << name_ << ") can't change mode while it has objects queued.");
+		retained_ = retained;
+	}
+
 	std::ostream& operator<<(std::ostream& os, const SceneGraph& sg)
 	{
 		os << "SCENEGRAPH(";
@@ -154,3 +266,71 @@ namespace KRE
 		return os;
 	}
 }
+
+namespace
+{
+	// Counts the times it has been processed.
+	class CountingNode : public KRE::SceneNode
+	{
+	public:
+		explicit CountingNode(std::weak_ptr<KRE::SceneGraph> sg) : KRE::SceneNode(sg), count(0) {}
+		void process(float) override { ++count; }
+		int count;
+	};
+}
+
+UNIT_TEST(scene_graph_remove_node)
+{
+	auto scene = KRE::SceneGraph::create("scene_graph_remove_node");
+	auto parent = scene->createNode();
+	scene->getRootNode()->attachNode(parent);
+	std::vector<std::shared_ptr<CountingNode>> children;
+	for(int n = 0; n != 3; ++n) {
+		children.emplace_back(std::make_shared<CountingNode>(scene));
+		parent->attachNode(children.back());
+	}
+	parent->removeNode(children[1]);
+	scene->process(0.0f);
+	CHECK_EQ(children[0]->count, 1);
+	CHECK_EQ(children[1]->count, 0);
+	CHECK_EQ(children[2]->count, 1);
+}
+
+BENCHMARK_ARG(scene_submit, const std::string& mode)
+{
+	// 1000 groups of 99 nodes, each with one object.
+	const int groups = 1000;
+	const int nodes_per_group = 99;
+	const bool retained = mode == "retained";
+	auto scene = KRE::SceneGraph::create("scene_submit");
+	scene->setRetained(retained);
+	std::vector<KRE::SceneNodePtr> group_nodes;
+	for(int g = 0; g != groups; ++g) {
+		auto group = scene->createNode();
+		group->setPosition(g, g);
+		scene->getRootNode()->attachNode(group);
+		group_nodes.emplace_back(group);
+	}
+	// Attaching to the last group first keeps the search for the parent node short.
+	for(auto it = group_nodes.rbegin(); it != group_nodes.rend(); ++it) {
+		for(int n = 0; n != nodes_per_group; ++n) {
+			auto node = scene->createNode();
+			node->attachObject(std::make_shared<KRE::SceneObject>("scene_submit"));
+			(*it)->attachNode(node);
+		}
+	}
+
+	auto wnd = KRE::WindowManager::getMainWindow();
+	auto rman = std::make_shared<KRE::RenderManager>();
+	rman->setRetained(retained);
+	auto queue = rman->addQueue(0, "opaques");
+	test::reset_benchmark_timer();
+	BENCHMARK_LOOP {
+		scene->renderScene(rman);
+		// Empties the queue in immediate mode without drawing anything.
+		queue->postRender(wnd);
+	}
+}
+
+BENCHMARK_ARG_CALL(scene_submit, immediate, "immediate")
+BENCHMARK_ARG_CALL(scene_submit, retained, "retained")
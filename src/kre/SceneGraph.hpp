@@ -23,6 +23,8 @@
 
 #pragma once
 
+#include <vector>
+
 #include "RenderFwd.hpp"
 #include "SceneFwd.hpp"
 #include "WindowManager.hpp"
@@ -41,14 +43,26 @@ namespace KRE
 		SceneNodePtr createNode(const std::string& node_type=std::string(), const variant& node=variant());
 		SceneNodePtr getRootNode();
 		void renderScene(const RenderManagerPtr& renderer);
-		void renderSceneHelper(const RenderManagerPtr& renderer, the::tree<SceneNodePtr>::pre_iterator& it, SceneNodeParams* snp);
 	
 		void process(float);
 
+		// In retained mode renderScene() leaves the objects queued between frames and only
+		// updates the nodes which have changed. The render manager must be retained too.
+		bool isRetained() const { return retained_; }
+		void setRetained(bool retained);
+
 		static void registerFactoryFunction(const std::string& type, std::function<SceneNodePtr(std::weak_ptr<SceneGraph>,const variant&)>);
 	private:
+		// Visits the nodes in pre-order, passing each one the parameters set by it and its
+		// ancestors.
+		template<typename F> void walkNodes(const F& fn);
+
 		std::string name_;
 		the::tree<SceneNodePtr> graph_;
+		bool retained_;
+		unsigned frame_;
+		// Nodes which have objects queued in retained mode.
+		std::vector<SceneNodePtr> submitted_nodes_;
 		SceneGraph(const SceneGraph&);
 
 		friend std::ostream& operator<<(std::ostream& s, const SceneGraph& sg);
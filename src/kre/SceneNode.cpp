@@ -51,7 +51,14 @@ namespace KRE
 		: scene_graph_(sg),
 		  position_(0.0f),
 		  rotation_(1.0f, 0.0f, 0.0f, 0.0f),
-		  scale_(1.0f)
+		  scale_(1.0f),
+		  thread_safe_(false),
+		  dirty_(true),
+		  submitted_(),
+		  submitted_camera_(),
+		  submitted_lights_(),
+		  submitted_render_target_(),
+		  submit_frame_(0)
 	{
 		ASSERT_LOG(scene_graph_.lock() != nullptr, "scene_graph_ was null.");
 	}
@@ -61,7 +68,14 @@ namespace KRE
 		  parent_(),
 		  position_(0.0f),
 		  rotation_(1.0f, 0.0f, 0.0f, 0.0f),
-		  scale_(1.0f)
+		  scale_(1.0f),
+		  thread_safe_(false),
+		  dirty_(true),
+		  submitted_(),
+		  submitted_camera_(),
+		  submitted_lights_(),
+		  submitted_render_target_(),
+		  submit_frame_(0)
 	{
 		ASSERT_LOG(scene_graph_.lock() != nullptr, "scene_graph_ was null.");
 		if(node.has_key("camera")) {
@@ -150,6 +164,7 @@ namespace KRE
 	void SceneNode::attachObject(const SceneObjectPtr& obj)
 	{
 		objects_.emplace(obj);
+		dirty_ = true;
 	}
 
 	void SceneNode::removeObject(const SceneObjectPtr& obj)
@@ -157,6 +172,7 @@ namespace KRE
 		auto it = objects_.find(obj);
 		ASSERT_LOG(it != objects_.end(), "Object is not in list: " << obj);
 		objects_.erase(it);
+		dirty_ = true;
 	}
 
 	void SceneNode::attachLight(size_t ref, const LightPtr& obj)
@@ -166,19 +182,22 @@ namespace KRE
 			lights_.erase(it);
 		}
 		lights_.emplace(ref,obj);
+		dirty_ = true;
 	}
 
 	void SceneNode::attachCamera(const CameraPtr& obj)
 	{
 		camera_ = obj;
+		dirty_ = true;
 	}
 
 	void SceneNode::attachRenderTarget(const RenderTargetPtr& obj)
 	{
 		render_target_ = obj;
+		dirty_ = true;
 	}
 
-	void SceneNode::renderNode(const RenderManagerPtr& renderer, SceneNodeParams* rp)
+	void SceneNode::applyNodeParams(SceneNodeParams* rp) const
 	{
 		if(camera_) {
 			rp->camera = camera_;
@@ -188,51 +207,113 @@ namespace KRE
 		}
 		if(render_target_) {
 			rp->render_target = render_target_;
+		}
+	}
+
+	void SceneNode::renderNode(const RenderManagerPtr& renderer, const SceneNodeParams& rp)
+	{
+		if(render_target_) {
 			render_target_->clear();
 		}
 		
 		for(auto o : objects_) {
 			o->setDerivedModel(getPosition(), getRotation(), getScale());
-			o->setCamera(rp->camera);
-			o->setLights(rp->lights);
-			o->setRenderTarget(rp->render_target);
+			o->setCamera(rp.camera);
+			o->setLights(rp.lights);
+			o->setRenderTarget(rp.render_target);
 			renderer->addRenderableToQueue(o->getQueue(), o->getOrder(), o);
 		}
 	}
 
+	void SceneNode::submitNode(const RenderManagerPtr& renderer, const SceneNodeParams& rp)
+	{
+		if(render_target_) {
+			render_target_->clear();
+		}
+
+		if(!dirty_ 
+			&& submitted_camera_ == rp.camera 
+			&& submitted_lights_ == rp.lights 
+			&& submitted_render_target_ == rp.render_target) {
+			return;
+		}
+		dirty_ = false;
+		submitted_camera_ = rp.camera;
+		submitted_lights_ = rp.lights;
+		submitted_render_target_ = rp.render_target;
+
+		for(auto it = submitted_.begin(); it != submitted_.end(); ) {
+			if(objects_.find(it->first) == objects_.end()) {
+				renderer->removeRenderableFromQueue(it->second, it->first);
+				it = submitted_.erase(it);
+			} else {
+				++it;
+			}
+		}
+		for(auto o : objects_) {
+			o->setDerivedModel(getPosition(), getRotation(), getScale());
+			o->setCamera(rp.camera);
+			o->setLights(rp.lights);
+			o->setRenderTarget(rp.render_target);
+			if(submitted_.find(o) == submitted_.end()) {
+				renderer->addRenderableToQueue(o->getQueue(), o->getOrder(), o);
+				submitted_[o] = o->getQueue();
+			}
+		}
+	}
+
+	void SceneNode::withdrawNode(const RenderManagerPtr& renderer)
+	{
+		for(auto& s : submitted_) {
+			renderer->removeRenderableFromQueue(s.second, s.first);
+		}
+		submitted_.clear();
+		submitted_camera_.reset();
+		submitted_lights_.clear();
+		submitted_render_target_.reset();
+		dirty_ = true;
+	}
+
 	void SceneNode::setPosition(const glm::vec3& position) 
 	{
 		position_ = position;
+		dirty_ = true;
 	}
 
 	void SceneNode::setPosition(float x, float y, float z) 
 	{
 		position_ = glm::vec3(x, y, z);
+		dirty_ = true;
 	}
 
 	void SceneNode::setPosition(int x, int y, int z) 
 	{
 		position_ = glm::vec3(float(x), float(y), float(z));
+		dirty_ = true;
 	}
 
 	void SceneNode::setRotation(float angle, const glm::vec3& axis) 
 	{
 		rotation_ = glm::angleAxis(glm::radians(angle), axis);
+		dirty_ = true;
 	}
 
 	void SceneNode::setRotation(const glm::quat& rot) 
 	{
 		rotation_ = rot;
+		dirty_ = true;
 	}
 
 	void SceneNode::setScale(float xs, float ys, float zs) 
 	{
 		scale_ = glm::vec3(xs, ys, zs);
+		dirty_ = true;
 	}
 
 	void SceneNode::setScale(const glm::vec3& scale) 
 	{
 		scale_ = scale;
+		dirty_ = true;
 	}
 
 	glm::mat4 SceneNode::getModelMatrix() const 
@@ -243,6 +324,7 @@ namespace KRE
 	void SceneNode::notifyNodeAttached(std::weak_ptr<SceneNode> parent)
 	{
 		parent_ = parent;
+		dirty_ = true;
 	}
 
 	void SceneNode::process(float)
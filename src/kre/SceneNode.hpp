@@ -24,6 +24,7 @@
 #pragma once
 
 #include <functional>
+#include <map>
 #include <set>
 #include <unordered_map>
 #include <vector>
@@ -52,10 +53,23 @@ namespace KRE
 		const CameraPtr& getCamera() const { return camera_; }
 		const LightPtrList& getLights() const { return lights_; }
 		const RenderTargetPtr getRenderTarget() const { return render_target_; }
-		void renderNode(const RenderManagerPtr& renderer, SceneNodeParams* rp);
+		// True if this node sets a camera, lights or render target for itself and its children.
+		bool hasNodeParams() const { return camera_ || !lights_.empty() || render_target_; }
+		void applyNodeParams(SceneNodeParams* rp) const;
+		// rp holds the parameters set by this node and its ancestors.
+		void renderNode(const RenderManagerPtr& renderer, const SceneNodeParams& rp);
+		// Retained mode version of renderNode(). The objects are only updated and their queue
+		// entries added or removed when the node or the parameters it inherits have changed.
+		void submitNode(const RenderManagerPtr& renderer, const SceneNodeParams& rp);
+		// Removes the objects submitted by submitNode() from their queues.
+		void withdrawNode(const RenderManagerPtr& renderer);
 		std::shared_ptr<SceneGraph> getParentGraph();
 		std::shared_ptr<SceneNode> getParent();
 		virtual void process(float);
+		// Declares that process() for this node and every node below it can be run on another
+		// thread at the same time as nodes in other parts of the scene.
+		bool isThreadSafe() const { return thread_safe_; }
+		void setThreadSafe(bool ts=true) { thread_safe_ = ts; }
 		virtual void notifyNodeAttached(std::weak_ptr<SceneNode> parent);
 		void setNodeName(const std::string& s) { name_ = s; }
 		const std::string& getNodeName() const { return name_; }
@@ -75,7 +89,7 @@ namespace KRE
 
 		glm::mat4 getModelMatrix() const;
 
-		void clear() { objects_.clear(); }
+		void clear() { objects_.clear(); dirty_ = true; }
 
 		static void registerObjectType(const std::string& type, ObjectTypeFunction fn);
 	private:
@@ -93,6 +107,19 @@ namespace KRE
 		glm::vec3 position_;
 		glm::quat rotation_;
 		glm::vec3 scale_;
+		bool thread_safe_;
+
+		// Set when the transform or attached objects change, cleared by submitNode().
+		bool dirty_;
+		// The queue each object was submitted to and the parameters they were given.
+		std::map<SceneObjectPtr, size_t> submitted_;
+		CameraPtr submitted_camera_;
+		LightPtrList submitted_lights_;
+		RenderTargetPtr submitted_render_target_;
+		// Frame number of the last submitNode(), used by the scene graph to find nodes which
+		// have been removed.
+		unsigned submit_frame_;
+		friend class SceneGraph;
 
 		friend std::ostream& operator<<(std::ostream& os, const SceneNode& node);
 	};
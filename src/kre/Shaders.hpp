@@ -86,6 +86,8 @@ namespace KRE
 		virtual ~ShaderProgram();
 
 		virtual void makeActive() = 0;
+		// The device's handle for the program, which its clones share.
+		virtual unsigned id() const = 0;
 		virtual void applyAttribute(AttributeBasePtr attr) = 0;
 		//virtual void applyUniformSet(UniformSetPtr uniforms) = 0;
 		virtual void cleanUpAfterDraw() = 0;
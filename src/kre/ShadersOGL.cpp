@@ -21,6 +21,8 @@
 	   distribution.
 */
 
+#include <algorithm>
+
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
@@ -38,6 +40,16 @@ namespace KRE
 	{
 		namespace
 		{
+			void set_attrib_divisor(GLuint loc, GLuint divisor)
+			{
+				// Core from 3.3, otherwise ARB_instanced_arrays, see DisplayDeviceCapabilties::INSTANCED_ARRAYS.
+				if(glVertexAttribDivisor != nullptr) {
+					glVertexAttribDivisor(loc, divisor);
+				} else {
+					glVertexAttribDivisorARB(loc, divisor);
+				}
+			}
+
 			struct uniform_mapping { const char* alt_name; const char* name; };
 			struct attribute_mapping { const char* alt_name; const char* name; };
 
@@ -872,7 +884,9 @@ namespace KRE
 			  u_mix_palettes_(-1),
 			  u_mix_(-1),
 			  u_discard_(-1),
-			  enabled_attribs_()
+			  enabled_attribs_(),
+			  divisor_attribs_(),
+			  uniform_cache_(std::make_shared<std::map<GLint, std::vector<GLfloat>>>())
 		{
 			init(name, vs, fs);
 		}
@@ -907,7 +921,9 @@ namespace KRE
 			  u_mix_palettes_(-1),
 			  u_mix_(-1),
 			  u_discard_(-1),
-			  enabled_attribs_()
+			  enabled_attribs_(),
+			  divisor_attribs_(),
+			  uniform_cache_(std::make_shared<std::map<GLint, std::vector<GLfloat>>>())
 		{
 			std::vector<Shader> shader_programs;
 			for(auto& sd : shader_data) {
@@ -1094,11 +1110,13 @@ namespace KRE
 
 		void ShaderProgram::makeActive()
 		{
-			//if(get_current_active_shader() == object_) {
-			//	return;
-			//}
+			if(get_current_active_shader() == object_) {
+				++DisplayDevice::getStateChangeCounters().shader_changes_skipped;
+				return;
+			}
 			glUseProgram(object_);
 			get_current_active_shader() = object_;
+			++DisplayDevice::getStateChangeCounters().shader_changes;
 		}
 
 
@@ -1245,6 +1263,7 @@ namespace KRE
 			auto it = v_uniforms_.find(uid);
 			ASSERT_LOG(it != v_uniforms_.end(), "Couldn't find location " << uid << " on the uniform list.");
 			const Actives& u = it->second;
+			invalidateUniform(u.location);
 			ASSERT_LOG(value != nullptr, "setUniformValue(): value is nullptr");
 			switch(u.type) {
 			case GL_INT:
@@ -1312,6 +1331,7 @@ namespace KRE
 			auto it = v_uniforms_.find(uid);
 			ASSERT_LOG(it != v_uniforms_.end(), "Couldn't find location " << uid << " on the uniform list.");
 			const Actives& u = it->second;
+			invalidateUniform(u.location);
 			switch(u.type) {
 			case GL_INT:
 			case GL_BOOL:
@@ -1336,6 +1356,7 @@ namespace KRE
 			auto it = v_uniforms_.find(uid);
 			ASSERT_LOG(it != v_uniforms_.end(), "Couldn't find location " << uid << " on the uniform list.");
 			const Actives& u = it->second;
+			invalidateUniform(u.location);
 			switch(u.type) {
 			case GL_FLOAT: {
 				glUniform1f(u.location, value);
@@ -1355,6 +1376,7 @@ namespace KRE
 			auto it = v_uniforms_.find(uid);
 			ASSERT_LOG(it != v_uniforms_.end(), "Couldn't find location " << uid << " on the uniform list.");
 			const Actives& u = it->second;
+			invalidateUniform(u.location);
 			ASSERT_LOG(value != nullptr, "set_uniform(): value is nullptr");
 			switch(u.type) {
 			case GL_INT:
@@ -1411,7 +1433,9 @@ namespace KRE
 				break;
 			}
 			case GL_FLOAT_VEC4: {
-				glUniform4fv(u.location, u.num_elements, value);
+				if(uniformChanged(u.location, value, 4 * u.num_elements)) {
+					glUniform4fv(u.location, u.num_elements, value);
+				}
 				break;
 			}
 			case GL_FLOAT_MAT2:	{
@@ -1423,7 +1447,9 @@ namespace KRE
 				break;
 			}
 			case GL_FLOAT_MAT4: {
-				glUniformMatrix4fv(u.location, u.num_elements, GL_FALSE, value);
+				if(uniformChanged(u.location, value, 16 * u.num_elements)) {
+					glUniformMatrix4fv(u.location, u.num_elements, GL_FALSE, value);
+				}
 				break;
 			}
 			default:
@@ -1431,6 +1457,24 @@ namespace KRE
 			}	
 		}
 
+		bool ShaderProgram::uniformChanged(GLint location, const GLfloat* value, int count) const
+		{
+			auto& counters = DisplayDevice::getStateChangeCounters();
+			auto& cached = (*uniform_cache_)[location];
+			if(static_cast<int>(cached.size()) == count && std::equal(cached.begin(), cached.end(), value)) {
+				++counters.uniform_uploads_skipped;
+				return false;
+			}
+			cached.assign(value, value + count);
+			++counters.uniform_uploads;
+			return true;
+		}
+
+		void ShaderProgram::invalidateUniform(GLint location) const
+		{
+			uniform_cache_->erase(location);
+		}
+
 		void ShaderProgram::setUniformFromVariant(int uid, const variant& value) const
 		{
 			if(uid == ShaderProgram::INVALID_UNIFORM) {
@@ -1440,6 +1484,7 @@ namespace KRE
 			auto it = v_uniforms_.find(uid);
 			ASSERT_LOG(it != v_uniforms_.end(), "Couldn't find location " << uid << " on the uniform list.");
 			const Actives& u = it->second;
+			invalidateUniform(u.location);
 			if(value.is_null()) {
 				ASSERT_LOG(false, "setUniformFromVariant(): value is null. shader='" << getName() << "', uid: " << uid << " : '" << u.name << "'");
 			}
@@ -1597,6 +1642,7 @@ namespace KRE
 		void ShaderProgram::setActives()
 		{
 			glUseProgram(object_);
+			get_current_active_shader() = object_;
 			// Cache some frequently used uniforms.
 			u_mvp_ = getUniform("mvp_matrix");
 			u_mv_ = getUniform("mv_matrix");
@@ -1739,6 +1785,8 @@ namespace KRE
 		{
 			auto attr_hw = attr->getDeviceBufferData();
 			attr_hw->bind();
+			// Divisors only apply to instanced draws, elsewhere every attribute is per-vertex.
+			const bool instanced = attr->getParent()->isInstanced();
 			for(auto& attrdesc : attr->getAttrDesc()) {
 				auto loc = attrdesc.getLocation();
 				glEnableVertexAttribArray(loc);					
@@ -1749,6 +1797,10 @@ namespace KRE
 					static_cast<GLsizei>(attrdesc.getStride()), 
 					reinterpret_cast<const GLvoid*>(attr_hw->value() + attr->getOffset() + attrdesc.getOffset()));
 				enabled_attribs_.emplace_back(loc);
+				if(instanced && attrdesc.getDivisor() != 0) {
+					set_attrib_divisor(loc, static_cast<GLuint>(attrdesc.getDivisor()));
+					divisor_attribs_.emplace_back(loc);
+				}
 			}
 		}
 
@@ -1774,6 +1826,10 @@ namespace KRE
 				glDisableVertexAttribArray(attrib);
 			}
 			enabled_attribs_.clear();
+			for(auto attrib : divisor_attribs_) {
+				set_attrib_divisor(attrib, 0);
+			}
+			divisor_attribs_.clear();
 		}
 
 		void ShaderProgram::setUniformsForTexture(const TexturePtr& tex) const
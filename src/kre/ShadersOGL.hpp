@@ -107,6 +107,7 @@ namespace KRE
 			void setUniformFromVariant(int uid, const variant& value) const override;
 
 			void makeActive() override;
+			unsigned id() const override { return object_; }
 
 			void configureActives(AttributeSetPtr attrset) override;
 			void configureAttribute(AttributeBasePtr attr) override;
@@ -149,6 +150,11 @@ namespace KRE
 
 			KRE::ShaderProgramPtr clone() override;
 		protected:
+			// Returns true if the value differs from the last one uploaded to the location,
+			// remembering it for next time.
+			bool uniformChanged(GLint location, const GLfloat* value, int count) const;
+			void invalidateUniform(GLint location) const;
+
 			bool link(const std::vector<Shader>& shader_programs);
 			bool queryUniforms();
 			bool queryAttributes();
@@ -187,6 +193,11 @@ namespace KRE
 			int u_discard_;
 
 			std::vector<GLuint> enabled_attribs_;
+			// Attributes with a divisor set for the current draw.
+			std::vector<GLuint> divisor_attribs_;
+			// Last vector and matrix values uploaded, by location. Uniform values belong to the
+			// program object so this is shared with clones.
+			std::shared_ptr<std::map<GLint, std::vector<GLfloat>>> uniform_cache_;
 		};
 	}
 }
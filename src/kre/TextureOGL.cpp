@@ -748,8 +748,10 @@ namespace KRE
 	{
 		// XXX fix this fore multiple texture binding.
 		if(get_current_bound_texture() == *texture_data_[0].id) {
+			++DisplayDevice::getStateChangeCounters().texture_binds_skipped;
 			return;
 		}
+		++DisplayDevice::getStateChangeCounters().texture_binds;
 		int n = static_cast<int>(texture_data_.size() - 1);
 		for(auto it = texture_data_.rbegin(); it != texture_data_.rend(); ++it, --n) {
 			glActiveTexture(GL_TEXTURE0 + n + binding_point);
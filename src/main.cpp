@@ -3,6 +3,9 @@
 #include <iostream>
 #include <fstream>
 
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
 #include "asserts.hpp"
 #include "filesystem.hpp"
 #include "Blittable.hpp"
@@ -11,6 +14,7 @@
 #include "ClipScope.hpp"
 #include "Font.hpp"
 #include "FontDriver.hpp"
+#include "JobSystem.hpp"
 #include "RenderManager.hpp"
 #include "RenderTarget.hpp"
 #include "SceneGraph.hpp"
@@ -120,11 +124,42 @@ int main(int argc, char* argv[])
 {
 	std::string log_file_name;
 	std::vector<std::string> args;
+	bool run_benchmarks = false;
+	int build_threads = 1;
+	bool chunked = false;
+	bool pack_terrain = false;
+	bool retained = false;
+	std::vector<std::string> benchmarks_list;
 	for(int i = 1; i < argc; ++i) {
-		if(argv[i] == std::string("--log-to")) {
+		const std::string arg = argv[i];
+		if(arg == "--log-to") {
 			++i;
 			ASSERT_LOG(i < argc, "No argument for --log-to");
 			log_file_name = argv[i];
+		} else if(arg == "--build-threads") {
+			++i;
+			ASSERT_LOG(i < argc, "No argument for --build-threads");
+			build_threads = boost::lexical_cast<int>(argv[i]);
+			ASSERT_LOG(build_threads > 0, "--build-threads must be at least 1: " << build_threads);
+		} else if(arg == "--job-threads") {
+			++i;
+			ASSERT_LOG(i < argc, "No argument for --job-threads");
+			const int job_threads = boost::lexical_cast<int>(argv[i]);
+			ASSERT_LOG(job_threads >= 0, "--job-threads can't be negative: " << job_threads);
+			// Number of workers in the shared pool, by default one per spare hardware thread.
+			KRE::JobSystem::setInstanceThreadCount(job_threads);
+		} else if(arg == "--chunked") {
+			chunked = true;
+		} else if(arg == "--pack-terrain") {
+			pack_terrain = true;
+		} else if(arg == "--retained") {
+			retained = true;
+		} else if(arg == "--benchmarks") {
+			run_benchmarks = true;
+		} else if(arg.substr(0, 13) == "--benchmarks=") {
+			run_benchmarks = true;
+			const std::string names = arg.substr(13);
+			boost::split(benchmarks_list, names, boost::is_any_of(","));
 		} else {
 			args.emplace_back(argv[i]);
 		}
@@ -191,19 +226,36 @@ int main(int argc, char* argv[])
 
 	auto rman = std::make_shared<RenderManager>();
 	auto rq = rman->addQueue(0, "opaques");
+	// Keeps the map's layers queued rather than submitting them again every frame.
+	rman->setRetained(retained);
+	scene->setRetained(retained);
 
-	hex::load(data_path);
+	hex::load(data_path, pack_terrain);
+
+	if(run_benchmarks) {
+		test::run_benchmarks(benchmarks_list.empty() ? nullptr : &benchmarks_list);
+		return 0;
+	}
 
 	std::string map_to_use = data_path + "maps/test01.map";
 	if(!args.empty()) {
 		map_to_use = data_path + "maps/" + args[0];
 	}
-	auto hmap = hex::HexMap::create(map_to_use);
-	hmap->build();
-	hex::MapNodePtr hex_renderable;
-	hex_renderable = std::dynamic_pointer_cast<hex::MapNode>(scene->createNode("hex_map"));
-	hmap->setRenderable(hex_renderable);
-	scene->getRootNode()->attachNode(hex_renderable);
+	hex::HexMapPtr hmap;
+	hex::ChunkedMapPtr chunked_map;
+	if(chunked) {
+		// Only the chunks in view are loaded and built.
+		chunked_map = hex::ChunkedMap::create(map_to_use);
+		chunked_map->setRenderParent(scene->getRootNode());
+		chunked_map->setViewArea(hex::MapNode::getTileArea(rect(0, 0, width, height)));
+	} else {
+		hmap = hex::HexMap::create(map_to_use);
+		hmap->build(true, build_threads);
+		hex::MapNodePtr hex_renderable;
+		hex_renderable = std::dynamic_pointer_cast<hex::MapNode>(scene->createNode("hex_map"));
+		hmap->setRenderable(hex_renderable);
+		scene->getRootNode()->attachNode(hex_renderable);
+	}
 
 	SDL_Event e;
 	bool done = false;
@@ -240,6 +292,9 @@ int main(int argc, char* argv[])
 					height = wnd.data2;
 					main_wnd->notifyNewWindowSize(width, height);
 					DisplayDevice::getCurrent()->setDefaultCamera(std::make_shared<Camera>("ortho1", 0, width, 0, height));
+					if(chunked_map != nullptr) {
+						chunked_map->setViewArea(hex::MapNode::getTileArea(rect(0, 0, width, height)));
+					}
 				}
 			}
 		}
@@ -247,7 +302,14 @@ int main(int argc, char* argv[])
 		//main_wnd->setClearColor(KRE::Color::colorWhite());
 		main_wnd->clear(ClearFlags::ALL);
 
-		hmap->process();
+		if(chunked_map != nullptr) {
+			chunked_map->process();
+		} else {
+			hmap->process();
+		}
+
+		// Jobs from other threads which need the GL context.
+		JobSystem::getInstance().runMainThreadJobs();
 
 		scene->renderScene(rman);
 		rman->render(main_wnd);
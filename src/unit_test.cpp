@@ -31,6 +31,19 @@ namespace test {
 			static test_map map;
 			return map;
 		}
+
+		typedef std::map<std::string, benchmark_test> benchmark_map;
+		benchmark_map& get_benchmark_map()
+		{
+			static benchmark_map map;
+			return map;
+		}
+
+		std::chrono::steady_clock::time_point& get_benchmark_start()
+		{
+			static std::chrono::steady_clock::time_point start;
+			return start;
+		}
 	}
 
 	int register_test(const std::string& name, unit_test test)
@@ -39,6 +52,12 @@ namespace test {
 		return 0;
 	}
 
+	int register_benchmark(const std::string& name, benchmark_test test)
+	{
+		get_benchmark_map()[name] = test;
+		return 0;
+	}
+
 	bool run_tests(const std::vector<std::string>* tests)
 	{
 		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
@@ -74,4 +93,45 @@ namespace test {
 			return true;
 		}
 	}
+
+	void reset_benchmark_timer()
+	{
+		get_benchmark_start() = std::chrono::steady_clock::now();
+	}
+
+	void run_benchmarks(const std::vector<std::string>* benchmarks)
+	{
+		std::vector<std::string> all_benchmarks;
+		if(!benchmarks) {
+			for(benchmark_map::const_iterator i = get_benchmark_map().begin(); i != get_benchmark_map().end(); ++i) {
+				all_benchmarks.push_back(i->first);
+			}
+
+			benchmarks = &all_benchmarks;
+		}
+
+		for(const auto& benchmark : *benchmarks) {
+			auto it = get_benchmark_map().find(benchmark);
+			if(it == get_benchmark_map().end()) {
+				LOG_ERROR("BENCHMARK " << benchmark << " NOT FOUND");
+				continue;
+			}
+			// Keep increasing the number of iterations until the run takes at least a second.
+			const long long MinTimeMs = 1000;
+			for(int nruns = 1; ; nruns *= 10) {
+				get_benchmark_start() = std::chrono::steady_clock::now();
+				it->second(nruns);
+				const std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+				const auto time_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(end - get_benchmark_start()).count();
+				if(time_ns >= MinTimeMs * 1000000LL || nruns >= 1000000000) {
+					const long long per_iteration_ns = time_ns / nruns;
+					LOG_INFO("BENCH " << benchmark << ": " << nruns << " iterations, " 
+						<< (per_iteration_ns >= 10000000LL ? per_iteration_ns / 1000000LL : per_iteration_ns >= 10000LL ? per_iteration_ns / 1000LL : per_iteration_ns)
+						<< (per_iteration_ns >= 10000000LL ? "ms" : per_iteration_ns >= 10000LL ? "us" : "ns")
+						<< "/iteration; total " << (time_ns / 1000000LL) << "ms");
+					break;
+				}
+			}
+		}
+	}
 }
@@ -29,10 +29,15 @@ namespace test
 	};
 
 	typedef std::function<void ()> unit_test;
+	typedef std::function<void (int)> benchmark_test;
 
 	int register_test(const std::string& name, unit_test test);
+	int register_benchmark(const std::string& name, benchmark_test test);
 	
 	bool run_tests(const std::vector<std::string>* tests=NULL);
+	void run_benchmarks(const std::vector<std::string>* benchmarks=NULL);
+	// Called by a benchmark once it has finished any set-up that shouldn't be timed.
+	void reset_benchmark_timer();
 }
 
 #define CHECK(cond, msg) if(!(cond)) { std::cerr << __FILE__ << ":" << __LINE__ << ": TEST CHECK FAILED: " << #cond << ": " << msg << "\n"; throw test::failure_exception(); }
@@ -53,3 +58,26 @@ namespace test
 	void debug_fn_##name() { std::cerr << TEST_VAR_##name << "\n"; } \
     }                   \
 	void test::TEST_##name()
+
+#define BENCHMARK(name) \
+	namespace test {    \
+	void BENCHMARK_##name(int benchmark_iterations); \
+	static int BENCHMARK_VAR_##name = register_benchmark(#name, BENCHMARK_##name); \
+	}                   \
+	void test::BENCHMARK_##name(int benchmark_iterations)
+
+#define BENCHMARK_LOOP while(benchmark_iterations-- > 0)
+
+#define BENCHMARK_ARG(name, arg) \
+	namespace test {    \
+	void BENCHMARK_ARG_##name(int benchmark_iterations, arg); \
+	}                   \
+	void test::BENCHMARK_ARG_##name(int benchmark_iterations, arg)
+
+#define BENCHMARK_ARG_CALL(name, id, arg) \
+	namespace test {    \
+	void BENCHMARK_ARG_CALL_##name##_##id(int benchmark_iterations) { \
+		BENCHMARK_ARG_##name(benchmark_iterations, arg); \
+	} \
+	static int BENCHMARK_ARG_VAR_##name##_##id = register_benchmark(#name " " #id, BENCHMARK_ARG_CALL_##name##_##id); \
+	}
@@ -1,6 +1,9 @@
+#include <algorithm>
+#include <atomic>
 #include <sstream>
 #include "asserts.hpp"
 #include "json.hpp"
+#include "unit_test.hpp"
 #include "variant.hpp"
 
 namespace
@@ -10,76 +13,197 @@ namespace
 		static variant res;
 		return res;
 	}
+
+	int compare_strings(const variant_string& a, const std::string& b)
+	{
+		return a.compare(0, a.size(), b.data(), b.size());
+	}
+}
+
+template<typename T> struct variant::Shared
+{
+	Shared(T* v, variant_arena* a) : refs(1), arena(a), value(std::move(*v)) {}
+	void release() {
+		if(--refs == 0) {
+			variant_arena* a = arena;
+			if(a) {
+				this->~Shared();
+				a->release();
+			} else {
+				delete this;
+			}
+		}
+	}
+	std::atomic<int> refs;
+	// Where this and the value's storage was allocated, nullptr for the heap. Holds a reference
+	// to the arena, which is freed with the last thing allocated from it.
+	variant_arena* arena;
+	T value;
+};
+
+template<typename T> variant::Shared<T>* variant::create_shared(T* value, variant_arena* arena)
+{
+	if(arena) {
+		arena->add_ref();
+		return new(arena->allocate(sizeof(Shared<T>), std::alignment_of<Shared<T>>::value)) Shared<T>(value, arena);
+	}
+	return new Shared<T>(value, nullptr);
 }
 
 variant::variant()
-	: type_(VARIANT_TYPE_NULL), i_(0), f_(0.0f), b_(false)
+	: type_(VARIANT_TYPE_NULL), i_(0)
 {
 }
 
 variant::variant(const variant& rhs) 
-	: type_(rhs.type()), i_(0), f_(0.0f), b_(false)
+	: type_(rhs.type_), i_(0)
 {
 	switch(type_) {
 	case VARIANT_TYPE_NULL:		break;
 	case VARIANT_TYPE_INTEGER:	i_ = rhs.i_; break;
 	case VARIANT_TYPE_FLOAT:	f_ = rhs.f_; break;
 	case VARIANT_TYPE_BOOL:		b_ = rhs.b_; break;
-	case VARIANT_TYPE_STRING:	s_ = rhs.s_; break;
-	case VARIANT_TYPE_MAP:		m_ = rhs.m_; break;
-	case VARIANT_TYPE_LIST:		l_ = rhs.l_; break;
+	case VARIANT_TYPE_STRING:	s_ = rhs.s_; ++s_->refs; break;
+	case VARIANT_TYPE_MAP:		m_ = rhs.m_; ++m_->refs; break;
+	case VARIANT_TYPE_LIST:		l_ = rhs.l_; ++l_->refs; break;
 	default:
 		ASSERT_LOG(false, "Unrecognised type in copy constructor: " << type_);
 	}
 }
 
-variant::variant(int64_t n)
-	: type_(VARIANT_TYPE_INTEGER), i_(n), f_(0.0f), b_(false)
+variant::variant(variant&& rhs)
+	: type_(rhs.type_), i_(rhs.i_)
 {
+	rhs.type_ = VARIANT_TYPE_NULL;
+	rhs.i_ = 0;
+}
 
+variant::~variant()
+{
+	release();
 }
 
-variant::variant(int n)
-	: type_(VARIANT_TYPE_INTEGER), i_(n), f_(0.0f), b_(false)
+void variant::release()
 {
+	switch(type_) {
+	case VARIANT_TYPE_STRING:	s_->release(); break;
+	case VARIANT_TYPE_MAP:		m_->release(); break;
+	case VARIANT_TYPE_LIST:		l_->release(); break;
+	default: break;
+	}
+	type_ = VARIANT_TYPE_NULL;
+	i_ = 0;
+}
 
+variant& variant::operator=(const variant& rhs)
+{
+	return *this = variant(rhs);
+}
+
+variant& variant::operator=(variant&& rhs)
+{
+	// rhs may be held inside this variant, so take its contents before releasing ours.
+	variant tmp(std::move(rhs));
+	release();
+	type_ = tmp.type_;
+	i_ = tmp.i_;
+	tmp.type_ = VARIANT_TYPE_NULL;
+	return *this;
+}
+
+variant::variant(int64_t n)
+	: type_(VARIANT_TYPE_INTEGER), i_(n)
+{
+}
+
+variant::variant(int n)
+	: type_(VARIANT_TYPE_INTEGER), i_(n)
+{
 }
 
 variant::variant(float f)
-	: type_(VARIANT_TYPE_FLOAT), i_(0), f_(f), b_(false)
+	: type_(VARIANT_TYPE_FLOAT), i_(0)
 {
+	f_ = f;
 }
 
 variant::variant(double f)
-	: type_(VARIANT_TYPE_FLOAT), i_(0), f_(static_cast<float>(f)), b_(false)
+	: type_(VARIANT_TYPE_FLOAT), i_(0)
 {
+	f_ = static_cast<float>(f);
 }
 
 variant::variant(const std::string& s)
-	: type_(VARIANT_TYPE_STRING), i_(0), f_(0.0f), s_(s), b_(false)
+	: type_(VARIANT_TYPE_STRING), i_(0)
 {
+	variant_string str(s.data(), s.size());
+	s_ = create_shared(&str, nullptr);
 }
 
-variant::variant(const std::map<variant,variant>& m)
-	: type_(VARIANT_TYPE_MAP), i_(0), f_(0.0f), m_(m), b_(false)
+variant::variant(const variant_map& m)
+	: type_(VARIANT_TYPE_MAP), i_(0)
 {
+	variant_map copy(m);
+	m_ = create_shared(&copy, nullptr);
+}
+
+variant::variant(const variant_list& l)
+	: type_(VARIANT_TYPE_LIST), i_(0)
+{
+	variant_list copy(l);
+	l_ = create_shared(&copy, nullptr);
 }
 
 variant::variant(const std::vector<variant>& l)
-	: type_(VARIANT_TYPE_LIST), i_(0), f_(0.0f), l_(l), b_(false)
+	: type_(VARIANT_TYPE_LIST), i_(0)
 {
+	variant_list copy(l.begin(), l.end());
+	l_ = create_shared(&copy, nullptr);
 }
 
 variant::variant(std::vector<variant>* list)
-	: type_(VARIANT_TYPE_LIST), i_(0), f_(0.0f), b_(false)
+	: type_(VARIANT_TYPE_LIST), i_(0)
 {
-	l_.swap(*list);
+	variant_list l(std::make_move_iterator(list->begin()), std::make_move_iterator(list->end()));
+	list->clear();
+	l_ = create_shared(&l, nullptr);
 }
 
 variant::variant(variant_map* vmap)
-	: type_(VARIANT_TYPE_MAP), i_(0), f_(0), b_(false)
+	: type_(VARIANT_TYPE_MAP), i_(0)
+{
+	m_ = create_shared(vmap, nullptr);
+}
+
+variant variant::create_string(const char* s, size_t size, variant_arena* arena)
+{
+	variant_string str(s, size, arena_allocator<char>(arena));
+	variant res;
+	res.type_ = VARIANT_TYPE_STRING;
+	res.s_ = create_shared(&str, arena);
+	return res;
+}
+
+variant variant::create_list(variant* first, variant* last, variant_arena* arena)
 {
-	m_.swap(*vmap);
+	variant_list list((arena_allocator<variant>(arena)));
+	list.reserve(last - first);
+	for(auto it = first; it != last; ++it) {
+		list.emplace_back(std::move(*it));
+	}
+	variant res;
+	res.type_ = VARIANT_TYPE_LIST;
+	res.l_ = create_shared(&list, arena);
+	return res;
+}
+
+variant variant::create_map(std::vector<std::pair<variant, variant>>* elements, variant_arena* arena)
+{
+	variant_map m(elements, arena);
+	variant res;
+	res.type_ = VARIANT_TYPE_MAP;
+	res.m_ = create_shared(&m, arena);
+	return res;
 }
 
 variant variant::from_bool(bool b)
@@ -90,6 +214,10 @@ variant variant::from_bool(bool b)
 	return n;
 }
 
+const variant_string& variant::str() const
+{
+	return s_->value;
+}
 
 std::string variant::type_as_string() const
 {
@@ -146,7 +274,7 @@ std::string variant::as_string() const
 {
 	switch(type()) {
 	case VARIANT_TYPE_STRING:
-		return s_;
+		return std::string(s_->value.data(), s_->value.size());
 	case VARIANT_TYPE_INTEGER: {
 		std::stringstream s;
 		s << i_;
@@ -167,7 +295,7 @@ std::string variant::as_string_default(const std::string& s) const
 {
 	switch(type()) {
 	case VARIANT_TYPE_STRING:
-		return s_;
+		return std::string(s_->value.data(), s_->value.size());
 	case VARIANT_TYPE_INTEGER: {
 		std::stringstream s;
 		s << i_;
@@ -222,11 +350,11 @@ bool variant::as_bool() const
 	case VARIANT_TYPE_BOOL:
 		return b_;
 	case VARIANT_TYPE_STRING:
-		return s_.empty() ? false : true;
+		return s_->value.empty() ? false : true;
 	case VARIANT_TYPE_LIST:
-		return l_.empty() ? false : true;
+		return l_->value.empty() ? false : true;
 	case VARIANT_TYPE_MAP:
-		return m_.empty() ? false : true;
+		return m_->value.empty() ? false : true;
 	default: break;
 	}
 	ASSERT_LOG(false, "as_bool() type conversion error from " << type_as_string() << " to boolean");
@@ -242,28 +370,40 @@ bool variant::as_bool(bool default_value) const
 	}
 }
 
+boost::string_ref variant::as_string_ref() const
+{
+	ASSERT_LOG(type() == VARIANT_TYPE_STRING, "as_string_ref() type conversion error from " << type_as_string() << " to string");
+	return boost::string_ref(s_->value.data(), s_->value.size());
+}
+
 const variant_list& variant::as_list() const
 {
 	ASSERT_LOG(type() == VARIANT_TYPE_LIST, "as_list() type conversion error from " << type_as_string() << " to list");
-	return l_;
+	return l_->value;
 }
 
 const variant_map& variant::as_map() const
 {
 	ASSERT_LOG(type() == VARIANT_TYPE_MAP, "as_map() type conversion error from " << type_as_string() << " to map");
-	return m_;
+	return m_->value;
 }
 
 variant_list& variant::as_mutable_list()
 {
 	ASSERT_LOG(type() == VARIANT_TYPE_LIST, "as_mutable_list() type conversion error from " << type_as_string() << " to list");
-	return l_;
+	if(l_->refs > 1 || l_->arena) {
+		*this = variant(l_->value);
+	}
+	return l_->value;
 }
 
 variant_map& variant::as_mutable_map()
 {
 	ASSERT_LOG(type() == VARIANT_TYPE_MAP, "as_mutable_map() type conversion error from " << type_as_string() << " to map");
-	return m_;
+	if(m_->refs > 1 || m_->arena) {
+		*this = variant(m_->value);
+	}
+	return m_->value;
 }
 
 bool variant::operator<(const variant& n) const
@@ -281,18 +421,18 @@ bool variant::operator<(const variant& n) const
 	case VARIANT_TYPE_FLOAT:
 		return f_ < n.f_;
 	case VARIANT_TYPE_STRING:
-		return s_ < n.s_;
+		return s_->value < n.s_->value;
 	case VARIANT_TYPE_MAP:
-		return m_.size() < n.m_.size();
+		return m_->value.size() < n.m_->value.size();
 	case VARIANT_TYPE_LIST:
-		for(int i = 0; i != l_.size() && i != n.l_.size(); ++i) {
-			if(l_[i] < n.l_[i]) {
+		for(int i = 0; i != l_->value.size() && i != n.l_->value.size(); ++i) {
+			if(l_->value[i] < n.l_->value[i]) {
 				return true;
-			} else if(l_[i] > n.l_[i]) {
+			} else if(l_->value[i] > n.l_->value[i]) {
 				return false;
 			}
 		}
-		return l_.size() < n.l_.size();
+		return l_->value.size() < n.l_->value.size();
 	default: break;
 	}
 	ASSERT_LOG(false, "operator< unknown type: " << type_as_string());
@@ -307,17 +447,17 @@ bool variant::operator>(const variant& n) const
 const variant& variant::operator[](size_t n) const
 {
 	ASSERT_LOG(type() == VARIANT_TYPE_LIST, "Tried to index variant that isn't a list, was: " << type_as_string());
-	ASSERT_LOG(n < l_.size(), "Tried to index a list outside of list bounds: " << n << " >= " << l_.size());
-	return l_[n];
+	ASSERT_LOG(n < l_->value.size(), "Tried to index a list outside of list bounds: " << n << " >= " << l_->value.size());
+	return l_->value[n];
 }
 
 const variant& variant::operator[](const variant& v) const
 {
 	if(type() == VARIANT_TYPE_LIST) {
-		return l_[size_t(v.as_int())];
+		return l_->value[size_t(v.as_int())];
 	} else if(type() == VARIANT_TYPE_MAP) {
-		auto it = m_.find(v);
-		ASSERT_LOG(it != m_.end(), "Couldn't find key in map");
+		auto it = m_->value.find(v);
+		ASSERT_LOG(it != m_->value.end(), "Couldn't find key in map");
 		return it->second;
 	} else {
 		ASSERT_LOG(false, "Tried to index a variant that isn't a list or map: " << type_as_string());
@@ -328,9 +468,9 @@ const variant& variant::operator[](const variant& v) const
 const variant& variant::operator[](const std::string& key) const
 {
 	ASSERT_LOG(type() == VARIANT_TYPE_MAP, "Tried to index variant that isn't a map, was: " << type_as_string());
-	auto it = m_.find(variant(key));
-	//ASSERT_LOG(it != m_.end(), "Couldn't find key(" << key << ") in map");
-	if(it != m_.end()) {
+	auto it = m_->value.find(key);
+	//ASSERT_LOG(it != m_->value.end(), "Couldn't find key(" << key << ") in map");
+	if(it != m_->value.end()) {
 		return it->second;
 	}
 	return null_variant();
@@ -339,9 +479,9 @@ const variant& variant::operator[](const std::string& key) const
 bool variant::has_key(const variant& v) const
 {
 	if(type() == VARIANT_TYPE_LIST) {
-		return v.as_int() < l_.size() ? true : false;
+		return v.as_int() < l_->value.size() ? true : false;
 	} else if(type() == VARIANT_TYPE_MAP) {
-		return m_.find(v) != m_.end() ? true : false;
+		return m_->value.find(v) != m_->value.end() ? true : false;
 	} else {
 		ASSERT_LOG(false, "Tried to index a variant that isn't a list or map: " << type_as_string());
 	}
@@ -354,12 +494,12 @@ bool variant::has_key(const std::string& key) const
 	if(type() != VARIANT_TYPE_MAP) {
 		return false;
 	}
-	return m_.find(variant(key)) != m_.end() ? true : false;
+	return m_->value.find(key) != m_->value.end() ? true : false;
 }
 
 bool variant::operator==(const std::string& s) const
 {
-	return *this == variant(s);
+	return type_ == VARIANT_TYPE_STRING && compare_strings(s_->value, s) == 0;
 }
 
 bool variant::operator==(int64_t n) const
@@ -388,15 +528,15 @@ bool variant::operator==(const variant& n) const
 	case VARIANT_TYPE_FLOAT:
 		return f_ == n.f_;
 	case VARIANT_TYPE_STRING:
-		return s_ == n.s_;
+		return s_->value == n.s_->value;
 	case VARIANT_TYPE_MAP:
-		return m_ == n.m_;
+		return m_->value == n.m_->value;
 	case VARIANT_TYPE_LIST:
-		if(l_.size() != n.l_.size()) {
+		if(l_->value.size() != n.l_->value.size()) {
 			return false;
 		}
-		for(size_t ndx = 0; ndx != l_.size(); ++ndx) {
-			if(l_[ndx] != n.l_[ndx]) {
+		for(size_t ndx = 0; ndx != l_->value.size(); ++ndx) {
+			if(l_->value[ndx] != n.l_->value[ndx]) {
 				return false;
 			}
 		}
@@ -417,11 +557,11 @@ int variant::num_elements() const
 	} else if(type_ == VARIANT_TYPE_FLOAT) {
 		return 1;
 	} else if (type_ == VARIANT_TYPE_LIST) {
-		return static_cast<int>(l_.size());
+		return static_cast<int>(l_->value.size());
 	} else if (type_ == VARIANT_TYPE_STRING) {
-		return static_cast<int>(s_.size());
+		return static_cast<int>(s_->value.size());
 	} else if (type_ == VARIANT_TYPE_MAP) {
-		return static_cast<int>(m_.size());
+		return static_cast<int>(m_->value.size());
 	}
 	return 0;
 }
@@ -448,7 +588,7 @@ void variant::write_json(std::ostream& os, bool pretty, int indent) const
 		break;
 	case VARIANT_TYPE_STRING:
 		os << '"';
-		for(auto it = s_.begin(); it != s_.end(); ++it) {
+		for(auto it = s_->value.begin(); it != s_->value.end(); ++it) {
 			/*if(*it == '"') {
 				os << "\\\"";
 			} else if(*it == '\\') {
@@ -490,8 +630,8 @@ void variant::write_json(std::ostream& os, bool pretty, int indent) const
 		break;
 	case VARIANT_TYPE_MAP:
 		os << (pretty ? ("{\n" + std::string(indent, ' ')) : "{");
-		for(auto pr = m_.begin(); pr != m_.end(); ++pr) {
-			if(pr != m_.begin()) {
+		for(auto pr = m_->value.begin(); pr != m_->value.end(); ++pr) {
+			if(pr != m_->value.begin()) {
 				os << (pretty ? (",\n" + std::string(indent, ' ')) : ",");
 			}
 			pr->first.write_json(os, pretty, indent + 4);
@@ -502,8 +642,8 @@ void variant::write_json(std::ostream& os, bool pretty, int indent) const
 		break;
 	case VARIANT_TYPE_LIST:
 		os << (pretty ? ("[\n" + std::string(indent, ' ')) : "[");
-		for(auto it = l_.begin(); it != l_.end(); ++it) {
-			if(it != l_.begin()) {
+		for(auto it = l_->value.begin(); it != l_->value.end(); ++it) {
+			if(it != l_->value.begin()) {
 				os << (pretty ? (",\n" + std::string(indent, ' ')) : ",");
 			}
 			it->write_json(os, pretty, indent + 4);
@@ -524,8 +664,8 @@ std::vector<std::string> variant::as_list_string() const
 {
 	std::vector<std::string> result;
 	ASSERT_LOG(type_ == VARIANT_TYPE_LIST, "as_list_string: variant must be a list.");
-	result.reserve(l_.size());
-	for(auto& el : l_) {
+	result.reserve(l_->value.size());
+	for(auto& el : l_->value) {
 		ASSERT_LOG(el.is_string(), "as_list_string: Each element in list must be a string.");
 		result.emplace_back(el.as_string());
 	}
@@ -536,8 +676,8 @@ std::vector<int> variant::as_list_int() const
 {
 	std::vector<int> result;
 	ASSERT_LOG(type_ == VARIANT_TYPE_LIST, "as_list_int: variant must be a list.");
-	result.reserve(l_.size());
-	for(auto& el : l_) {
+	result.reserve(l_->value.size());
+	for(auto& el : l_->value) {
 		ASSERT_LOG(el.is_numeric(), "as_list_int: Each element in list must be an integer");
 		result.emplace_back(el.as_int32());
 	}
@@ -637,3 +777,106 @@ std::string variant::to_debug_string() const
 {
 	return write_json(true, 0);
 }
+
+namespace
+{
+	bool key_less(const variant_map::value_type& a, const variant& key)
+	{
+		return a.first < key;
+	}
+
+	bool keys_equal(const variant& a, const variant& b)
+	{
+		return !(a < b) && !(b < a);
+	}
+}
+
+variant_map::variant_map(std::vector<value_type>* elements, variant_arena* arena)
+	: elements_(arena_allocator<value_type>(arena))
+{
+	auto key_order = [](const value_type& a, const value_type& b) { 
+		return a.first < b.first; 
+	};
+	// Documents are usually written with their keys in order already.
+	if(!std::is_sorted(elements->begin(), elements->end(), key_order)) {
+		std::stable_sort(elements->begin(), elements->end(), key_order);
+	}
+	// Keep the last of each run of equal keys.
+	auto out = elements->begin();
+	for(auto it = elements->begin(); it != elements->end(); ++it) {
+		auto next = it + 1;
+		if(next != elements->end() && keys_equal(it->first, next->first)) {
+			continue;
+		}
+		if(out != it) {
+			*out = std::move(*it);
+		}
+		++out;
+	}
+	elements_.reserve(out - elements->begin());
+	elements_.insert(elements_.end(), std::make_move_iterator(elements->begin()), std::make_move_iterator(out));
+	elements->clear();
+}
+
+variant_map::iterator variant_map::find(const variant& key)
+{
+	auto it = std::lower_bound(elements_.begin(), elements_.end(), key, key_less);
+	return it != elements_.end() && keys_equal(it->first, key) ? it : elements_.end();
+}
+
+variant_map::const_iterator variant_map::find(const variant& key) const
+{
+	auto it = std::lower_bound(elements_.begin(), elements_.end(), key, key_less);
+	return it != elements_.end() && keys_equal(it->first, key) ? it : elements_.end();
+}
+
+variant_map::const_iterator variant_map::find(const std::string& key) const
+{
+	// Same ordering as variant::operator<, where all strings sort together by value.
+	auto it = std::lower_bound(elements_.begin(), elements_.end(), key, [](const value_type& a, const std::string& k) {
+		return a.first.type_ != variant::VARIANT_TYPE_STRING ? a.first.type_ < variant::VARIANT_TYPE_STRING : compare_strings(a.first.str(), k) < 0;
+	});
+	return it != elements_.end() && it->first.type_ == variant::VARIANT_TYPE_STRING && compare_strings(it->first.str(), key) == 0 ? it : elements_.end();
+}
+
+size_t variant_map::erase(const variant& key)
+{
+	auto it = find(key);
+	if(it == elements_.end()) {
+		return 0;
+	}
+	elements_.erase(it);
+	return 1;
+}
+
+variant& variant_map::operator[](const variant& key)
+{
+	auto it = std::lower_bound(elements_.begin(), elements_.end(), key, key_less);
+	if(it == elements_.end() || !keys_equal(it->first, key)) {
+		it = elements_.insert(it, value_type(key, variant()));
+	}
+	return it->second;
+}
+
+UNIT_TEST(variant_map)
+{
+	std::vector<variant_map::value_type> elements;
+	elements.emplace_back(variant(std::string("b")), variant(1));
+	elements.emplace_back(variant(std::string("a")), variant(2));
+	elements.emplace_back(variant(std::string("b")), variant(3));
+	variant_map m(&elements);
+	CHECK_EQ(m.size(), 2);
+	CHECK_EQ(m.begin()->first.as_string(), "a");
+	CHECK_EQ(m.find(std::string("b"))->second.as_int(), 3);
+	CHECK(m.find(std::string("c")) == m.end(), "found missing key");
+	m[variant(std::string("c"))] = variant(4);
+	CHECK_EQ(m.size(), 3);
+
+	// Copies share storage until one of them is modified.
+	variant v(&m);
+	variant copy = v;
+	copy.as_mutable_map()[variant(std::string("a"))] = variant(5);
+	CHECK_EQ(v["a"].as_int(), 2);
+	CHECK_EQ(copy["a"].as_int(), 5);
+	CHECK_EQ(sizeof(variant), 16);
+}
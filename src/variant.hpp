@@ -2,13 +2,22 @@
 
 #include <map>
 #include <string>
+#include <utility>
 #include <vector>
 #include <cstdint>
 
+#include <boost/utility/string_ref.hpp>
+
+#include "variant_arena.hpp"
+
 class variant;
-typedef std::map<variant,variant> variant_map;
-typedef std::vector<variant> variant_list;
+class variant_map;
+typedef std::vector<variant, arena_allocator<variant>> variant_list;
+typedef std::basic_string<char, std::char_traits<char>, arena_allocator<char>> variant_string;
 
+// Strings, lists and maps are held in reference counted storage which is shared between copies,
+// so copying a variant is cheap. The storage is copied on write if it's shared, or was allocated
+// from an arena, when as_mutable_list() or as_mutable_map() is called.
 class variant
 {
 public:
@@ -25,6 +34,7 @@ public:
 
 	variant();
 	variant(const variant&);
+	variant(variant&&);
 	explicit variant(int64_t);
 	explicit variant(int);
 	explicit variant(float);
@@ -32,8 +42,19 @@ public:
 	explicit variant(const std::string&);
 	explicit variant(const variant_map&);
 	explicit variant(const variant_list&);
+	explicit variant(const std::vector<variant>&);
 	explicit variant(std::vector<variant>* list);
 	explicit variant(variant_map* vmap);
+	~variant();
+
+	// Used when building trees, the storage is allocated from arena unless it's null. The list
+	// elements are moved from and the map elements may be in any order, see variant_map.
+	static variant create_string(const char* s, size_t size, variant_arena* arena);
+	static variant create_list(variant* first, variant* last, variant_arena* arena);
+	static variant create_map(std::vector<std::pair<variant, variant>>* elements, variant_arena* arena);
+
+	variant& operator=(const variant&);
+	variant& operator=(variant&&);
 
 	variant_type type() const { return type_; }
 	std::string type_as_string() const;
@@ -42,6 +63,8 @@ public:
 
 	std::string as_string() const;
 	std::string as_string_default(const std::string& s) const;
+	// The characters of a string, valid for as long as a variant holds the string.
+	boost::string_ref as_string_ref() const;
 	int64_t as_int() const;
 	int64_t as_int(int64_t value) const;
 	int as_int32(int value=0) const { return static_cast<int>(as_int(value)); }
@@ -83,21 +106,64 @@ public:
 
 	bool has_key(const variant& v) const;
 	bool has_key(const std::string& key) const;
-			
+
 	void write_json(std::ostream& s, bool pretty=true, int indent=0) const;
 	std::string write_json(bool pretty=true, int indent=0) const;
 
 	std::string to_debug_string() const;
-protected:
 private:
+	friend class variant_map;
+	template<typename T> struct Shared;
+	template<typename T> static Shared<T>* create_shared(T* value, variant_arena* arena);
+	void release();
+	const variant_string& str() const;
+
 	variant_type type_;
+	union {
+		bool b_;
+		int64_t i_;
+		float f_;
+		Shared<variant_string>* s_;
+		Shared<variant_list>* l_;
+		Shared<variant_map>* m_;
+	};
+};
 
-	bool b_;
-	int64_t i_;
-	float f_;
-	std::string s_;
-	variant_map m_;
-	variant_list l_;
+// Map of variants kept as a vector of pairs sorted by key. Variant maps are small, built once
+// and then mostly searched, which this does without the per node allocations of a std::map.
+class variant_map
+{
+public:
+	typedef std::pair<variant, variant> value_type;
+	typedef std::vector<value_type, arena_allocator<value_type>> container_type;
+	typedef container_type::iterator iterator;
+	typedef container_type::const_iterator const_iterator;
+
+	variant_map() : elements_() {}
+	// Takes the pairs in any order, leaving elements empty. Where there are duplicate keys the
+	// last one is used.
+	explicit variant_map(std::vector<value_type>* elements, variant_arena* arena=nullptr);
+
+	iterator begin() { return elements_.begin(); }
+	iterator end() { return elements_.end(); }
+	const_iterator begin() const { return elements_.begin(); }
+	const_iterator end() const { return elements_.end(); }
+	size_t size() const { return elements_.size(); }
+	bool empty() const { return elements_.empty(); }
+	void clear() { elements_.clear(); }
+
+	iterator find(const variant& key);
+	const_iterator find(const variant& key) const;
+	// As find() but without creating a variant for the key.
+	const_iterator find(const std::string& key) const;
+	size_t count(const variant& key) const { return find(key) != end() ? 1 : 0; }
+	size_t erase(const variant& key);
+	variant& operator[](const variant& key);
+
+	bool operator==(const variant_map& other) const { return elements_ == other.elements_; }
+	bool operator!=(const variant_map& other) const { return !(*this == other); }
+private:
+	container_type elements_;
 };
 
 std::ostream& operator<<(std::ostream& os, const variant& n);
@@ -116,4 +182,3 @@ variant quat_to_variant(const glm::quat& v);
 
 glm::vec4 variant_to_vec4(const variant& v);
 variant vec4_to_variant(const glm::vec4& v);
-
@@ -0,0 +1,58 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "asserts.hpp"
+#include "variant_arena.hpp"
+
+namespace
+{
+	const size_t BlockSize = 64 * 1024;
+}
+
+variant_arena::variant_arena()
+	: refs_(1),
+	  blocks_(),
+	  pos_(nullptr),
+	  end_(nullptr),
+	  capacity_(0)
+{
+}
+
+variant_arena::~variant_arena()
+{
+	for(auto block : blocks_) {
+		::operator delete(block);
+	}
+}
+
+variant_arena* variant_arena::create()
+{
+	return new variant_arena();
+}
+
+void variant_arena::release()
+{
+	if(--refs_ == 0) {
+		delete this;
+	}
+}
+
+void* variant_arena::allocate(size_t size, size_t align)
+{
+	ASSERT_LOG(align != 0 && (align & (align - 1)) == 0 && align <= 16, "Bad alignment for arena allocation: " << align);
+	char* p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(pos_) + align - 1) & ~uintptr_t(align - 1));
+	if(pos_ == nullptr || p + size > end_) {
+		// Big allocations get a block to themselves rather than wasting the rest of the current one.
+		const size_t block_size = std::max(BlockSize, size + align);
+		char* block = static_cast<char*>(::operator new(block_size));
+		blocks_.emplace_back(block);
+		capacity_ += block_size;
+		p = reinterpret_cast<char*>((reinterpret_cast<uintptr_t>(block) + align - 1) & ~uintptr_t(align - 1));
+		if(size > BlockSize / 4) {
+			return p;
+		}
+		end_ = block + block_size;
+	}
+	pos_ = p + size;
+	return p;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+// Monotonic allocator for variant trees which are built and destroyed together, such as parsed
+// documents. Nothing is freed until the arena is released by its creator and by every variant
+// allocated from it, at which point all the memory is freed at once.
+// Only the thread building the tree may allocate from it.
+class variant_arena
+{
+public:
+	static variant_arena* create();
+	void add_ref() { ++refs_; }
+	void release();
+
+	void* allocate(size_t size, size_t align);
+	// Total size of the blocks allocated so far.
+	size_t capacity() const { return capacity_; }
+private:
+	variant_arena();
+	~variant_arena();
+	variant_arena(const variant_arena&);
+	void operator=(const variant_arena&);
+
+	std::atomic<int> refs_;
+	std::vector<char*> blocks_;
+	char* pos_;
+	char* end_;
+	size_t capacity_;
+};
+
+// Allocates from an arena if it has one or from the heap otherwise. Copies of containers using
+// it go on the heap, see select_on_container_copy_construction().
+template<typename T>
+class arena_allocator
+{
+public:
+	typedef T value_type;
+	typedef T* pointer;
+	typedef const T* const_pointer;
+	typedef T& reference;
+	typedef const T& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+	template<typename U> struct rebind { typedef arena_allocator<U> other; };
+
+	arena_allocator() : arena_(nullptr) {}
+	explicit arena_allocator(variant_arena* arena) : arena_(arena) {}
+	template<typename U> arena_allocator(const arena_allocator<U>& a) : arena_(a.arena()) {}
+
+	T* allocate(size_t n) {
+		if(arena_) {
+			return static_cast<T*>(arena_->allocate(n * sizeof(T), std::alignment_of<T>::value));
+		}
+		return static_cast<T*>(::operator new(n * sizeof(T)));
+	}
+	void deallocate(T* p, size_t) {
+		if(!arena_) {
+			::operator delete(p);
+		}
+	}
+	template<typename U, typename... Args> void construct(U* p, Args&&... args) {
+		::new(static_cast<void*>(p)) U(std::forward<Args>(args)...);
+	}
+	template<typename U> void destroy(U* p) { p->~U(); }
+	size_t max_size() const { return size_t(-1) / sizeof(T); }
+
+	arena_allocator select_on_container_copy_construction() const { return arena_allocator(); }
+	variant_arena* arena() const { return arena_; }
+
+	template<typename U> bool operator==(const arena_allocator<U>& a) const { return arena_ == a.arena(); }
+	template<typename U> bool operator!=(const arena_allocator<U>& a) const { return arena_ != a.arena(); }
+private:
+	variant_arena* arena_;
+};
@@ -39,7 +39,7 @@ variant_builder& variant_builder::set_value(const std::string& name, const varia
 
 variant variant_builder::build()
 {
-	std::map<variant, variant> res;
+	variant_map res;
 	for(auto& i : attr_) {
 		if(i.second.size() == 1) {
 			res[i.first] = i.second[0];